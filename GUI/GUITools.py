@@ -1,6 +1,15 @@
 import pygame
 import math
+import numpy as np
 from log import logError, logInfo
+from decoders import DecoderPipeline
+from mathChannels import MathPipeline
+from minMaxPyramid import MinMaxPyramid
+from persistence import PersistenceMap
+from sincInterpolator import SincInterpolator
+from samples import LOGIC_THRESHOLD, LOGIC_HIGH, toArray
+from serialCom import SerialCom, TriggerConfig
+from tracing import span
 
 
 class Point:
@@ -98,6 +107,17 @@ class UserInterface:
     def drawLine(self, start, end, color):
         pygame.draw.line(self.screen, color, (start+self.loc).get(), (end+self.loc).get())
 
+    def drawPolyline(self, xs, ys, color):
+        """Draws line connecting points with provided cords (arrays) clipped to segment"""
+        if len(xs) < 2:
+            return
+        points = np.column_stack((np.clip(xs, -self.size.x, 2 * self.size.x) + self.loc.x,
+                                  np.clip(ys, -self.size.y, 2 * self.size.y) + self.loc.y))
+        clip = self.screen.get_clip()
+        self.screen.set_clip((self.loc.x, self.loc.y, self.size.x + 1, self.size.y + 1))
+        pygame.draw.lines(self.screen, color, False, points.tolist())
+        self.screen.set_clip(clip)
+
     def drawDashedLine(self, start, end, fillness, color):
         """Draws dashed line"""
         start = Point(start)
@@ -137,6 +157,10 @@ class UIGraph(UserInterface):
            size: Point representing size of segment
            division: Tuple containing information about number of divisions on graph
        """
+    MATH_COLORS = [(230, 60, 200), (80, 160, 255), (240, 240, 90), (120, 230, 120)]
+    DEVICE_COLORS = [(0, 200, 255), (255, 80, 80), (150, 255, 100), (230, 230, 230), (200, 120, 255),
+                     (255, 170, 200), (120, 255, 220)]
+
     def __init__(self, screen, location, size, division=(16, 10)):
         super().__init__(screen, location, size)
         self.division = division
@@ -146,6 +170,32 @@ class UIGraph(UserInterface):
         self.scale = [130, 0.5]
         self.freq = 10000
         self.numberOfSamples = 2000
+        self.numberOfSegments = 1
+        self.etsSteps = 1
+        self.decimation = 1
+        self.autoRearm = False
+        self.sampleWidth = 16
+        self.probingMode = SerialCom.PROBING_ANALOG
+        # The highest sample clock at which ADC delivers a new conversion for every reading, None - unknown
+        self.maxFreq = None
+        self.data = None
+        self.pyramid = MinMaxPyramid()
+        self.lanePyramids = []
+        self.overlays = None
+        self.overlayPyramids = []
+        self.mathTraces = None
+        self.mathPyramids = []
+        self.sincInterpolation = False
+        self.deviceTraces = []
+        self.devicePyramids = {}
+        self.mask = None
+        self.maskPyramids = []
+        self.violations = None
+        self.interpolator = SincInterpolator()
+        self.persistence = None
+        self.persistenceView = None
+        self.annotationFont = pygame.font.SysFont("monospace", 12)
+        self.annotationHeight = 18
 
     def drawBackground(self):
         """Clears segment and draws divisions"""
@@ -177,54 +227,304 @@ class UIGraph(UserInterface):
         self.scale[0] = round(max(self.scale[0] + scale[0], 0.1), 2)
         self.scale[1] = round(max(self.scale[1] + scale[1], 0.1), 2)
 
+    def isDigital(self):
+        return self.probingMode == SerialCom.PROBING_DIGITAL
+
     def incFreq(self, freq):
-        """Increses freqency of samples probing"""
+        """Increses freqency of samples probing - within range of timer of logic analyser in digital mode.
+           In analog mode sample clock (with averaging and ETS phases) is kept within rate of ADC conversions"""
         if self.freq < 500:
             freq //= 10
         self.freq = max(self.freq + freq, 1)
+        if self.isDigital():
+            self.freq = min(max(self.freq, SerialCom.MIN_LOGIC_FREQ), SerialCom.MAX_LOGIC_FREQ)
+        elif self.maxFreq:
+            self.freq = max(min(self.freq, self.maxFreq // (self.decimation * self.etsSteps)), 1)
 
     def incNumberOfSamples(self, samples):
-        """Increases number of samples"""
-        self.numberOfSamples = max(self.numberOfSamples + samples, 1)
+        """Increases number of samples up to the number which fits in memory of device with current sample width.
+           Logic analyser stores runs, so its limit does not depend on memory"""
+        if self.isDigital():
+            limit = SerialCom.MAX_LOGIC_SAMPLES
+        else:
+            limit = SerialCom.maxNumberOfSamples(self.sampleWidth, self.numberOfSegments, self.autoRearm)
+        self.numberOfSamples = min(max(self.numberOfSamples + samples, 1), limit)
+
+    def sampleRate(self):
+        """Returns rate of samples in displayed record - in equivalent-time mode it is multiple of probing frequency"""
+        return self.freq * self.etsSteps
 
     def getParams(self):
         """Returns string containing information of current graph settings"""
-        return str(round(self.scale[0] / self.freq * 1000, 1)) + 'ms/div', \
+        if self.isDigital():
+            return str(round(self.scale[0] / self.sampleRate() * 1000, 3)) + 'ms/div', 'logic', \
+                   str(round(self.sampleRate() / 1000, 1)) + 'kHz', str(self.numberOfSamples)
+        return str(round(self.scale[0] / self.sampleRate() * 1000, 3 if self.etsSteps > 1 else 1)) + 'ms/div' + \
+               (' sinc' if self.sincInterpolation else ''), \
                str(self.scale[1]) + 'V/div', \
-               str(round(self.freq / 1000, 1)) + 'kHz', \
-               str(self.numberOfSamples)
+               str(round(self.sampleRate() / 1000, 1)) + 'kHz' + (' ETS' if self.etsSteps > 1 else '') + \
+               (' avg' + str(self.decimation) if self.decimation > 1 else '') + (' rearm' if self.autoRearm else ''), \
+               str(self.numberOfSamples) + (' {}bit'.format(self.sampleWidth) if self.sampleWidth != 16 else '')
 
     def scaleCords(self, cords):
         """Hepler method used to scale points before drawing them on screen"""
         assert (type(cords) == tuple)
         return Point((self.size.x / 16 * cords[0] / self.scale[0], (-1) * self.size.y / 10 * cords[1] / self.scale[1]))
 
-    def draw(self, data=None):
+    def scaleX(self, no):
+        """Returns X cord on screen of sample with provided number"""
+        return self.size.x / 16 * no / self.scale[0] + self.startOfCord.x
+
+    def scaleY(self, value):
+        """Returns Y cord on screen of provided voltage"""
+        return (-1) * self.size.y / 10 * value / self.scale[1] + self.startOfCord.y
+
+    def laneY(self, lane):
+        """Returns function converting voltage of digital lane to Y cord - lanes of inputs are stacked
+           from D0 at the top, logical one fills 60% of lane height"""
+        height = self.size.y / SerialCom.LOGIC_CHANNELS
+        bottom = height * (lane + 0.8)
+        return lambda value: bottom - np.asarray(value) / LOGIC_HIGH * height * 0.6
+
+    def visibleSamples(self):
+        """Returns range of sample numbers which are located inside graph"""
+        samplesPerPixel = 16 * self.scale[0] / self.size.x
+        return -self.startOfCord.x * samplesPerPixel, (self.size.x - self.startOfCord.x) * samplesPerPixel
+
+    def setData(self, data):
+        """Selects samples to be displayed - single channel or list of lanes of logic analyser.
+            Min/max pyramids are built only when new capture is provided
+            Returns True if capture has changed"""
+        if data is self.data:
+            return False
+        self.data = data
+        if type(data) == list and data and isinstance(data[0], np.ndarray):
+            self.lanePyramids = [MinMaxPyramid(lane) for lane in data]
+            self.pyramid = MinMaxPyramid()
+        else:
+            self.lanePyramids = []
+            self.pyramid = MinMaxPyramid(toArray(data))
+        return True
+
+    def setOverlays(self, overlays):
+        """Selects additional captures drawn behind the main one"""
+        if overlays is self.overlays:
+            return
+        self.overlays = overlays
+        self.overlayPyramids = [MinMaxPyramid(toArray(overlay)) for overlay in overlays] if overlays else []
+
+    def setMathTraces(self, traces):
+        """Selects math traces - list of tuples (MathChannel, values) drawn over capture. Values are
+           shifted left by delay of channel, so filtered signal is aligned with capture"""
+        if traces is self.mathTraces:
+            return
+        self.mathTraces = traces
+        self.mathPyramids = [MinMaxPyramid(values[channel.delay:]) for channel, values in traces] if traces else []
+
+    def mathScale(self, channel, pyramid):
+        """Returns tuple (function converting values of math trace to Y cords, label of trace).
+           Traces in other units than volts are scaled to fit in 4 divisions above and below zero"""
+        if channel.unit == 'V':
+            return self.scaleY, channel.name
+        peak = max(abs(float(np.min(pyramid.samples()))), abs(float(np.max(pyramid.samples()))), 1e-9)
+        exponent = 10 ** math.floor(math.log10(peak / 4))
+        perDiv = next(step * exponent for step in (1, 2, 5, 10) if step * exponent >= peak / 4)
+        scaleY = lambda value: (-1) * self.size.y / 10 * np.asarray(value) / perDiv + self.startOfCord.y
+        return scaleY, '{} {:g}{}/div'.format(channel.name, perDiv, channel.unit)
+
+    def drawMathTraces(self):
+        """Draws math traces in their colors, labelled in the bottom right corner"""
+        for no, ((channel, _), pyramid) in enumerate(zip(self.mathTraces, self.mathPyramids)):
+            if len(pyramid) < 2:
+                continue
+            color = self.MATH_COLORS[no % len(self.MATH_COLORS)]
+            scaleY, label = self.mathScale(channel, pyramid)
+            self.drawTrace(pyramid, color, scaleY=scaleY, interpolate=self.sincInterpolation)
+            self.printText(label, Point((self.size.x - 150, self.size.y - 20 * (no + 1))), color)
+
+    def setDeviceTraces(self, traces):
+        """Selects captures of other devices - list of tuples (values, offset in samples, label).
+           Pyramid is built only for capture which has not been drawn before"""
+        self.deviceTraces = traces or []
+        self.devicePyramids = {id(values): self.devicePyramids.get(id(values)) or (values, MinMaxPyramid(values))
+                               for values, _, _ in self.deviceTraces}
+
+    def drawDeviceTraces(self):
+        """Draws captures of other devices on time axis of the main one, labelled in the bottom left corner"""
+        for no, (values, offset, label) in enumerate(self.deviceTraces):
+            color = self.DEVICE_COLORS[no % len(self.DEVICE_COLORS)]
+            self.drawTrace(self.devicePyramids[id(values)][1], color, interpolate=self.sincInterpolation,
+                           offset=offset)
+            self.printText(label, Point((5, self.size.y - 20 * (no + 1))), color)
+
+    def setMask(self, mask, violations=None):
+        """Selects mask (see maskTest.Mask) drawn around capture and boolean array of samples
+           of capture outside of it. Pyramids of envelopes are built only when mask changes"""
+        if mask is not self.mask:
+            self.mask = mask
+            self.maskPyramids = [MinMaxPyramid(mask.lower), MinMaxPyramid(mask.upper)] if mask is not None else []
+        self.violations = violations if mask is not None else None
+
+    def drawMask(self):
+        """Draws upper and lower envelope of mask"""
+        for pyramid in self.maskPyramids:
+            self.drawTrace(pyramid, (60, 110, 160))
+
+    def drawViolations(self):
+        """Marks samples of capture outside of mask - one marker per column of graph, with tick at its bottom"""
+        first, last = self.visibleSamples()
+        indices = np.flatnonzero(self.violations[:len(self.pyramid)])
+        indices = indices[(indices >= first) & (indices <= last)]
+        xs, columns = np.unique(np.round(self.scaleX(indices)).astype(int), return_index=True)
+        ys = self.scaleY(self.pyramid.samples()[indices[columns]])
+        for x, y in zip(xs, ys):
+            self.drawLine(Point((x, y - 5)), Point((x, y + 5)), (255, 40, 40))
+            self.drawLine(Point((x, self.size.y - 8)), Point((x, self.size.y)), (255, 40, 40))
+
+    def setPersistence(self, decay):
+        """Enables persistence mode with provided decay factor (1.0 - infinite persistence), None disables it"""
+        if decay is None:
+            self.persistence = None
+        else:
+            self.persistence = PersistenceMap(self.size.get(), decay)
+            self.persistenceView = None
+
+    def isFading(self):
+        """Checks if persistence map should be drawn again, as it has faded since it was drawn last"""
+        return self.persistence is not None and not self.lanePyramids and self.persistence.isFading()
+
+    def columnSpans(self, pyramid):
+        """Returns tuple (xs, tops, bottoms) - for every column of graph covered by trace
+           the lowest and the highest Y cord of trace in that column"""
+        first, last = self.visibleSamples()
+        first, last = max(first, 0), min(last, len(pyramid) - 1)
+        if last <= first:
+            empty = np.zeros(0)
+            return empty, empty, empty
+
+        start, end = self.scaleX(first), self.scaleX(last)
+        if (last - first) > 2 * (end - start):
+            positions, mins, maxs = pyramid.query(first, last + 1, max(int(round(end - start)), 1))
+            return self.scaleX(positions), self.scaleY(maxs), self.scaleY(mins)
+
+        xs = np.arange(math.ceil(start), math.floor(end) + 1)
+        values = self.scaleY(self.valuesAtColumns(pyramid, xs, self.sincInterpolation))
+        nextValues = np.append(values[1:], values[-1:])
+        return xs, np.minimum(values, nextValues), np.maximum(values, nextValues)
+
+    def valuesAtColumns(self, pyramid, xs, sinc, offset=0):
+        """Returns values of trace at provided columns of graph located between samples - interpolated
+           linearly or with band-limited sinc interpolation"""
+        positions = (np.asarray(xs) - self.startOfCord.x) * 16 * self.scale[0] / self.size.x - offset
+        if sinc:
+            return self.interpolator.interpolate(pyramid.samples(), positions)
+        return np.interp(positions, np.arange(len(pyramid)), pyramid.samples())
+
+    def drawPersistence(self, newCapture):
+        """Adds new capture to persistence map and draws it faded by time elapsed since previous draw.
+           Map is cleared when graph is scaled or moved"""
+        view = (tuple(self.scale), self.startOfCord.get())
+        if view != self.persistenceView:
+            self.persistence.clear()
+            self.persistenceView = view
+            newCapture = True
+        if newCapture and len(self.pyramid) > 1:
+            self.persistence.accumulate(*self.columnSpans(self.pyramid))
+        self.screen.blit(self.persistence.render(), self.loc.get())
+
+    def drawTrace(self, pyramid, color, digitalColor=None, scaleY=None, interpolate=False, offset=0):
+        """Draws samples stored in pyramid. When there are more samples than pixels,
+           each column is drawn as line between minimum and maximum of its samples,
+           so the cost depends on width of graph, not on number of samples.
+           scaleY converts values to Y cords, by default voltage scale of graph is used.
+           If interpolate is set and samples are more than 2 pixels apart, trace is reconstructed
+           at every column with sinc interpolation instead of straight lines between samples.
+           offset moves trace right by provided (fractional) number of samples"""
+        scaleY = scaleY or self.scaleY
+        first, last = self.visibleSamples()
+        first, last = first - offset, last - offset
+        if last - first > 2 * self.size.x:
+            positions, mins, maxs = pyramid.query(first, last + 1, self.size.x)
+            xs = np.repeat(self.scaleX(positions + offset), 2)
+            values = np.column_stack((mins, maxs)).reshape(-1)
+        else:
+            first = max(int(first), 0)
+            last = min(int(math.ceil(last)) + 1, len(pyramid))
+            xs = self.scaleX(np.arange(first, last) + offset)
+            values = pyramid.samples()[first:last]
+
+        if interpolate and len(xs) > 1 and xs[1] - xs[0] > 2:
+            columns = np.arange(math.ceil(xs[0]), math.floor(xs[-1]) + 1)
+            self.drawPolyline(columns, scaleY(self.valuesAtColumns(pyramid, columns, True, offset)), color)
+        else:
+            self.drawPolyline(xs, scaleY(values), color)
+        if digitalColor is not None:
+            self.drawPolyline(xs, scaleY(np.where(values > LOGIC_THRESHOLD, LOGIC_HIGH, 0)), digitalColor)
+
+    def drawLanes(self):
+        """Draws every input of logic analyser in its own lane, labelled with its number"""
+        for no, pyramid in enumerate(self.lanePyramids):
+            scaleY = self.laneY(no)
+            self.drawLine(Point((0, scaleY(0))), Point((self.size.x, scaleY(0))), self.divColor)
+            self.drawTrace(pyramid, (0, 166, 147), scaleY=scaleY)
+            self.printText('D{}'.format(no), Point((2, scaleY(LOGIC_HIGH) - 15)), (150, 150, 150))
+
+    def drawAnnotations(self, annotations):
+        """Draws elements decoded by protocol decoders in rows above the trace"""
+        for annotation in annotations:
+            start = max(self.scaleX(annotation.start), 0)
+            end = min(self.scaleX(annotation.end), self.size.x)
+            if end <= start:
+                continue
+            top = 2 + annotation.row * (self.annotationHeight + 2)
+            color = (200, 40, 40) if annotation.isError else (230, 200, 50)
+            if end - start < 4:
+                self.drawLine(Point((start, top)), Point((start, top + self.annotationHeight)), color)
+                continue
+            self.drawRect(Point((start, top)), Point((end - start, self.annotationHeight)), color, 1)
+            for text in annotation.texts:
+                label = self.annotationFont.render(text, 1, color)
+                if label.get_width() + 4 <= end - start:
+                    self.screen.blit(label, (self.loc + Point(((start + end - label.get_width()) / 2,
+                                                               top + (self.annotationHeight - label.get_height()) / 2))).get())
+                    break
+
+    def draw(self, data=None, annotations=None, overlays=None, mathTraces=None, deviceTraces=None, mask=None):
         self.drawBackground()
+        self.setMask(*(mask or (None, )))
+        if self.maskPyramids:
+            self.drawMask()
 
-        if type(data) != list:
+        if type(data) not in (list, np.ndarray):
             data = []
-        lastPoint = None
-        lastInterpolatedPoint = None
-        for point in data:
-            assert (type(point) == tuple)
-            scaledPoint = self.scaleCords(point)
-            interpolatedPoint = self.scaleCords((point[0], 3.3 if point[1] > 1.1 else 0))
-            scaledPoint += self.startOfCord
-            interpolatedPoint += self.startOfCord
-            if self.inScreen(scaledPoint) and lastPoint is not None:
-                self.drawLine(lastPoint, scaledPoint, (255, 126, 0))
-            if self.inScreen(interpolatedPoint) and lastInterpolatedPoint is not None:
-                self.drawLine(lastInterpolatedPoint, interpolatedPoint, (0, 166, 147))
-            lastPoint = scaledPoint
-            lastInterpolatedPoint = interpolatedPoint
+        self.setOverlays(overlays)
+        for pyramid in self.overlayPyramids:
+            self.drawTrace(pyramid, (110, 55, 0), interpolate=self.sincInterpolation)
+        newCapture = self.setData(data)
+        if self.lanePyramids:
+            self.drawLanes()
+        elif self.persistence is not None:
+            self.drawPersistence(newCapture)
+        else:
+            self.drawTrace(self.pyramid, (255, 126, 0), (0, 166, 147), interpolate=self.sincInterpolation)
+        self.setDeviceTraces(deviceTraces)
+        if not self.lanePyramids:
+            self.drawDeviceTraces()
+        if self.violations is not None and self.violations.any() and not self.lanePyramids:
+            self.drawViolations()
+        self.setMathTraces(mathTraces)
+        if self.mathPyramids:
+            self.drawMathTraces()
+
+        if annotations:
+            self.drawAnnotations(annotations)
 
 
 class UIStatus(UserInterface):
     def __init__(self, screen, location, size):
         super().__init__(screen, location, size)
 
-    def draw(self, graphParams=("None", "None"), triggerParams=""):
+    def draw(self, graphParams=("None", "None"), triggerParams="", info=""):
         self.clearView()
         pygame.draw.line(self.screen, (50, 50, 50), (self.loc.x, (self.loc + self.size).y),
                          (self.loc + self.size).get(), 1)
@@ -237,15 +537,36 @@ class UIStatus(UserInterface):
                                w3=max(10 - len(graphParams[2]), 0),
                                w4=max(10 - len(graphParams[3]), 0)),
                        Point((0, 0)), (255, 255, 255))
+        if info:
+            label = self.font.render(info, 1, (255, 200, 0))
+            self.screen.blit(label, (self.loc + Point((self.size.x - label.get_width() - 5, 0))).get())
 
 
 class UITrigger(UserInterface):
+    """Arrow showing trigger level and condition of trigger selected in GUI
+
+       Attributes:
+           condition: index in ANALOG_CONDITIONS or DIGITAL_CONDITIONS - tuples (label, type, negative, longer)
+           width: limit of pulse width in seconds
+           upperLevel: upper level of runt trigger in volts
+           pattern: tuple (pattern, mask) of digital inputs
+       """
+    ANALOG_CONDITIONS = [('', TriggerConfig.LEVEL, False, False),
+                         ('P+<', TriggerConfig.PULSE, False, False), ('P+>', TriggerConfig.PULSE, False, True),
+                         ('P-<', TriggerConfig.PULSE, True, False), ('P->', TriggerConfig.PULSE, True, True),
+                         ('runt+', TriggerConfig.RUNT, False, False), ('runt-', TriggerConfig.RUNT, True, False)]
+    DIGITAL_CONDITIONS = [('any', TriggerConfig.LEVEL, False, False), ('', TriggerConfig.PATTERN, False, False)]
+
     def __init__(self, screen, location, size):
         super().__init__(screen, location, size)
 
         self.arrowHeight = 20
         self.arrowWidthRatio = 2 / 3
         self.triggerLevel = 1.2
+        self.condition = 0
+        self.width = 1e-4
+        self.upperLevel = 2.5
+        self.pattern = (1, 1)
 
     def setTriggerLevel(self, trigger):
         self.triggerLevel = trigger
@@ -253,11 +574,55 @@ class UITrigger(UserInterface):
     def incTriggerLevel(self, trigger):
         self.triggerLevel += trigger
 
+    def conditions(self, digital):
+        return self.DIGITAL_CONDITIONS if digital else self.ANALOG_CONDITIONS
+
+    def nextCondition(self, digital, ets=False):
+        """Selects the next trigger condition - only level trigger is available in equivalent-time sampling"""
+        self.condition = 0 if ets else (self.condition + 1) % len(self.conditions(digital))
+
+    def incParameter(self, up, digital=False):
+        """Doubles (or halves) limit of pulse width, or moves upper level of runt trigger by 0.1V"""
+        type = self.conditions(digital)[self.condition][1]
+        if type == TriggerConfig.PULSE:
+            self.width = min(max(self.width * (2 if up else 0.5), 1e-6), 10)
+        elif type == TriggerConfig.RUNT:
+            self.upperLevel = round(min(max(self.upperLevel + (0.1 if up else -0.1), 0), 3.3), 2)
+
+    def toConfig(self, digital, sampleClock):
+        """Returns TriggerConfig of selected condition, width is converted to ticks of sample clock"""
+        _, type, negative, longer = self.conditions(digital)[self.condition]
+        return TriggerConfig(type, negative, longer, self.upperLevel, max(round(self.width * sampleClock), 1),
+                             *self.pattern)
+
+    def fromConfig(self, config, digital, sampleClock):
+        """Selects condition read from device"""
+        self.condition = 0
+        for i, (_, type, negative, longer) in enumerate(self.conditions(digital)):
+            if (type, negative, longer) == (config.type, config.negative, config.longer):
+                self.condition = i
+        if config.type == TriggerConfig.PULSE:
+            self.width = config.width / sampleClock
+        elif config.type == TriggerConfig.RUNT:
+            self.upperLevel = config.upperLevel
+        elif config.type == TriggerConfig.PATTERN:
+            self.pattern = (config.pattern, config.mask)
+
     def scaleY(self, scale, y):
         return (-1) * self.size.y / 10 * y / scale[1]
 
-    def getParams(self):
-        return str(round(self.triggerLevel, 2)) + 'V'
+    def getParams(self, digital=False):
+        label, type, _, _ = self.conditions(digital)[self.condition]
+        if type == TriggerConfig.PATTERN:
+            return TriggerConfig.formatPattern(*self.pattern)
+        if digital:
+            return label
+        text = str(round(self.triggerLevel, 2)) + 'V'
+        if type == TriggerConfig.PULSE:
+            text += ' {}{:g}us'.format(label, round(self.width * 1e6, 1))
+        elif type == TriggerConfig.RUNT:
+            text += ' {} {:g}V'.format(label, self.upperLevel)
+        return text
 
     def drawArrow(self, color, text, scale):
         posOfMiddle = self.size / 2 + (0, self.scaleY(scale, self.triggerLevel))
@@ -306,14 +671,27 @@ class GUI:
         self.graph = UIGraph(self.screen, (35, 21), (800, 600))
         self.status = UIStatus(self.screen, (0, 0), (835, 20))
         self.trigger = UITrigger(self.screen, (0, 21), (35, 600))
+        self.decoders = DecoderPipeline()
+        self.math = MathPipeline()
 
-    def draw(self, exData, msg=None):
+    def draw(self, exData, msg=None, overlays=None, info='', continuous=False, deviceTraces=None, mask=None):
+        """Draws whole window. continuous indicates that capture follows the previous one (auto re-arm),
+           so math channels keep their state. deviceTraces are captures of other devices
+           (see UIGraph.setDeviceTraces), mask is tuple (Mask, violations) (see UIGraph.setMask)"""
         self.screen.fill((0, 0, 0))
 
-        self.graph.draw(exData)
-        self.status.draw(graphParams=self.graph.getParams(), triggerParams=self.trigger.getParams())
-        self.trigger.draw(self.graph.scale)
-
-        if msg is not None:
-            MessageBox(self.screen, self.DFT_MSGBOX_LOC, self.DFT_MSGBOX_SIZE, msg).draw()
-        pygame.display.update()
+        sampleRate = self.graph.sampleRate()
+        with span('decode'):
+            annotations = self.decoders.run(exData, sampleRate)
+        with span('math'):
+            mathTraces = self.math.run(exData, sampleRate, continuous)
+        with span('render'):
+            self.graph.draw(exData, annotations, overlays, mathTraces, deviceTraces, mask)
+            self.status.draw(graphParams=self.graph.getParams(),
+                             triggerParams=self.trigger.getParams(self.graph.isDigital()), info=info)
+            self.trigger.draw(self.graph.scale)
+
+            if msg is not None:
+                MessageBox(self.screen, self.DFT_MSGBOX_LOC, self.DFT_MSGBOX_SIZE, msg).draw()
+        with span('display flip'):
+            pygame.display.update()
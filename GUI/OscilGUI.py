@@ -1,116 +1,767 @@
 #!/usr/bin/env python3
-import sys
+import argparse
 from log import logInfo, logError
 from GUITools import GUI
-from serialCom import SerialCom
+from serialCom import SerialCom, AcquisitionConfig, TriggerConfig, AdcTiming
+from decoders import UARTDecoder
+from mathChannels import MovingAverage, LowPass, BandPass, SinglePoleIIR, Derivative, Integral, \
+    Difference, Product
+from recording import Capture, Recorder, Replay
+from ets import reconstruct
+from autoSet import autoSet
+from samples import expandRuns, toLanes, toArray
+from oscilClient import Oscilloscope, OscilError, triggerTime
+from oscilBroker import Subscriber
+from maskTest import Mask, MaskTester, DFT_TOLERANCE, DFT_TIME_TOLERANCE
+from streamExport import CaptureSource, ExportJob, ReplaySource, exportFormat
+import tracing
 import pygame
-from time import sleep
+from time import sleep, time
+import os
+import threading
+import numpy as np
 import serial
 
 expectingData = False
+# Segments of the last segmented capture - list of tuples (timestamp, data)
+segments = []
+currentSegment = 0
+# List of all segments drawn behind the selected one, None if disabled
+segmentOverlays = None
+# Indicates that settings of device have been changed in GUI and not sent yet
+configChanged = False
+# Indicates that device captures in auto re-arm mode and request for the next capture is pending
+streaming = False
+# Time at which DOWNLOAD_NEXT is sent again after device had no capture ready, None if request is pending
+nextRequestTime = None
+NEXT_RETRY_INTERVAL = 0.02
+# Other devices (--device) - Oscilloscope objects, each with its own worker thread
+devices = []
+# Pending capture (future) and the last received Capture of each of other devices
+deviceFutures = []
+deviceCaptures = []
+# Host time at which displayed capture of the main device was triggered
+triggerTimestamp = None
+# Indicates that arm and trigger now of the main device are broadcast to other devices
+sharedArm = False
+# Mask test of new captures (MaskTester) - None if disabled, and options of masks from command line
+maskTester = None
+maskOptions = None
+# File spans of pipeline are written to (--trace), None if tracing is disabled
+traceFile = None
+# File captures are exported to with F9 (--export), export running in background and its state last drawn
+exportPath = None
+exportJob = None
+exportInfo = ''
 
 
 ################################
 # Main program
 ################################
-def processUserInput(gui, serial):
-    global expectingData
+def processUserInput(gui, serial, replay=None):
+    """Handles all pending events from pygame. Without device (serial is None) commands for device are
+       ignored, with replay they are replaced with selecting captures from recording. Settings of device are only
+       changed in GUI here and sent by applyConfig() once per frame, so rapid key presses result in a single command.
+       Returns True if anything has changed"""
+    global expectingData, segments, currentSegment, segmentOverlays, configChanged
     scaleGraphLUT = {pygame.K_UP: (0, 0.1), pygame.K_DOWN: (0, -0.1), pygame.K_LEFT: (-0.1, 0),
                      pygame.K_RIGHT: (0.1, 0)}
     posGraphLUT = {pygame.K_a: (10, 0), pygame.K_d: (-10, 0)}
     scaleTriggerLUT = {pygame.K_i: 0.1, pygame.K_j: -0.1}
     freqLUT = {pygame.K_z: 10000, pygame.K_x: -10000}
     samplesLUT = {pygame.K_n: -100, pygame.K_m: 100}
+    persistenceModes = [None, 0.85, 1.0]
+    segmentLUT = {pygame.K_k: -1, pygame.K_l: 1}
+    replayLUT = {pygame.K_PAGEUP: -1, pygame.K_PAGEDOWN: 1, pygame.K_HOME: -1e12, pygame.K_END: 1e12}
+    mathLUT = {pygame.K_1: MovingAverage, pygame.K_2: LowPass, pygame.K_3: BandPass, pygame.K_4: SinglePoleIIR,
+               pygame.K_5: Derivative, pygame.K_6: Integral, pygame.K_7: Difference, pygame.K_8: Product}
+    changed = False
+    analog = not gui.graph.isDigital()
     for event in pygame.event.get():
         if event.type == pygame.QUIT:
             logInfo('Exiting...')
+            if traceFile is not None:
+                logInfo('Written {} trace events to {}'.format(tracing.dump(traceFile), traceFile))
             pygame.quit()
             exit(0)
         elif event.type == pygame.KEYDOWN:
+            changed = True
             if event.key in scaleGraphLUT:
                 gui.graph.incScale(scaleGraphLUT[event.key])
-                return True
-            elif event.key in scaleTriggerLUT:
-                gui.trigger.incTriggerLevel(scaleTriggerLUT[event.key])
-                serial.setTriggerLevel(gui.trigger.triggerLevel)
-                return True
             elif event.key in posGraphLUT:
                 gui.graph.incPos(posGraphLUT[event.key])
-                return True
+            elif event.key == pygame.K_u:
+                gui.decoders.toggle(UARTDecoder)
+            elif event.key in mathLUT:
+                gui.math.toggle(mathLUT[event.key])
+            elif event.key in segmentLUT and segments:
+                currentSegment = min(max(currentSegment + segmentLUT[event.key], 0), len(segments) - 1)
+            elif event.key == pygame.K_y and segments:
+                segmentOverlays = None if segmentOverlays is not None else [data for _, data in segments]
+            elif event.key == pygame.K_F12 and traceFile is not None:
+                logInfo('Written {} trace events to {}'.format(tracing.dump(traceFile), traceFile))
+            elif event.key == pygame.K_F9:
+                startExport(gui, replay)
+            elif event.key == pygame.K_q:
+                gui.graph.sincInterpolation = not gui.graph.sincInterpolation
+            elif event.key == pygame.K_h:
+                current = None if gui.graph.persistence is None else gui.graph.persistence.decay
+                gui.graph.setPersistence(persistenceModes[(persistenceModes.index(current) + 1) % len(persistenceModes)])
+            elif serial is None:
+                if replay is not None and event.key in replayLUT:
+                    replay.seek(replay.position + replayLUT[event.key])
+            elif event.key in scaleTriggerLUT:
+                gui.trigger.incTriggerLevel(scaleTriggerLUT[event.key])
+                configChanged = True
+            elif event.key == pygame.K_v:
+                gui.trigger.nextCondition(not analog, gui.graph.etsSteps > 1)
+                configChanged = True
+            elif event.key == pygame.K_t:
+                gui.trigger.incParameter(not event.mod & pygame.KMOD_SHIFT, not analog)
+                configChanged = True
             elif event.key in freqLUT:
                 gui.graph.incFreq(freqLUT[event.key])
-                serial.setPrecision(gui.graph.freq)
-                return True
+                configChanged = True
+            elif event.key == pygame.K_c and analog:
+                # Average 1, 2, 4, ... readings into one sample, sample clock is faster by the same factor
+                gui.graph.decimation = gui.graph.decimation * 2 if gui.graph.decimation < serial.MAX_DECIMATION else 1
+                gui.graph.incFreq(0)
+                configChanged = True
             elif event.key in samplesLUT:
                 gui.graph.incNumberOfSamples(samplesLUT[event.key])
-                if serial.setNumberOfSamples(gui.graph.numberOfSamples):
-                    gui.graph.incNumberOfSamples(samplesLUT[event.key] * (-1))
-                return True
+                configChanged = True
+            elif event.key == pygame.K_g:
+                toggleDigital(gui)
+            elif event.key == pygame.K_f and analog:
+                runAutoSet(gui, serial)
+            elif event.key == pygame.K_e and analog:
+                toggleEts(gui)
+            elif event.key == pygame.K_r and analog:
+                toggleAutoRearm(gui)
+            elif event.key == pygame.K_w and analog:
+                switchSampleWidth(gui)
+            elif event.key == pygame.K_s and analog and gui.graph.etsSteps == 1:
+                if gui.graph.numberOfSegments == 1:
+                    count = serial.maxNumberOfSegments(gui.graph.numberOfSamples, gui.graph.sampleWidth)
+                else:
+                    count = 1
+                if count != gui.graph.numberOfSegments:
+                    gui.graph.numberOfSegments = count
+                    gui.graph.autoRearm = False
+                    segments, segmentOverlays = [], None
+                    configChanged = True
             elif event.key == pygame.K_SPACE:
-                if serial.triggerNow() == 0:
-                    expectingData = True
-                return True
+                startCapture(gui, serial, serial.triggerNow)
             elif event.key == pygame.K_o:
-                serial.turnOff()
-                return True
+                stopStreaming(serial)
             elif event.key == pygame.K_p:
-                if serial.trigMode() == 0:
-                    expectingData = True
-                return True
+                startCapture(gui, serial, serial.trigMode)
+            elif event.key == pygame.K_b and analog:
+                toggleMask(gui)
+            else:
+                changed = False
         elif event.type == pygame.MOUSEBUTTONDOWN:
             if event.button == 4:
                 gui.graph.incScale((0.5, 0))
-                return True
+                changed = True
             elif event.button == 5:
                 gui.graph.incScale((-0.5, 0))
-                return True
-    return False
+                changed = True
+    return changed
+
+
+def configFromGui(gui):
+    """Returns acquisition parameters selected in GUI"""
+    return AcquisitionConfig(gui.trigger.triggerLevel, gui.graph.probingMode, gui.graph.freq,
+                             gui.graph.numberOfSamples, gui.graph.numberOfSegments, gui.graph.etsSteps,
+                             gui.graph.decimation, gui.graph.autoRearm, gui.graph.sampleWidth)
+
+
+def syncConfig(gui, serial, config=None):
+    """Reads acquisition parameters from device (unless provided) and shows them in GUI. Returns False on failure"""
+    global segments, segmentOverlays
+    if config is None:
+        config = serial.getConfig()
+    if config is None:
+        logError('Could not read configuration of device')
+        return False
+    gui.trigger.setTriggerLevel(config.triggerLevel)
+    gui.graph.freq, gui.graph.numberOfSamples, gui.graph.decimation = config.freq, config.numberOfSamples, \
+        config.decimation
+    gui.graph.autoRearm, gui.graph.sampleWidth = config.autoRearm, config.sampleWidth
+    gui.graph.probingMode = config.mode
+    trigger = serial.getTriggerConfig()
+    if trigger is not None:
+        gui.trigger.fromConfig(trigger, gui.graph.isDigital(), config.freq * config.decimation)
+    if (config.numberOfSegments, config.etsSteps) != (gui.graph.numberOfSegments, gui.graph.etsSteps):
+        gui.graph.numberOfSegments, gui.graph.etsSteps = config.numberOfSegments, config.etsSteps
+        segments, segmentOverlays = [], None
+    return True
+
+
+def applyConfig(gui, serial):
+    """Sends settings changed since previous frame in one SET_CONFIG command followed by trigger condition.
+       If device refuses them, GUI returns to settings of device"""
+    global configChanged
+    if not configChanged:
+        return True
+    configChanged = False
+    restart = streaming
+    if restart:
+        # Device captures continuously in auto re-arm mode - it is stopped for the time of change
+        stopStreaming(serial)
+    status = serial.setConfig(configFromGui(gui))
+    if status == 0:
+        trigger = gui.trigger.toConfig(gui.graph.isDigital(), gui.graph.freq * gui.graph.decimation)
+        status = serial.setTriggerConfig(trigger)
+    if status == 0:
+        configureDevices(gui, trigger)
+    if status != 0:
+        logError('Device refused configuration ({})'.format('busy' if status == 2 else 'invalid settings'))
+        syncConfig(gui, serial)
+    if restart:
+        startCapture(gui, serial, serial.trigMode)
+    return status == 0
+
+
+def toggleEts(gui):
+    """Switches equivalent-time sampling - every trigger fills one segment sampled with different phase"""
+    global segments, segmentOverlays, configChanged
+    if gui.graph.etsSteps == 1:
+        steps = min(SerialCom.MAX_ETS_STEPS,
+                    SerialCom.maxNumberOfSegments(gui.graph.numberOfSamples, gui.graph.sampleWidth))
+        if steps < 2:
+            logError('Number of samples is too high for equivalent-time sampling')
+            return
+    else:
+        steps = 1
+    gui.graph.numberOfSegments = gui.graph.etsSteps = steps
+    gui.graph.autoRearm = False
+    gui.graph.incFreq(0)
+    # Pulse and runt triggers need continuous samples
+    if steps > 1:
+        gui.trigger.condition = 0
+    segments, segmentOverlays = [], None
+    configChanged = True
+
+
+def toggleAutoRearm(gui):
+    """Switches auto re-arm mode - device fills one half of memory while the other one is downloaded,
+       so captures are shown as fast as link allows. Segmented capture and ETS are disabled"""
+    global segments, segmentOverlays, configChanged
+    gui.graph.autoRearm = not gui.graph.autoRearm
+    if gui.graph.autoRearm:
+        gui.graph.numberOfSegments = gui.graph.etsSteps = 1
+        gui.graph.numberOfSamples = min(gui.graph.numberOfSamples,
+                                        SerialCom.maxNumberOfSamples(gui.graph.sampleWidth, autoRearm=True))
+        segments, segmentOverlays = [], None
+    configChanged = True
+
+
+def toggleDigital(gui):
+    """Switches logic analyser mode - inputs PA0-PA7 are sampled together and drawn in separate lanes.
+       Frequency and number of samples are limited to ranges of logic analyser, segmented capture, ETS,
+       averaging and auto re-arm are disabled"""
+    global segments, segmentOverlays, configChanged
+    graph = gui.graph
+    if graph.isDigital():
+        graph.probingMode = SerialCom.PROBING_ANALOG
+    else:
+        graph.probingMode = SerialCom.PROBING_DIGITAL
+        graph.numberOfSegments = graph.etsSteps = graph.decimation = 1
+        graph.autoRearm = False
+        segments, segmentOverlays = [], None
+    gui.trigger.condition = 0
+    graph.incFreq(0)
+    graph.incNumberOfSamples(0)
+    configChanged = True
+
+
+def switchSampleWidth(gui):
+    """Switches bits of sample stored by device (16, 12, 8) - narrower samples allow longer captures.
+       Number of samples is reduced if it does not fit in memory with new width"""
+    global configChanged
+    widths = SerialCom.SAMPLE_WIDTHS
+    gui.graph.sampleWidth = widths[(widths.index(gui.graph.sampleWidth) + 1) % len(widths)]
+    gui.graph.incNumberOfSamples(0)
+    configChanged = True
+
+
+def startCapture(gui, serial, command):
+    """Sends pending settings and arms device with provided command (TRIG_NOW or TRIG_MODE).
+       In auto re-arm mode the first capture is requested at once"""
+    global expectingData, streaming, nextRequestTime
+    applyConfig(gui, serial)
+    if command() != 0:
+        return
+    streaming = gui.graph.autoRearm
+    expectingData = not streaming
+    nextRequestTime = None
+    if streaming:
+        serial.requestNext()
+    if sharedArm:
+        armDevices(command == serial.triggerNow)
+
+
+def configureDevices(gui, trigger):
+    """Sends settings of the main device to other ones without waiting for them. Other devices are armed
+       for every capture, so they do not use auto re-arm mode"""
+    config = configFromGui(gui)
+    config.autoRearm = False
+    for no, scope in enumerate(devices):
+        future = scope.submitConfig(config, trigger)
+        future.add_done_callback(lambda future, no=no: reportConfig(future, no))
+
+
+def reportConfig(future, no):
+    """Logs configuration refused by other device - called by its worker thread"""
+    try:
+        if future.result() != 0:
+            logError('Device {} refused configuration'.format(no + 2))
+    except OscilError as e:
+        logError('Device {}: {}'.format(no + 2, e))
+
+
+def connectDevices(ports):
+    """Connects to other devices - their captures are drawn on time axis of the main one"""
+    global deviceFutures, deviceCaptures
+    for port in ports:
+        try:
+            devices.append(Oscilloscope(port))
+        except (OscilError, serial.serialutil.SerialException) as e:
+            logError('Could not connect to device on {}: {}'.format(port, e))
+    deviceFutures = [None] * len(devices)
+    deviceCaptures = [None] * len(devices)
+
+
+def armDevices(immediately):
+    """Arms all other devices at once - device which still waits for trigger is skipped"""
+    for no, scope in enumerate(devices):
+        if deviceFutures[no] is None:
+            deviceFutures[no] = scope.arm(immediately)
+
+
+def pollDevices():
+    """Collects finished captures of other devices without waiting. Without shared arm every device
+       is re-armed at once, so it captures on its own trigger. Returns True if any capture has arrived"""
+    arrived = False
+    for no, future in enumerate(deviceFutures):
+        if future is not None and future.done():
+            deviceFutures[no] = None
+            try:
+                deviceCaptures[no] = future.result()[0]
+                arrived = True
+            except OscilError as e:
+                logError('Device {}: {}'.format(no + 2, e))
+    if not sharedArm:
+        armDevices(False)
+    return arrived
+
+
+def deviceTraces(gui):
+    """Returns captures of other devices placed on time axis of displayed capture (see UIGraph.setDeviceTraces)"""
+    traces = []
+    for no, capture in enumerate(deviceCaptures):
+        if capture is None or len(capture.channels) != 1 or triggerTimestamp is None:
+            continue
+        delay = capture.timestamp - triggerTimestamp
+        traces.append((capture.channels[0], delay * gui.graph.sampleRate(),
+                       'dev{} {:+.3f}ms'.format(no + 2, delay * 1000)))
+    return traces
+
+
+def stopStreaming(serial):
+    """Stops taking samples and drops request for the next capture of auto re-arm mode"""
+    global streaming, nextRequestTime
+    serial.turnOff()
+    nextRequestTime = None
+    if streaming:
+        serial.cancelNext()
+        streaming = False
+
+
+def captureAvailable(serial):
+    """Checks if capture can be downloaded - response to DOWNLOAD_NEXT has started to arrive in auto re-arm
+       mode or armed capture has finished. Request refused by device is sent again after NEXT_RETRY_INTERVAL"""
+    global nextRequestTime
+    if streaming:
+        if nextRequestTime is not None and time() >= nextRequestTime:
+            nextRequestTime = None
+            serial.requestNext()
+        return serial.nextAvailable()
+    return expectingData and serial.isDataAvail()
+
+
+def runAutoSet(gui, serial):
+    """Returns to single capture mode, adjusts settings to current signal and waits for trigger"""
+    global expectingData, segments, segmentOverlays, configChanged
+    if gui.graph.numberOfSegments > 1 or gui.graph.autoRearm:
+        gui.graph.numberOfSegments = gui.graph.etsSteps = 1
+        gui.graph.autoRearm = False
+        segments, segmentOverlays = [], None
+        configChanged = True
+    stopStreaming(serial)
+    if not applyConfig(gui, serial):
+        return
+
+    result = autoSet(serial, gui)
+    if result is None:
+        logError('Auto-set failed - device did not accept settings or capture')
+        syncConfig(gui, serial)
+        return
+    logInfo('Auto-set: ' + result)
+    if serial.trigMode() == 0:
+        expectingData = True
+
+
+def toggleMask(gui):
+    """Starts mask test with mask built from displayed capture or stops it"""
+    global maskTester
+    if maskTester is not None:
+        logInfo('Mask test stopped - {}'.format(maskTester.describe()))
+        maskTester = None
+        return
+    if len(gui.graph.pyramid) < 2:
+        logError('Mask is built from displayed capture - take capture first')
+        return
+    mask = Mask.fromGolden(gui.graph.pyramid.samples(), maskOptions.mask_tolerance, maskOptions.mask_time)
+    if maskOptions.mask is not None:
+        mask.save(maskOptions.mask)
+    maskTester = MaskTester(mask, maskOptions.mask_stop)
+    logInfo('Mask test started')
+
+
+def testMask(serial, captures):
+    """Tests new captures against mask. With --mask-stop the first failing capture stops device, so it stays
+       displayed - returns its number in provided list then, otherwise None"""
+    if maskTester is None or maskTester.isStopped():
+        return None
+    for no, capture in enumerate(captures):
+        if not maskTester.test(capture) and maskTester.isStopped():
+            stopStreaming(serial)
+            logError('Capture has failed mask test - {}'.format(maskTester.describe()))
+            return no
+    return None
+
+
+def describeMask(exData):
+    """Returns tuple (Mask, violations) for UIGraph - samples outside of mask are marked if displayed
+       capture is the last tested one"""
+    if maskTester is None:
+        return None
+    return maskTester.mask, maskTester.violations if maskTester.lastCapture is exData else None
+
+
+def startExport(gui, replay=None):
+    """Starts export of the whole recording in replay, otherwise of displayed capture (all segments of
+       segmented capture) to file from --export. Export runs in background - pressing F9 again cancels it"""
+    global exportJob
+    if exportPath is None:
+        logError('Provide file to export to with --export')
+        return
+    if exportJob is not None and exportJob.is_alive():
+        exportJob.cancel()
+        return
+    if replay is not None:
+        source = ReplaySource(replay)
+    else:
+        data = gui.graph.data
+        if data is None or len(data) == 0:
+            logError('Nothing to export - take capture first')
+            return
+        if type(data) == list and isinstance(data[0], np.ndarray):
+            captures = [Capture(data, gui.graph.sampleRate())]
+        elif segments:
+            captures = [Capture([toArray(segment)], gui.graph.sampleRate()) for _, segment in segments]
+        else:
+            captures = [Capture([toArray(data)], gui.graph.sampleRate())]
+        source = CaptureSource(captures)
+    exportJob = ExportJob(source, exportPath)
+    exportJob.start()
+    logInfo('Exporting {} captures to {}'.format(source.captures, exportPath))
+
+
+def describeExport():
+    """Returns status bar information about the last export and remembers it, so exportUpdated() tells
+       when it should be drawn again"""
+    global exportInfo
+    exportInfo = exportJob.describe() if exportJob is not None else ''
+    return exportInfo
+
+
+def exportUpdated():
+    if exportJob is None or exportJob.describe() == exportInfo:
+        return False
+    if exportJob.finished:
+        logInfo(exportJob.describe())
+    return True
+
+
+def describeSegments(gui):
+    """Returns status bar information about selected segment of segmented capture"""
+    if not segments or gui.graph.etsSteps > 1:
+        return ''
+    offset = ((segments[currentSegment][0] - segments[0][0]) & 0xffffffff) / 1000
+    return 'Seg: {}/{} +{:.3f}ms'.format(currentSegment + 1, len(segments), offset)
+
+
+def replayMain(gui, path):
+    """Displays captures stored in recording file"""
+    try:
+        replay = Replay(path)
+    except (OSError, ValueError) as e:
+        logError('Could not open recording: {}'.format(e))
+        exit(1)
+    if len(replay) == 0:
+        logError('Recording does not contain any capture')
+        exit(1)
+
+    logInfo('Replaying {} captures from {}'.format(len(replay), path))
+    shown, data = None, None
+    while True:
+        if replay.position != shown:
+            shown = replay.position
+            capture = replay.capture(shown)
+            gui.graph.freq = round(capture.sampleRate)
+            gui.graph.numberOfSamples = len(capture.channels[0])
+            # Recording of logic analyser holds lane of every input
+            data = capture.channels if len(capture.channels) > 1 else capture.channels[0]
+        gui.draw(data, info=describeExport())
+        while not processUserInput(gui, None, replay) and not exportUpdated() and not gui.graph.isFading():
+            sleep(0.05)
+
+
+def subscribeMain(gui, address):
+    """Displays captures published by broker (oscilBroker.py) - device is controlled by broker"""
+    try:
+        subscriber = Subscriber(address)
+    except OSError as e:
+        logError('Could not connect to broker: {}'.format(e))
+        exit(1)
+
+    # The latest capture - receiving thread keeps reading frames, so broker never waits for rendering
+    latest = [None]
+
+    def receiver():
+        for capture in subscriber.captures():
+            latest[0] = capture
+        logError('Broker has closed connection')
+    threading.Thread(target=receiver, daemon=True).start()
+
+    logInfo('Showing captures from broker at {}'.format(address))
+    gui.draw([], 'Waiting for captures from broker')
+    shown = None
+    while True:
+        changed = processUserInput(gui, None)
+        if latest[0] is not shown:
+            shown, changed = latest[0], True
+        if (changed or exportUpdated() or gui.graph.isFading()) and shown is not None:
+            gui.graph.freq = round(shown.sampleRate)
+            gui.graph.numberOfSamples = len(shown.channels[0])
+            gui.draw(shown.channels if len(shown.channels) > 1 else shown.channels[0], info=describeExport())
+        sleep(0.02)
+
+
+def mathFactories(args):
+    """Returns functions creating math channels with settings provided in command line"""
+    return {MovingAverage: lambda: MovingAverage(args.average), LowPass: lambda: LowPass(args.lowpass),
+            BandPass: lambda: BandPass(*(args.bandpass or (None, None))),
+            SinglePoleIIR: lambda: SinglePoleIIR(args.iir)}
 
 
 def main():
-    global expectingData, serialCom
-    if len(sys.argv) != 2:
+    global expectingData, serialCom, segments, currentSegment, segmentOverlays, triggerTimestamp, sharedArm
+    global maskTester, maskOptions, traceFile, exportPath, nextRequestTime
+    parser = argparse.ArgumentParser(description='Oscilloscope built on STM32 microcontroller')
+    parser.add_argument('port', nargs='?', help='serial port device is connected to')
+    parser.add_argument('--device', metavar='PORT', action='append', default=[],
+                        help='serial port of another device drawn on the same time axis (can be repeated)')
+    parser.add_argument('--shared-arm', action='store_true',
+                        help='arm and trigger other devices together with the main one instead of independently')
+    parser.add_argument('--record', metavar='FILE', help='save every downloaded capture to recording file')
+    parser.add_argument('--replay', metavar='FILE', help='display captures from recording file instead of device')
+    parser.add_argument('--subscribe', metavar='ADDRESS',
+                        help='display captures published by oscilBroker.py (HOST:PORT or Unix socket) '
+                             'instead of device')
+    parser.add_argument('--pattern', default='1', type=TriggerConfig.parsePattern,
+                        help='pattern of digital inputs selected with V in logic analyser mode, written from D0, '
+                             'e.g. 1x0 (default: 1)')
+    parser.add_argument('--average', type=int, default=8, help='number of samples of moving average (default: 8)')
+    parser.add_argument('--lowpass', metavar='HZ', type=float,
+                        help='cutoff of low-pass filter (default: 1/50 of frequency of samples)')
+    parser.add_argument('--bandpass', metavar=('LOW', 'HIGH'), type=float, nargs=2,
+                        help='band of band-pass filter in Hz (default: 1/100 to 1/20 of frequency of samples)')
+    parser.add_argument('--iir', metavar='HZ', type=float,
+                        help='cutoff of single-pole IIR filter (default: 1/50 of frequency of samples)')
+    parser.add_argument('--trace', metavar='FILE',
+                        help='record spans of pipeline (download, decoding, rendering) and write them to FILE '
+                             'in Chrome trace format on F12 and at exit')
+    parser.add_argument('--export', metavar='FILE',
+                        help='export displayed capture (whole recording with --replay) to VCD (.vcd) or sigrok '
+                             'session (.sr) on F9')
+    parser.add_argument('--impedance', metavar='OHMS', type=int, default=0,
+                        help='output impedance of probed source - device lengthens sample time of ADC for it and '
+                             'sampling frequency is limited to rate of conversions (default: 0)')
+    parser.add_argument('--mask', metavar='FILE',
+                        help='mask test uses mask from file (if it exists), mask built with B is saved to it')
+    parser.add_argument('--mask-tolerance', metavar='VOLTS', type=float, default=DFT_TOLERANCE,
+                        help='distance of mask from displayed capture (default: {})'.format(DFT_TOLERANCE))
+    parser.add_argument('--mask-time', metavar='SAMPLES', type=int, default=DFT_TIME_TOLERANCE,
+                        help='samples by which edges can move inside mask (default: {})'.format(DFT_TIME_TOLERANCE))
+    parser.add_argument('--mask-stop', action='store_true',
+                        help='stop capturing on the first capture which fails mask test and keep it displayed')
+    args = parser.parse_args()
+    if args.export is not None:
+        try:
+            exportFormat(args.export)
+        except ValueError as e:
+            parser.error(str(e))
+        exportPath = args.export
+    if args.trace is not None:
+        traceFile = args.trace
+        tracing.enable()
+
+    if args.replay is not None:
+        gui = GUI()
+        gui.math.factories = mathFactories(args)
+        replayMain(gui, args.replay)
+    if args.subscribe is not None:
+        gui = GUI()
+        gui.math.factories = mathFactories(args)
+        subscribeMain(gui, args.subscribe)
+    if args.port is None:
         logError('Please provide serial port as first argument')
         exit(1)
 
     try:
-        serialCom = SerialCom(sys.argv[1])
+        serialCom = SerialCom(args.port)
     except serial.serialutil.SerialException as e:
         logError('Could not open serial port: {}'.format(e.args[1]))
         exit(1)
 
     gui = GUI()
+    gui.math.factories = mathFactories(args)
+    gui.trigger.pattern = args.pattern
     gui.draw([], 'Looking for device')
     while serialCom.ping() != 0:
         gui.draw([], 'Device is not responding to\nPING command\nCheck connection\n\nRetrying...')
         sleep(1)
 
-    gui.draw([], 'Device is connected\n\nSending initial configuration')
-    actions = [{'job': serialCom.setTriggerLevel, 'name': 'Setting trigger level', 'value': 1},
-               {'job': serialCom.setMode, 'name': 'Setting mode', 'value': 0},
-               {'job': serialCom.setNumberOfSamples, 'name': 'Setting number of samples', 'value': gui.graph.numberOfSamples},
-               {'job': serialCom.setPrecision, 'name': 'Setting frequency', 'value': gui.graph.freq}]
-    for action in actions:
-        gui.draw([], 'Device is connected\n\nSending initial configuration\n\n' + action['name'])
-        while action['job'](action['value']) != 0:
+    # Device chooses timing of ADC for each sample clock - it reports how fast ADC can follow the source
+    timing = serialCom.setAdcTiming(0, args.impedance)
+    if timing is not None:
+        gui.graph.maxFreq = timing.maxFrequency
+        logInfo('ADC timing: {}'.format(timing))
+    elif args.impedance > AdcTiming.MAX_IMPEDANCE:
+        logError('Impedance of source is too high for ADC (at most {} ohms)'.format(AdcTiming.MAX_IMPEDANCE))
+
+    # Device configured before (e.g. by previous instance of GUI) keeps its settings
+    config = serialCom.getConfig()
+    if config is not None and config.numberOfSamples > 0:
+        gui.draw([], 'Device is connected\n\nReading configuration')
+        syncConfig(gui, serialCom, config)
+    else:
+        gui.draw([], 'Device is connected\n\nSending initial configuration')
+        while serialCom.setConfig(configFromGui(gui)) != 0:
             sleep(3)
-            gui.draw([], 'Device is connected\n\nSending initial configuration\n\nRetrying: ' + action['name'])
+            gui.draw([], 'Device is connected\n\nSending initial configuration\n\nRetrying...')
+
+    if args.device:
+        gui.draw([], 'Connecting to other devices')
+        connectDevices(args.device)
+        configureDevices(gui, gui.trigger.toConfig(gui.graph.isDigital(), gui.graph.freq * gui.graph.decimation))
+        sharedArm = args.shared_arm
+
+    maskOptions = args
+    if args.mask is not None and os.path.exists(args.mask):
+        maskTester = MaskTester(Mask.load(args.mask), args.mask_stop)
+        logInfo('Mask test with mask from {}'.format(args.mask))
+
+    recorder = None
+    if args.record is not None:
+        recorder = Recorder(args.record, gui.graph.freq)
+        logInfo('Recording captures to {}'.format(args.record))
 
     gui.draw([])
     exData = []
-    while True:
-        message = None
-        while not (expectingData and serialCom.isDataAvail()) and not processUserInput(gui, serialCom):
-            sleep(0.3)
-
-        if expectingData and serialCom.isDataAvail():
-            (status, exData) = serialCom.downloadData()
-            if status:
-                expectingData = False
-            else:
-                message = 'Downloading samples failed\nCommunication error\noccurred\n\nPress any key'
+    try:
+        while True:
+            message = None
+            while True:
+                # User input is handled first, so it is not starved by captures arriving in auto re-arm mode
+                updated = processUserInput(gui, serialCom)
+                updated = pollDevices() or updated
+                updated = exportUpdated() or updated
+                # Persistence map fades also when no capture arrives
+                updated = gui.graph.isFading() or updated
+                if updated or captureAvailable(serialCom):
+                    break
+                sleep(0.02 if streaming or devices or gui.graph.persistence is not None else 0.3)
+            applyConfig(gui, serialCom)
+
+            if streaming and serialCom.nextAvailable():
+                (status, data) = serialCom.receiveNext()
+                if not status:
+                    # No capture was ready - request is repeated later instead of at speed of link
+                    nextRequestTime = time() + NEXT_RETRY_INTERVAL
+                    if not updated:
+                        continue
+                else:
+                    tracing.instant('capture ready')
+                    # Device transmits the next capture while this one is being drawn
+                    serialCom.requestNext()
+                    exData = data
+                    triggerTimestamp = time()
+                    testMask(serialCom, [exData])
+                    if recorder is not None:
+                        recorder.write(exData, sampleRate=gui.graph.sampleRate(), timestamp=time())
+                        recorder.flush()
+            elif expectingData and serialCom.isDataAvail():
+                tracing.instant('capture ready')
+                # Time of trigger on host clock is needed only to align captures of other devices
+                start = (triggerTime(serialCom) or time()) if devices else time()
+                if gui.graph.isDigital():
+                    (status, runs) = serialCom.downloadRuns()
+                    exData = toLanes(expandRuns(runs), SerialCom.LOGIC_CHANNELS)
+                    # Recording holds single analog channel - captures of logic analyser are not recorded
+                    segments, captures, timestamps = [], [], []
+                elif gui.graph.etsSteps > 1:
+                    (status, etsSegments) = serialCom.downloadSegments()
+                    exData = reconstruct([data for _, data in etsSegments], gui.graph.etsSteps)
+                    segments, captures, timestamps = [], [exData], [start]
+                elif gui.graph.numberOfSegments > 1:
+                    (status, segments) = serialCom.downloadSegments()
+                    currentSegment, segmentOverlays = 0, None
+                    captures = [data for _, data in segments]
+                    timestamps = [start + ((timestamp - segments[0][0]) & 0xffffffff) / 1e6
+                                  for timestamp, _ in segments]
+                else:
+                    (status, exData) = serialCom.downloadData()
+                    segments, captures, timestamps = [], [exData], [start]
+                if status:
+                    expectingData = False
+                    triggerTimestamp = start
+                    failed = testMask(serialCom, captures)
+                    if failed is not None and segments:
+                        currentSegment = failed
+                    if recorder is not None:
+                        for capture, timestamp in zip(captures, timestamps):
+                            recorder.write(capture, sampleRate=gui.graph.sampleRate(), timestamp=timestamp)
+                        recorder.flush()
+                else:
+                    message = 'Downloading samples failed\nCommunication error\noccurred\n\nPress any key'
 
-        gui.draw(exData, message)
+            if segments:
+                exData = segments[currentSegment][1]
+            info = ' '.join(text for text in (describeSegments(gui), maskTester and maskTester.describe(),
+                                              describeExport()) if text)
+            gui.draw(exData, message, segmentOverlays, info, continuous=streaming, deviceTraces=deviceTraces(gui),
+                     mask=describeMask(exData))
+    finally:
+        if recorder is not None:
+            recorder.close()
+        for scope in devices:
+            scope.close()
 
 
 if __name__ == '__main__':
@@ -0,0 +1,153 @@
+import math
+from time import sleep, monotonic
+import numpy as np
+from samples import toArray
+from tracing import traced
+
+"""Limits of settings chosen by auto-set"""
+MIN_FREQ = 100
+MAX_FREQ = 200000
+MIN_SAMPLES = 100
+MAX_SAMPLES = 4000
+"""Signals with lower peak-to-peak voltage are treated as constant"""
+MIN_AMPLITUDE = 0.05
+"""Search captures - fast one finds signals above 200 Hz without aliasing, slow one signals down to 2 Hz"""
+SLOW_FREQ = 2000
+SEARCH_SAMPLES = 2000
+"""Target picture - number of samples per period and periods per capture and per screen"""
+SAMPLES_PER_PERIOD = 50
+PERIODS_PER_CAPTURE = 10
+PERIODS_PER_SCREEN = 4
+CAPTURE_TIMEOUT = 5
+
+
+def niceValue(value, steps=(1, 2, 5)):
+    """Rounds value up to the nearest number from series 1, 2, 5, 10, 20, ..."""
+    if value <= 0:
+        return steps[0]
+    exponent = 10 ** math.floor(math.log10(value))
+    for step in steps + (10,):
+        if step * exponent >= value * (1 - 1e-9):
+            return step * exponent
+
+
+def dominantFrequency(volts, sampleRate):
+    """Returns frequency (in Hz) of the strongest component of signal other than DC or 0 if there is none
+        Peak of windowed spectrum is refined by parabolic interpolation of neighbouring bins"""
+    if len(volts) < 4:
+        return 0.0
+    window = np.hanning(len(volts))
+    spectrum = np.abs(np.fft.rfft((volts - volts.mean()) * window))
+    spectrum[0] = 0
+    peak = int(np.argmax(spectrum))
+    if peak == 0 or spectrum[peak] == 0:
+        return 0.0
+    offset = 0.0
+    if 0 < peak < len(spectrum) - 1:
+        left, middle, right = np.log(spectrum[peak - 1:peak + 2] + 1e-12)
+        denominator = left - 2 * middle + right
+        if denominator != 0:
+            offset = 0.5 * (left - right) / denominator
+    return (peak + offset) * sampleRate / len(volts)
+
+
+def crossingFrequency(volts, sampleRate):
+    """Returns frequency (in Hz) estimated from falling crossings of middle level (with hysteresis)
+        Better than spectrum for square waves, whose harmonics may be stronger than fundamental after aliasing"""
+    low, high = volts.min(), volts.max()
+    middle, hysteresis = (low + high) / 2, (high - low) / 10
+    state = np.where(volts > middle + hysteresis, 1, np.where(volts < middle - hysteresis, -1, 0))
+    known = np.flatnonzero(state)
+    if len(known) < 2:
+        return 0.0
+    levels = state[known]
+    falling = known[1:][(levels[1:] == -1) & (levels[:-1] == 1)]
+    if len(falling) < 2:
+        return 0.0
+    return (len(falling) - 1) * sampleRate / (falling[-1] - falling[0])
+
+
+@traced('measure')
+def analyse(data, sampleRate):
+    """Returns tuple (freq, low, high) - estimated frequency of signal and its extreme voltages"""
+    volts = toArray(data).astype(np.float64)
+    if len(volts) == 0:
+        return 0.0, 0.0, 0.0
+    low, high = float(volts.min()), float(volts.max())
+    if high - low < MIN_AMPLITUDE:
+        return 0.0, low, high
+    freq = crossingFrequency(volts, sampleRate)
+    return (freq if freq > 0 else dominantFrequency(volts, sampleRate)), low, high
+
+
+def capture(serial, freq, samples):
+    """Takes capture immediately with provided settings. Returns samples or None on failure"""
+    if serial.setPrecision(freq) != 0 or serial.setNumberOfSamples(samples) != 0 or serial.triggerNow() != 0:
+        return None
+    deadline = monotonic() + CAPTURE_TIMEOUT + samples / freq
+    while not serial.isDataAvail():
+        if monotonic() > deadline:
+            return None
+        sleep(0.01)
+    status, data = serial.downloadData()
+    return data if status else None
+
+
+def chooseSettings(freq, low, high, maxFreq=MAX_FREQ):
+    """Returns tuple (sample rate, number of samples, trigger level, X scale, Y scale) for signal"""
+    if freq <= 0:
+        # Constant signal - slow timebase, whole capture on screen
+        rate, samples = 1000, 1600
+        scaleX = samples / 16
+    else:
+        rate = min(max(niceValue(freq * SAMPLES_PER_PERIOD), MIN_FREQ), maxFreq)
+        samplesPerPeriod = rate / freq
+        samples = int(min(max(PERIODS_PER_CAPTURE * samplesPerPeriod, MIN_SAMPLES), MAX_SAMPLES))
+        scaleX = min(PERIODS_PER_SCREEN * samplesPerPeriod, samples) / 16
+    # Zero of Y axis is in the middle of graph - the highest voltage has to fit in its upper half
+    scaleY = niceValue(max(high, abs(low), MIN_AMPLITUDE) / 4.5)
+    return int(rate), samples, round((low + high) / 2, 3), round(max(float(scaleX), 0.1), 2), scaleY
+
+
+def autoSet(serial, gui):
+    """Finds sample rate, number of samples, trigger level and scale of graph for current signal
+        Coarse-to-fine search takes at most three captures: fast one, slow one only if the fast one
+        contains less than two periods, and the last one with chosen settings to refine the estimate.
+        Returns description of found signal or None if device did not respond"""
+    # Sample clock of device runs faster than sample rate when readings are averaged
+    maxFreq = min(MAX_FREQ, gui.graph.maxFreq or MAX_FREQ) // gui.graph.decimation
+    rate = maxFreq
+    data = capture(serial, rate * gui.graph.decimation, SEARCH_SAMPLES)
+    if data is None:
+        return None
+    freq, low, high = analyse(data, rate)
+
+    if high - low >= MIN_AMPLITUDE and freq * SEARCH_SAMPLES / rate < 2:
+        rate = SLOW_FREQ
+        data = capture(serial, rate * gui.graph.decimation, SEARCH_SAMPLES)
+        if data is None:
+            return None
+        freq, low, high = analyse(data, rate)
+        if freq * SEARCH_SAMPLES / rate < 2:
+            freq = 0.0
+
+    rate, samples, level, scaleX, scaleY = chooseSettings(freq, low, high, maxFreq)
+    if freq > 0:
+        data = capture(serial, rate * gui.graph.decimation, samples)
+        if data is None:
+            return None
+        fineFreq, low, high = analyse(data, rate)
+        freq = fineFreq if fineFreq > 0 else freq
+        rate, samples, level, scaleX, scaleY = chooseSettings(freq, low, high, maxFreq)
+
+    if serial.setPrecision(rate * gui.graph.decimation) != 0 or serial.setNumberOfSamples(samples) != 0 or \
+            serial.setTriggerLevel(level) != 0:
+        return None
+    gui.graph.freq, gui.graph.numberOfSamples = rate, samples
+    gui.graph.setScale((scaleX, scaleY))
+    gui.graph.startOfCord.x = 0
+    gui.trigger.setTriggerLevel(level)
+
+    if freq <= 0:
+        return 'constant {:.2f}V'.format((low + high) / 2)
+    return '{:.1f}Hz {:.2f}Vpp'.format(freq, high - low)
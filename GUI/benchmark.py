@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import os
+import platform
+import sys
+from time import sleep, monotonic
+
+"""Numbers of samples of benchmarked (16-bit) captures - the last one is limit of device memory for 16-bit samples,
+   narrower samples allow up to SAMPLES_MEMORY_SIZE of them"""
+SAMPLE_COUNTS = (100, 250, 500, 1000, 2000, 4000)
+"""Interval of polling device for finished capture, the same as in main loop of OscilGUI"""
+DFT_POLL_INTERVAL = 0.3
+"""UART speed of device"""
+DFT_BAUDRATE = 38400
+"""Metrics compared with baseline - relative increase above tolerance is reported as regression"""
+COMPARED_METRICS = ('latency', 'download', 'decode', 'render')
+
+
+def percentiles(values):
+    """Returns dict with median and 99th percentile of values (in milliseconds)"""
+    ordered = sorted(values)
+    pick = lambda q: ordered[min(int(round(q * (len(ordered) - 1))), len(ordered) - 1)] * 1000
+    return {'p50': round(pick(0.5), 3), 'p99': round(pick(0.99), 3)}
+
+
+def measure(serial, gui, device, numberOfSamples, freq, repeat, poll, baudrate):
+    """Runs repeat cycles of capture, download, decoding and drawing - the same as OscilGUI does.
+       Returns dict of results for provided number of samples"""
+    from serialCom import AcquisitionConfig
+    if serial.setConfig(AcquisitionConfig(1.5, 0, freq, numberOfSamples)) != 0:
+        raise RuntimeError('Simulated device refused {} samples'.format(numberOfSamples))
+    gui.graph.freq, gui.graph.numberOfSamples = freq, numberOfSamples
+
+    latency, download, decode, render = [], [], [], []
+    start = monotonic()
+    for _ in range(repeat):
+        serial.trigMode()
+        while not serial.isDataAvail():
+            sleep(poll)
+        # Trigger fires on the first stored sample, capture is ready after the last one
+        triggered = device.readyAt - numberOfSamples / freq
+
+        begin = monotonic()
+        status, data = serial.downloadData()
+        downloaded = monotonic()
+        if not status or len(data) != numberOfSamples:
+            raise RuntimeError('Downloading {} samples failed'.format(numberOfSamples))
+        gui.decoders.run(data, gui.graph.sampleRate())
+        decoded = monotonic()
+        gui.draw(data)              # Reuses annotations cached by decoders
+        drawn = monotonic()
+
+        latency.append(drawn - triggered)
+        download.append(downloaded - begin)
+        decode.append(decoded - downloaded)
+        render.append(drawn - decoded)
+    elapsed = monotonic() - start
+
+    # Response to DOWNLOAD_DATA: status, length, samples and end byte, 10 bits per byte (8N1)
+    wireBytes = 1 + 4 + 2 * numberOfSamples + 1
+    result = {'samples': numberOfSamples,
+              'latency': percentiles(latency),
+              'download': percentiles(download),
+              'decode': percentiles(decode),
+              'render': percentiles(render),
+              'capturesPerSecond': round(repeat / elapsed, 3),
+              'samplesPerSecond': round(numberOfSamples * repeat / sum(download), 1)}
+    if baudrate is not None:
+        result['linkUtilisation'] = round(wireBytes * 10 / baudrate * repeat / elapsed, 4)
+    return result
+
+
+def compare(results, baseline, tolerance):
+    """Returns list of descriptions of metrics which are worse than in baseline by more than tolerance"""
+    previous = {entry['samples']: entry for entry in baseline.get('results', [])}
+    regressions = []
+    for entry in results:
+        old = previous.get(entry['samples'])
+        if old is None:
+            continue
+        for metric in COMPARED_METRICS:
+            before, after = old[metric]['p50'], entry[metric]['p50']
+            if before > 0 and after > before * (1 + tolerance):
+                regressions.append('{} samples: {} p50 {:.3f} ms -> {:.3f} ms'.format(entry['samples'], metric,
+                                                                                     before, after))
+    return regressions
+
+
+def main():
+    """Benchmarks path of capture from simulated device to screen with real SerialCom and GUI code"""
+    parser = argparse.ArgumentParser(description='Latency and throughput benchmark of STM32Oscil GUI')
+    parser.add_argument('--samples', type=int, nargs='+', default=SAMPLE_COUNTS, help='numbers of samples to test')
+    parser.add_argument('--repeat', type=int, default=10, help='number of captures for each number of samples')
+    parser.add_argument('--freq', type=int, default=100000, help='frequency of samples')
+    parser.add_argument('--baudrate', type=int, default=DFT_BAUDRATE,
+                        help='speed of UART of simulated device, 0 - unlimited (measures host only)')
+    parser.add_argument('--poll', type=float, default=DFT_POLL_INTERVAL, help='interval of polling for capture')
+    parser.add_argument('--output', metavar='FILE', help='write results as JSON to file instead of stdout')
+    parser.add_argument('--baseline', metavar='FILE', help='JSON results of previous run to compare with')
+    parser.add_argument('--tolerance', type=float, default=0.25, help='allowed relative increase of p50 times')
+    args = parser.parse_args()
+
+    os.environ.setdefault('SDL_VIDEODRIVER', 'dummy')
+    from simDevice import SimulatedDevice, SquareSource
+    from serialCom import SerialCom
+    from GUITools import GUI
+    from decoders import UARTDecoder
+
+    baudrate = args.baudrate or None
+    device = SimulatedDevice(SquareSource(1000.0, edge=1e-5), noise=2.0, realTime=True, seed=1, baudrate=baudrate)
+    serial = SerialCom(device.start())
+    gui = GUI()
+    gui.decoders.toggle(UARTDecoder)
+
+    results = []
+    try:
+        for numberOfSamples in args.samples:
+            result = measure(serial, gui, device, numberOfSamples, args.freq, args.repeat, args.poll, baudrate)
+            results.append(result)
+            print('{:>6} samples: latency {:>9.1f} ms, download {:>9.1f} ms, decode {:>7.2f} ms, render {:>7.2f} ms'
+                  .format(numberOfSamples, result['latency']['p50'], result['download']['p50'],
+                          result['decode']['p50'], result['render']['p50']), file=sys.stderr)
+    finally:
+        device.stop()
+
+    report = {'environment': {'python': platform.python_version(), 'machine': platform.machine(),
+                              'baudrate': baudrate, 'freq': args.freq, 'repeat': args.repeat, 'poll': args.poll},
+              'results': results}
+    if args.output is not None:
+        with open(args.output, 'w') as file:
+            json.dump(report, file, indent=2)
+    else:
+        json.dump(report, sys.stdout, indent=2)
+        print()
+
+    if args.baseline is not None:
+        with open(args.baseline) as file:
+            regressions = compare(results, json.load(file), args.tolerance)
+        for regression in regressions:
+            print('Regression: ' + regression, file=sys.stderr)
+        return 1 if regressions else 0
+    return 0
+
+
+if __name__ == '__main__':
+    exit(main())
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+import argparse
+from time import sleep, monotonic
+from serialCom import SerialCom
+
+
+def measure(serial, freq, decimation):
+    """Takes one capture with provided averaging and returns profile of capture stages and its duration"""
+    serial.getProfile()         # Drop measurements of previous commands
+    start = monotonic()
+    if serial.setPrecision(freq * decimation) != 0 or serial.setDecimation(decimation) != 0:
+        return None
+    serial.trigMode()
+    while not serial.isDataAvail():
+        sleep(0.05)
+    status, profile = serial.getProfile()
+    elapsed = monotonic() - start
+    serial.downloadData()
+    return (profile, elapsed) if status else None
+
+
+def main():
+    """Prints cost of each capture stage of firmware measured by DWT cycle counter"""
+    parser = argparse.ArgumentParser(description='Measures cost of capture stages of STM32Oscil firmware')
+    parser.add_argument('port', help='serial port device is connected to')
+    parser.add_argument('--freq', type=int, default=10000, help='frequency of stored samples')
+    parser.add_argument('--samples', type=int, default=2000, help='number of samples of each capture')
+    args = parser.parse_args()
+
+    serial = SerialCom(args.port)
+    if serial.ping() != 0 or serial.setNumberOfSamples(args.samples) != 0 or serial.setTriggerLevel(3.3) != 0:
+        print('Device is not responding')
+        return 1
+
+    print('{:<18}{:>10}{:>12}{:>12}'.format('stage', 'calls', 'avg cycles', 'max cycles'))
+    decimation = 1
+    while decimation <= serial.MAX_DECIMATION:
+        result = measure(serial, args.freq, decimation)
+        if result is None:
+            print('Capture with {} averaged readings failed'.format(decimation))
+            return 1
+        profile, elapsed = result
+        if not any(calls for calls, _, _ in profile.values()):
+            print('Nothing was measured - firmware has to be built with CAPTURE_PROFILING=1')
+            return 1
+        for name, (calls, cycles, maxCycles) in profile.items():
+            # Sleep is measured in microseconds - it is shown as share of idle time below
+            if calls and name != 'sleep':
+                print('{:<18}{:>10}{:>12.1f}{:>12}'.format(name, calls, cycles / calls, maxCycles))
+        # Main loop of firmware sleeps in WFI whenever no command is pending
+        sleepTime = profile.get('sleep', (0, 0, 0))[1] / 1e6
+        print('idle {:.1f}% of {:.2f} s'.format(100 * sleepTime / elapsed, elapsed))
+        decimation *= 2
+
+    serial.setDecimation(1)
+    serial.setPrecision(args.freq)
+    return 0
+
+
+if __name__ == '__main__':
+    exit(main())
@@ -0,0 +1,439 @@
+#!/usr/bin/env python3
+import sys
+import numpy as np
+from samples import toDigital, findEdges, LOGIC_THRESHOLD
+
+
+class Annotation:
+    """Class representing part of captured signal decoded by protocol decoder
+
+    Attributes:
+        start: number of sample at which decoded element starts
+        end: number of sample at which decoded element ends
+        texts: alternative descriptions of element ordered from the longest to the shortest one
+        row: row above the graph in which annotation should be drawn
+        isError: True if element violates protocol (framing, parity, missing ACK, ...)
+    """
+    def __init__(self, start, end, texts, row=0, isError=False):
+        self.start = float(start)
+        self.end = float(end)
+        self.texts = texts if type(texts) in (list, tuple) else (texts, )
+        self.row = row
+        self.isError = isError
+
+    def __repr__(self):
+        return 'Annotation({}, {}, {!r}{})'.format(self.start, self.end, self.texts[0], ', error' if self.isError else '')
+
+
+def describeByte(value, bits=8):
+    """Returns descriptions of decoded word ordered from the longest to the shortest one"""
+    width = (bits + 3) // 4
+    texts = ['0x{:0{w}X}'.format(value, w=width), '{:0{w}X}'.format(value, w=width)]
+    if 32 <= value < 127:
+        texts.insert(0, "0x{:0{w}X} '{}'".format(value, chr(value), w=width))
+    return texts
+
+
+def wordsFromBits(bits, wordSize, msbFirst):
+    """Packs array of bits into words of provided size. Incomplete word at the end is dropped"""
+    count = len(bits) // wordSize
+    weights = 1 << np.arange(wordSize, dtype=np.int64)
+    if msbFirst:
+        weights = weights[::-1]
+    return bits[:count * wordSize].reshape(count, wordSize).astype(np.int64) @ weights
+
+
+class Decoder:
+    """The base class for all protocol decoders
+        Decoders work on digital approximation of captured channels and look only at signal edges,
+        so their cost depends on number of transmitted symbols, not on length of capture.
+
+    Attributes:
+        name: short name of protocol displayed to user
+        channelNames: names of channels decoder expects, optional ones are placed at the end
+        requiredChannels: number of channels which have to be provided
+        rows: number of annotation rows used by decoder
+    """
+    name = ''
+    channelNames = ()
+    requiredChannels = 1
+    rows = 1
+
+    def decode(self, channels, sampleRate):
+        """Decodes list of digital channels (numpy arrays of booleans) sampled at provided rate
+            Returns list of Annotation objects"""
+        raise NotImplementedError
+
+
+class UARTDecoder(Decoder):
+    """Decoder of asynchronous serial transmission
+
+    Attributes:
+        baudrate: speed of transmission, None to estimate it from the shortest pulse in capture
+        dataBits: number of data bits in frame
+        parity: 'N' - none, 'E' - even, 'O' - odd
+        stopBits: number of stop bits in frame
+        inverted: True if line idles low
+        msbFirst: True if data bits are sent starting from the most significant one
+    """
+    name = 'UART'
+    channelNames = ('RX', )
+
+    def __init__(self, baudrate=None, dataBits=8, parity='N', stopBits=1, inverted=False, msbFirst=False):
+        if parity not in ('N', 'E', 'O'):
+            raise ValueError('Unknown parity: {}'.format(parity))
+        if not 5 <= dataBits <= 9 or stopBits not in (1, 2):
+            raise ValueError('Unsupported frame format')
+        self.baudrate = baudrate
+        self.dataBits = dataBits
+        self.parity = parity
+        self.stopBits = stopBits
+        self.inverted = inverted
+        self.msbFirst = msbFirst
+        self.lastBaudrate = None
+
+    @staticmethod
+    def estimateBitPeriod(edges):
+        """Estimates length of one bit (in samples) as mean length of the shortest pulses in capture
+            Returns None if there is not enough edges"""
+        pulses = np.diff(edges)
+        if len(pulses) == 0:
+            return None
+        shortest = pulses.min()
+        return float(pulses[pulses < shortest * 1.5].mean())
+
+    def decode(self, channels, sampleRate):
+        bits = channels[0] if not self.inverted else ~channels[0]
+        edges = findEdges(bits)
+
+        if self.baudrate:
+            bitPeriod = sampleRate / self.baudrate
+        else:
+            bitPeriod = self.estimateBitPeriod(edges)
+        if bitPeriod is None or bitPeriod < 1:
+            return []
+        self.lastBaudrate = sampleRate / bitPeriod
+
+        parityBits = 0 if self.parity == 'N' else 1
+        frameBits = 1 + self.dataBits + parityBits + self.stopBits
+        # Middle of each bit following start bit, relative to falling edge of start bit
+        offsets = (np.arange(frameBits) + 0.5) * bitPeriod
+        weights = 1 << np.arange(self.dataBits)
+        if self.msbFirst:
+            weights = weights[::-1]
+        startEdges = edges[~bits[edges]]
+
+        annotations = []
+        position = 0
+        while True:
+            i = np.searchsorted(startEdges, position)
+            if i >= len(startEdges):
+                break
+            start = startEdges[i]
+            points = (start + offsets).astype(np.int64)
+            if points[-1] >= len(bits):
+                break
+            values = bits[points]
+            if values[0]:
+                # Glitch - line went back high before middle of start bit
+                position = start + 1
+                continue
+
+            data = values[1:1 + self.dataBits]
+            value = int(data @ weights)
+            texts = describeByte(value, self.dataBits)
+            isError = False
+            if parityBits and (int(data.sum()) + int(values[1 + self.dataBits]) + (self.parity == 'O')) % 2:
+                texts, isError = ['PE ' + texts[0], 'PE'], True
+            if not values[-self.stopBits:].all():
+                texts, isError = ['FE ' + texts[0], 'FE'], True
+            end = start + frameBits * bitPeriod
+            annotations.append(Annotation(start, end, texts, isError=isError))
+            # Resume looking for start bit from the middle of last stop bit
+            position = start + offsets[-1]
+        return annotations
+
+
+class SPIDecoder(Decoder):
+    """Decoder of SPI bus. MISO and CS channels are optional
+
+    Attributes:
+        cpol: clock polarity (level of idle clock line)
+        cpha: clock phase, 0 - data sampled on leading edge, 1 - on trailing edge
+        wordSize: number of bits in one word
+        msbFirst: True if words are sent starting from the most significant bit
+    """
+    name = 'SPI'
+    channelNames = ('SCLK', 'MOSI', 'MISO', 'CS')
+    requiredChannels = 2
+    rows = 2
+
+    def __init__(self, cpol=0, cpha=0, wordSize=8, msbFirst=True):
+        self.cpol = cpol
+        self.cpha = cpha
+        self.wordSize = wordSize
+        self.msbFirst = msbFirst
+
+    def decode(self, channels, sampleRate):
+        clock = channels[0]
+        edges = findEdges(clock)
+        # Data is sampled on rising edge in modes 0 and 3, on falling one in modes 1 and 2
+        samplingEdges = edges[clock[edges] == (self.cpol == self.cpha)]
+
+        # Split sampling edges into transfers separated by chip select activations
+        transfers = [samplingEdges]
+        if len(channels) > 3 and channels[3] is not None:
+            select = channels[3]
+            selectEdges = findEdges(select)
+            activations = np.concatenate(([0] if not select[0] else [], selectEdges[~select[selectEdges]]))
+            samplingEdges = samplingEdges[~select[samplingEdges]]
+            transfers = np.split(samplingEdges, np.searchsorted(samplingEdges, activations[1:]))
+
+        annotations = []
+        for transfer in transfers:
+            count = len(transfer) // self.wordSize
+            if count == 0:
+                continue
+            bounds = transfer[:count * self.wordSize].reshape(count, self.wordSize)
+            halfBit = (bounds[:, -1] - bounds[:, 0]) / max(self.wordSize - 1, 1) / 2
+            for row, line in enumerate(channels[1:3]):
+                if line is None:
+                    continue
+                words = wordsFromBits(line[transfer], self.wordSize, self.msbFirst)
+                for word, first, last, margin in zip(words, bounds[:, 0], bounds[:, -1], halfBit):
+                    annotations.append(Annotation(first - margin, last + margin,
+                                                  describeByte(int(word), self.wordSize), row=row))
+        return annotations
+
+
+class I2CDecoder(Decoder):
+    """Decoder of I2C bus"""
+    name = 'I2C'
+    channelNames = ('SCL', 'SDA')
+    requiredChannels = 2
+
+    def decode(self, channels, sampleRate):
+        scl, sda = channels[0], channels[1]
+        sclEdges = findEdges(scl)
+        risingScl = sclEdges[scl[sclEdges]]
+        sdaEdges = findEdges(sda)
+        # SDA changing while SCL is high marks START (falling SDA) or STOP (rising SDA) condition
+        conditions = sdaEdges[scl[sdaEdges] & scl[sdaEdges - 1]]
+
+        annotations = []
+        for i, condition in enumerate(conditions):
+            if sda[condition]:
+                annotations.append(Annotation(condition - 1, condition + 1, ('STOP', 'P')))
+                continue
+            annotations.append(Annotation(condition - 1, condition + 1, ('START', 'S')))
+            end = conditions[i + 1] if i + 1 < len(conditions) else len(scl)
+            clocks = risingScl[np.searchsorted(risingScl, condition):np.searchsorted(risingScl, end)]
+            count = len(clocks) // 9
+            if count == 0:
+                continue
+            clocks = clocks[:count * 9].reshape(count, 9)
+            bits = sda[clocks]
+            values = wordsFromBits(bits[:, :8].reshape(-1), 8, True)
+            period = float(np.diff(clocks[0]).mean())
+            for no, (value, ack, bounds) in enumerate(zip(values, bits[:, 8], clocks)):
+                value = int(value)
+                if no == 0:
+                    texts = ['Addr 0x{:02X} {}'.format(value >> 1, 'R' if value & 1 else 'W'),
+                             '{:02X}{}'.format(value >> 1, 'R' if value & 1 else 'W')]
+                else:
+                    texts = describeByte(value)
+                texts = [text + (' NACK' if ack else ' ACK') for text in texts[:1]] + texts[1:]
+                annotations.append(Annotation(bounds[0] - period / 2, bounds[-1] + period / 2, texts, isError=bool(ack)))
+        return annotations
+
+
+"""Dict of available decoders indexed by their names"""
+DECODERS = {decoder.name: decoder for decoder in (UARTDecoder, SPIDecoder, I2CDecoder)}
+
+
+def registerDecoder(decoder):
+    """Makes decoder class available in DECODERS dict. Can be used as class decorator"""
+    DECODERS[decoder.name] = decoder
+    return decoder
+
+
+class DecoderPipeline:
+    """Class running set of protocol decoders on captured samples
+
+    Attributes:
+        decoders: list of tuples (decoder, indices of capture channels connected to decoder)
+        threshold: voltage above which sample is treated as logical one
+    """
+    def __init__(self, threshold=LOGIC_THRESHOLD):
+        self.decoders = []
+        self.threshold = threshold
+        self.cache = (None, None, [])
+
+    def add(self, decoder, channels=None):
+        """Adds decoder connected to provided channels (by default first channels of capture)"""
+        if channels is None:
+            channels = tuple(range(decoder.requiredChannels))
+        self.decoders.append((decoder, tuple(channels)))
+        self.cache = (None, None, [])
+
+    def remove(self, decoderClass):
+        self.decoders = [entry for entry in self.decoders if type(entry[0]) != decoderClass]
+        self.cache = (None, None, [])
+
+    def toggle(self, decoderClass):
+        """Removes decoder of provided class if present or adds one with default settings"""
+        if any(type(decoder) == decoderClass for decoder, _ in self.decoders):
+            self.remove(decoderClass)
+        else:
+            self.add(decoderClass())
+
+    def isEnabled(self):
+        return len(self.decoders) != 0
+
+    def run(self, data, sampleRate):
+        """Decodes capture and returns list of Annotation objects
+            data may be single channel (list of (no, sample) tuples or array of voltages)
+            or list of such channels. Result is cached until different capture is provided"""
+        if not self.decoders:
+            return []
+        if self.cache[0] is data and self.cache[1] == sampleRate:
+            return self.cache[2]
+
+        channels = data if type(data) == list and data and type(data[0]) != tuple else [data]
+        digital = [toDigital(channel, self.threshold) for channel in channels]
+
+        annotations = []
+        row = 0
+        for decoder, indices in self.decoders:
+            if max(indices) >= len(digital) or any(len(digital[i]) < 2 for i in indices):
+                continue
+            connected = [digital[i] for i in indices] + [None] * (len(decoder.channelNames) - len(indices))
+            for annotation in decoder.decode(connected, sampleRate):
+                annotation.row += row
+                annotations.append(annotation)
+            row += decoder.rows
+
+        self.cache = (data, sampleRate, annotations)
+        return annotations
+
+
+def uartStream(frames, bitLength, dataBits=8, parity='N', stopBits=1):
+    """Returns idle-high line carrying frames - tuples (value, spoilt parity, spoilt stop bit)"""
+    bits = [1] * 3
+    for value, badParity, badStop in frames:
+        data = [(value >> bit) & 1 for bit in range(dataBits)]
+        bits += [0] + data
+        if parity != 'N':
+            bits.append((sum(data) + (parity == 'O') + badParity) % 2)
+        bits += [0 if badStop else 1] * stopBits + [1] * 2
+    return np.repeat(np.array(bits, dtype=bool), bitLength)
+
+
+def spiStream(mosi, miso, cpol, cpha, halfPeriod=4):
+    """Returns channels (SCLK, MOSI, MISO, CS) of transfers - lists of bytes sent in one CS activation"""
+    lines = [[], [], [], []]
+
+    def hold(clock, out, into, select, length=halfPeriod):
+        for line, level in zip(lines, (clock, out, into, select)):
+            line += [level] * length
+
+    hold(cpol, 1, 1, 1)
+    for outWords, inWords in zip(mosi, miso):
+        hold(cpol, 1, 1, 0)
+        for out, into in zip(outWords, inWords):
+            for bit in range(7, -1, -1):
+                outBit, inBit = (out >> bit) & 1, (into >> bit) & 1
+                # Data changes half period before sampling edge - on idle clock in phase 0, on leading edge in 1
+                if cpha:
+                    hold(1 - cpol, outBit, inBit, 0)
+                    hold(cpol, outBit, inBit, 0)
+                else:
+                    hold(cpol, outBit, inBit, 0)
+                    hold(1 - cpol, outBit, inBit, 0)
+        hold(cpol, 1, 1, 0)
+        hold(cpol, 1, 1, 1, 3 * halfPeriod)
+    return [np.array(line, dtype=bool) for line in lines]
+
+
+def i2cStream(transactions, quarter=3):
+    """Returns channels (SCL, SDA) of transactions joined by repeated START and ended by STOP
+        Each transaction is a list of tuples (byte, ACK level)"""
+    scl, sda = [], []
+
+    def hold(clock, data):
+        scl.extend([clock] * quarter)
+        sda.extend([data] * quarter)
+
+    hold(1, 1)
+    for no, transaction in enumerate(transactions):
+        if no > 0:
+            hold(0, 1)
+            hold(1, 1)
+        hold(1, 0)
+        hold(0, 0)
+        for value, ack in transaction:
+            for bit in [(value >> i) & 1 for i in range(7, -1, -1)] + [ack]:
+                hold(0, bit)
+                hold(1, bit)
+                hold(1, bit)
+                hold(0, bit)
+    hold(0, 0)
+    hold(1, 0)
+    hold(1, 1)
+    hold(1, 1)
+    return [np.array(scl, dtype=bool), np.array(sda, dtype=bool)]
+
+
+def main():
+    """Regression check of decoders on synthetic bitstreams - UART with estimated baudrate, parity and framing
+       errors, SPI in all clock modes with chip select, I2C with ACK, NACK and repeated START"""
+    sampleRate = 1000000
+    failed = 0
+
+    def check(name, annotations, expected):
+        nonlocal failed
+        got = [(a.texts[0], a.isError) for a in annotations]
+        ok = got == expected
+        failed += not ok
+        result = 'OK' if ok else 'FAILED\n    expected {}\n    got      {}'.format(expected, got)
+        print('{:<28} {}'.format(name, result))
+        return ok
+
+    text = b'U2 ok'
+    bitLength = sampleRate / 9600
+    uart = UARTDecoder()
+    stream = uartStream([(byte, False, False) for byte in text], bitLength)
+    check('UART auto-baud', uart.decode([stream], sampleRate), [(describeByte(byte)[0], False) for byte in text])
+    if abs(uart.lastBaudrate - 9600) > 9600 * 0.02:
+        failed += 1
+        print('    estimated baudrate {:.0f}, expected 9600 - FAILED'.format(uart.lastBaudrate))
+
+    frames = [(0x41, False, False), (0x42, True, False), (0x43, False, False)]
+    check('UART even parity error', UARTDecoder(9600, parity='E').decode([uartStream(frames, bitLength, parity='E')],
+                                                                         sampleRate),
+          [("0x41 'A'", False), ("PE 0x42 'B'", True), ("0x43 'C'", False)])
+    frames = [(0x31, False, False), (0x32, False, True), (0x33, False, False)]
+    check('UART odd parity, framing', UARTDecoder(9600, parity='O', stopBits=2).decode(
+        [uartStream(frames, bitLength, parity='O', stopBits=2)], sampleRate),
+          [("0x31 '1'", False), ("FE 0x32 '2'", True), ("0x33 '3'", False)])
+
+    mosi, miso = [[0xA5, 0x3C], [0x01]], [[0x5A, 0xFF], [0x80]]
+    for cpol in (0, 1):
+        for cpha in (0, 1):
+            channels = spiStream(mosi, miso, cpol, cpha)
+            annotations = sorted(SPIDecoder(cpol, cpha).decode(channels, sampleRate), key=lambda a: (a.row, a.start))
+            check('SPI mode {} with CS'.format(cpol * 2 + cpha), annotations,
+                  [(describeByte(word)[0], False) for words in (mosi, miso) for transfer in words for word in transfer])
+
+    channels = i2cStream([[(0xA0, 0), (0x12, 0)], [(0xA1, 0), (0xAB, 1)]])
+    check('I2C repeated START, NACK', I2CDecoder().decode(channels, sampleRate),
+          [('START', False), ('Addr 0x50 W ACK', False), ('0x12 ACK', False), ('START', False),
+           ('Addr 0x50 R ACK', False), ('0xAB NACK', True), ('STOP', False)])
+    channels = i2cStream([[(0x90, 1)]])
+    check('I2C address NACK', I2CDecoder().decode(channels, sampleRate),
+          [('START', False), ('Addr 0x48 W NACK', True), ('STOP', False)])
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+import sys
+import numpy as np
+from samples import toArray
+
+
+def reconstruct(segments, steps):
+    """Assembles record of equivalent-time sampling from segments downloaded from device
+        Sampling of segment n started one period plus (n % steps) / steps of period after trigger edge,
+        so segments interleave into record with sampling rate steps times higher than rate of device.
+        Samples falling into the same position are averaged.
+        Returns array of voltages, the first element is taken one sampling period after trigger edge"""
+    times, values = [], []
+    for no, segment in enumerate(segments):
+        volts = toArray(segment)
+        times.append(np.arange(len(volts)) * steps + no % steps)
+        values.append(volts)
+    if not times:
+        return np.zeros(0, dtype=np.float32)
+
+    positions = np.concatenate(times)
+    values = np.concatenate(values)
+    length = int(positions.max()) + 1
+    counts = np.bincount(positions, minlength=length)
+    sums = np.bincount(positions, weights=values, minlength=length)
+
+    # Fill positions without samples (missing phases) by interpolation
+    filled = np.flatnonzero(counts)
+    return np.interp(np.arange(length), filled, sums[filled] / counts[filled]).astype(np.float32)
+
+
+def main():
+    """Simulation harness - captures periodic signal above Nyquist frequency of real-time sampling
+       from simulated device and compares reconstructed record with the source"""
+    from simDevice import SimulatedDevice, SineSource, EXTI_THRESHOLD
+    from serialCom import SerialCom
+
+    sampleRate, signalFreq, steps, length = 10000, 7300.0, 16, 200
+    source = SineSource(signalFreq, amplitude=1.2, offset=1.65)
+    device = SimulatedDevice(source, noise=1.0, seed=1)
+    serial = SerialCom(device.start())
+
+    for job, value in ((serial.setNumberOfSamples, length),
+                       (serial.setPrecision, sampleRate), (serial.setSegments, steps), (serial.setEts, steps)):
+        if job(value) != 0:
+            print('Configuration of simulated device failed')
+            return 1
+    serial.trigMode()
+    status, segments = serial.downloadSegments()
+    device.stop()
+    if not status:
+        print('Downloading segments failed')
+        return 1
+
+    record = reconstruct([data for _, data in segments], steps)
+    # Record starts one period after signal fell through input threshold of trigger
+    edge = np.pi - np.arcsin((EXTI_THRESHOLD - source.offset) / source.amplitude)
+    times = (np.arange(len(record)) / steps + 1) / sampleRate
+    expected = source(times + edge / (2 * np.pi * signalFreq))
+    error = np.sqrt(np.mean((record - expected) ** 2))
+    print('Real-time rate: {} Sa/s, signal: {} Hz, effective rate: {} Sa/s'.format(sampleRate, signalFreq,
+                                                                                   sampleRate * steps))
+    print('Reconstructed {} samples, RMS error: {:.3f} V ({:.1f}% of amplitude)'.format(
+        len(record), error, 100 * error / source.amplitude))
+    return 0 if error < 0.1 * source.amplitude else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+import collections
+import sys
+from time import monotonic
+import numpy as np
+from samples import toArray
+from tracing import traced
+
+"""Tolerance of mask built from golden capture - volts and samples (shift of edges in time)"""
+DFT_TOLERANCE = 0.2
+DFT_TIME_TOLERANCE = 2
+"""Period (in seconds) over which rate of tested waveforms is measured"""
+RATE_WINDOW = 1.0
+
+
+class Mask:
+    """Pass/fail limits of waveform - upper and lower envelope, sample by sample
+
+    Attributes:
+        lower: array of the lowest allowed voltage of every sample
+        upper: array of the highest allowed voltage of every sample
+    """
+    def __init__(self, lower, upper):
+        self.lower = np.asarray(lower, dtype=np.float32)
+        self.upper = np.asarray(upper, dtype=np.float32)
+
+    def __len__(self):
+        return len(self.upper)
+
+    @staticmethod
+    def fromGolden(golden, tolerance=DFT_TOLERANCE, timeTolerance=DFT_TIME_TOLERANCE):
+        """Returns mask around golden capture - envelope is widened by tolerance in volts and
+           by timeTolerance samples in both directions, so edges can move slightly. The first and the last
+           timeTolerance samples are not limited, as they can be shifted from outside of golden capture"""
+        golden = toArray(golden).astype(np.float32)
+        if timeTolerance > 0 and len(golden):
+            width = 2 * timeTolerance + 1
+            highest = np.lib.stride_tricks.sliding_window_view(
+                np.pad(golden, timeTolerance, constant_values=np.inf), width).max(axis=1)
+            lowest = np.lib.stride_tricks.sliding_window_view(
+                np.pad(golden, timeTolerance, constant_values=-np.inf), width).min(axis=1)
+        else:
+            highest, lowest = golden, golden
+        return Mask(lowest - tolerance, highest + tolerance)
+
+    @staticmethod
+    def load(path):
+        with np.load(path) as data:
+            return Mask(data['lower'], data['upper'])
+
+    def save(self, path):
+        with open(path, 'wb') as file:
+            np.savez(file, lower=self.lower, upper=self.upper)
+
+    def violations(self, values):
+        """Returns boolean array marking samples of capture outside of mask. Capture of other length
+           than mask fails - samples missing from capture and ones beyond the mask are marked too"""
+        values = toArray(values)
+        length = min(len(values), len(self))
+        marked = np.ones(max(len(values), len(self)), dtype=bool)
+        marked[:length] = (values[:length] > self.upper[:length]) | (values[:length] < self.lower[:length])
+        return marked
+
+
+class MaskTester:
+    """Counts captures which pass and fail mask test
+
+    Attributes:
+        mask: Mask captures are tested against
+        stopOnFailure: if set, the first failing capture is kept and test() of further ones is refused
+        passes, failures: number of tested captures
+        failedCapture: values of the first failing capture (if stopOnFailure is set), otherwise None
+        lastCapture: the last tested capture
+        violations: boolean array of samples outside of mask in the last tested capture
+    """
+    def __init__(self, mask, stopOnFailure=False):
+        self.mask = mask
+        self.stopOnFailure = stopOnFailure
+        self.reset()
+
+    def reset(self):
+        self.passes, self.failures = 0, 0
+        self.failedCapture = None
+        self.lastCapture = None
+        self.violations = None
+        self.tested = collections.deque()
+
+    def isStopped(self):
+        return self.stopOnFailure and self.failedCapture is not None
+
+    @traced('mask test')
+    def test(self, values):
+        """Tests capture against mask - returns True if it passes"""
+        if self.isStopped():
+            return False
+        self.lastCapture = values
+        self.violations = self.mask.violations(values)
+        passed = not self.violations.any()
+        if passed:
+            self.passes += 1
+        else:
+            self.failures += 1
+            if self.stopOnFailure:
+                self.failedCapture = values
+        now = monotonic()
+        self.tested.append(now)
+        while self.tested[0] < now - RATE_WINDOW:
+            self.tested.popleft()
+        return passed
+
+    def rate(self):
+        """Returns number of captures tested per second over the last RATE_WINDOW"""
+        while self.tested and self.tested[0] < monotonic() - RATE_WINDOW:
+            self.tested.popleft()
+        return len(self.tested) / RATE_WINDOW
+
+    def describe(self):
+        return 'Mask: {} pass {} fail {:.0f} wfm/s{}'.format(self.passes, self.failures, self.rate(),
+                                                              ' STOPPED' if self.isStopped() else '')
+
+
+def main():
+    """Checks mask test with synthetic captures - noisy ones with edge moved by a sample pass, the one with
+       glitch and too short ones fail - and reports how many waveforms of size of device memory are tested
+       per second"""
+    rng = np.random.default_rng(1)
+    t = np.arange(2000) / 20000
+    golden = np.where(np.mod(t * 1000, 1.0) < 0.5, 3.0, 0.3) + rng.normal(0, 0.01, len(t))
+    mask = Mask.fromGolden(golden)
+    tester = MaskTester(mask)
+
+    failed = 0
+    # Edge moved by one sample and noise stay inside mask, glitch of 0.5 V does not
+    shifted = np.concatenate((golden[:1], golden[:-1])) + rng.normal(0, 0.02, len(t))
+    glitch = golden.copy()
+    glitch[1234:1237] -= 0.5
+    for name, values, expected in (('shifted edge', shifted, True), ('glitch', glitch, False),
+                                   ('short capture', shifted[:1500], False),
+                                   ('cut before glitch', glitch[:1200], False)):
+        passed = tester.test(values)
+        failed += passed != expected
+        print('{:<18} {} - {}'.format(name, 'pass' if passed else 'fail ({} samples)'.format(
+            np.count_nonzero(tester.violations)), 'OK' if passed == expected else 'FAILED'))
+
+    tester.stopOnFailure = True
+    tester.reset()
+    tester.test(shifted)
+    tester.test(glitch)
+    kept = tester.failedCapture is glitch and not tester.test(shifted) and tester.passes == 1
+    failed += not kept
+    print('stop on failure keeps failing capture - {}'.format('OK' if kept else 'FAILED'))
+
+    tester = MaskTester(mask)
+    captures = [shifted + rng.normal(0, 0.01, len(t)) for _ in range(100)]
+    start = monotonic()
+    for no in range(2000):
+        tester.test(captures[no % len(captures)])
+    print('{:.0f} waveforms of {} samples tested per second'.format(2000 / (monotonic() - start), len(t)))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
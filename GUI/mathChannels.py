@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+import sys
+import numpy as np
+from samples import toArray
+
+
+class MathChannel:
+    """The base class for traces computed on host from captured channels
+
+    Channel keeps its state (e.g. history of filter) between calls of process(), so consecutive chunks
+    of continuous signal are filtered as one - nothing is recomputed when the next chunk arrives.
+    reset() starts from scratch, the first sample is then treated as if it lasted forever.
+
+    Attributes:
+        name: label of trace in GUI
+        unit: unit of computed values - traces in volts are drawn with scale of graph
+        requiredChannels: number of capture channels channel is computed from
+        delay: number of samples output lags behind input (group delay of linear-phase filters)
+    """
+    name = ''
+    unit = 'V'
+    requiredChannels = 1
+
+    def __init__(self):
+        self.delay = 0
+        self.sampleRate = None
+
+    def reset(self):
+        pass
+
+    def design(self, sampleRate):
+        """Computes coefficients for provided rate of samples - called only when it changes"""
+
+    def process(self, channels, sampleRate):
+        """Returns array computed from chunk of each required channel (arrays of the same length)"""
+        if sampleRate != self.sampleRate:
+            self.sampleRate = sampleRate
+            self.design(sampleRate)
+            self.reset()
+        return self.compute(*channels[:self.requiredChannels])
+
+    def compute(self, *chunks):
+        raise NotImplementedError
+
+
+class FirFilter(MathChannel):
+    """Filter with finite impulse response - chunk is convolved with taps together with the last
+       len(taps) - 1 samples of previous chunk"""
+    name = 'FIR'
+
+    def __init__(self, taps=(1.0, )):
+        super().__init__()
+        self.setTaps(taps)
+
+    def setTaps(self, taps):
+        self.taps = np.asarray(taps, dtype=np.float64)
+        self.delay = (len(self.taps) - 1) // 2
+        self.history = None
+
+    def reset(self):
+        self.history = None
+
+    def compute(self, chunk):
+        chunk = toArray(chunk).astype(np.float64)
+        if not len(chunk):
+            return chunk
+        if self.history is None:
+            self.history = np.full(len(self.taps) - 1, chunk[0])
+        extended = np.concatenate((self.history, chunk))
+        self.history = extended[len(extended) - len(self.history):]
+        return np.convolve(extended, self.taps, mode='valid')
+
+
+def lowPassTaps(cutoff, sampleRate, numTaps):
+    """Returns taps of windowed-sinc low-pass filter (Hamming window) with unity gain at DC"""
+    n = np.arange(numTaps) - (numTaps - 1) / 2
+    taps = np.sinc(2 * cutoff / sampleRate * n) * np.hamming(numTaps)
+    return taps / taps.sum()
+
+
+class MovingAverage(FirFilter):
+    name = 'avg'
+
+    def __init__(self, length=8):
+        super().__init__(np.full(length, 1 / length))
+        self.name = 'avg{}'.format(length)
+
+
+class LowPass(FirFilter):
+    """Windowed-sinc low-pass filter - cutoff (in Hz) is by default 1/50 of rate of samples"""
+    name = 'LP'
+
+    def __init__(self, cutoff=None, numTaps=63):
+        super().__init__()
+        self.cutoff, self.numTaps = cutoff, numTaps
+
+    def design(self, sampleRate):
+        cutoff = self.cutoff or sampleRate / 50
+        self.setTaps(lowPassTaps(min(cutoff, sampleRate / 2), sampleRate, self.numTaps))
+
+
+class BandPass(FirFilter):
+    """Difference of two windowed-sinc low-pass filters - by default passes band from 1/100 to 1/20
+       of rate of samples. Gain is normalised at centre of band"""
+    name = 'BP'
+
+    def __init__(self, low=None, high=None, numTaps=127):
+        super().__init__()
+        self.low, self.high, self.numTaps = low, high, numTaps
+
+    def design(self, sampleRate):
+        low = self.low or sampleRate / 100
+        high = min(self.high or sampleRate / 20, sampleRate / 2)
+        taps = lowPassTaps(high, sampleRate, self.numTaps) - lowPassTaps(low, sampleRate, self.numTaps)
+        n = np.arange(self.numTaps)
+        gain = abs(np.sum(taps * np.exp(-2j * np.pi * (low + high) / 2 / sampleRate * n)))
+        self.setTaps(taps / gain if gain > 0 else taps)
+
+
+class SinglePoleIIR(MathChannel):
+    """Low-pass filter y[n] = y[n-1] + a * (x[n] - y[n-1]) with cutoff (in Hz) by default 1/50 of rate of samples
+        Recurrence is evaluated for blocks of samples at once: inside block y[n] = d^n * (d * y[-1] +
+        a * cumsum(x[k] * d^-k)), where d = 1 - a. Blocks are short enough for d^-k to keep precision.
+        Quickly decaying filter is applied as FIR with its truncated impulse response instead"""
+    name = 'IIR'
+    MAX_GROWTH = 1e6
+
+    def __init__(self, cutoff=None):
+        super().__init__()
+        self.cutoff = cutoff
+        self.last = None
+
+    def design(self, sampleRate):
+        cutoff = min(self.cutoff or sampleRate / 50, sampleRate / 2)
+        self.decay = np.exp(-2 * np.pi * cutoff / sampleRate)
+        self.block = int(np.log(self.MAX_GROWTH) / -np.log(self.decay)) if self.decay > 0 else 0
+        self.fir = None
+        if self.block < 32:
+            # Impulse response falls below 1e-12 within a few dozens of samples
+            length = max(int(np.ceil(np.log(1e-12) / np.log(self.decay))), 1) if self.decay > 0 else 1
+            taps = (1 - self.decay) * self.decay ** np.arange(length)
+            self.fir = FirFilter(taps / taps.sum())
+
+    def reset(self):
+        self.last = None
+        if self.fir is not None:
+            self.fir.reset()
+
+    def compute(self, chunk):
+        chunk = toArray(chunk).astype(np.float64)
+        if self.fir is not None or not len(chunk):
+            return self.fir.compute(chunk) if self.fir is not None else chunk
+        if self.last is None:
+            self.last = chunk[0]
+        d, a = self.decay, 1 - self.decay
+        out = np.empty_like(chunk)
+        powers = d ** np.arange(min(self.block, len(chunk)))
+        for start in range(0, len(chunk), self.block):
+            block = chunk[start:start + self.block]
+            grow = powers[:len(block)]
+            out[start:start + len(block)] = grow * (d * self.last + a * np.cumsum(block / grow))
+            self.last = out[start + len(block) - 1]
+        return out
+
+
+class Derivative(MathChannel):
+    """Rate of change of signal in volts per millisecond"""
+    name = 'd/dt'
+    unit = 'V/ms'
+
+    def __init__(self):
+        super().__init__()
+        self.previous = None
+
+    def reset(self):
+        self.previous = None
+
+    def compute(self, chunk):
+        chunk = toArray(chunk).astype(np.float64)
+        if not len(chunk):
+            return chunk
+        previous = chunk[0] if self.previous is None else self.previous
+        self.previous = chunk[-1]
+        return np.diff(chunk, prepend=previous) * self.sampleRate / 1000
+
+
+class Integral(MathChannel):
+    """Integral of signal since reset in volt-milliseconds"""
+    name = 'integral'
+    unit = 'Vms'
+
+    def __init__(self):
+        super().__init__()
+        self.total = 0.0
+
+    def reset(self):
+        self.total = 0.0
+
+    def compute(self, chunk):
+        out = self.total + np.cumsum(toArray(chunk).astype(np.float64)) * 1000 / self.sampleRate
+        if len(out):
+            self.total = out[-1]
+        return out
+
+
+class Difference(MathChannel):
+    name = 'A-B'
+    requiredChannels = 2
+
+    def compute(self, a, b):
+        return toArray(a).astype(np.float64) - toArray(b)
+
+
+class Product(MathChannel):
+    name = 'AxB'
+    unit = 'V2'
+    requiredChannels = 2
+
+    def compute(self, a, b):
+        return toArray(a).astype(np.float64) * toArray(b)
+
+
+class MathPipeline:
+    """Class computing enabled math channels from captures, similar to DecoderPipeline
+
+    Attributes:
+        channels: list of enabled MathChannel objects
+        factories: dict {class of channel: function creating it with settings chosen by user}
+    """
+    def __init__(self, factories=None):
+        self.channels = []
+        self.factories = factories or {}
+        self.cache = (None, None, [])
+
+    def toggle(self, channelClass):
+        """Removes channel of provided class if present or adds one with default settings"""
+        if any(type(channel) == channelClass for channel in self.channels):
+            self.channels = [channel for channel in self.channels if type(channel) != channelClass]
+        else:
+            self.channels.append(self.factories.get(channelClass, channelClass)())
+        self.cache = (None, None, [])
+
+    def isEnabled(self):
+        return len(self.channels) != 0
+
+    def run(self, data, sampleRate, continuous=False):
+        """Returns list of tuples (channel, values) for capture - single channel or list of channels.
+            If continuous is set, capture is treated as the next chunk of the previous one (auto re-arm),
+            otherwise channels start from scratch. Result is cached until different capture is provided"""
+        if not self.channels:
+            return []
+        if self.cache[0] is data and self.cache[1] == sampleRate:
+            return self.cache[2]
+
+        inputs = data if type(data) == list and data and type(data[0]) != tuple else [data]
+        inputs = [toArray(channel) for channel in inputs]
+        traces = []
+        for channel in self.channels:
+            if channel.requiredChannels > len(inputs) or not len(inputs[0]):
+                continue
+            if not continuous:
+                channel.reset()
+            traces.append((channel, channel.process(inputs, sampleRate)))
+
+        self.cache = (data, sampleRate, traces)
+        return traces
+
+
+def main():
+    """Checks filters against direct per-sample evaluation - signal is processed in random chunks"""
+    rng = np.random.default_rng(1)
+    signal = np.sin(np.arange(5000) * 0.01) + rng.normal(0, 0.3, 5000)
+    sampleRate = 10000
+
+    def reference(channel):
+        if isinstance(channel, SinglePoleIIR):
+            channel.process([signal[:1]], sampleRate)
+            d, y, out = channel.decay, signal[0], []
+            for x in signal:
+                y = d * y + (1 - d) * x
+                out.append(y)
+            return np.array(out)
+        channel.process([signal[:1]], sampleRate)
+        if isinstance(channel, FirFilter):
+            padded = np.concatenate((np.full(len(channel.taps) - 1, signal[0]), signal))
+            return np.array([np.dot(padded[i:i + len(channel.taps)], channel.taps[::-1]) for i in range(len(signal))])
+        if isinstance(channel, Derivative):
+            return np.diff(signal, prepend=signal[0]) * sampleRate / 1000
+        return np.cumsum(signal) * 1000 / sampleRate
+
+    failed = 0
+    for channel in (MovingAverage(8), LowPass(), BandPass(), SinglePoleIIR(), SinglePoleIIR(4000), Derivative(),
+                    Integral()):
+        expected = reference(channel)
+        channel.reset()
+        cuts = np.sort(rng.choice(np.arange(1, len(signal)), 20, replace=False))
+        result = np.concatenate([channel.process([chunk], sampleRate) for chunk in np.split(signal, cuts)])
+        error = np.max(np.abs(result - expected))
+        ok = error < 1e-6 * max(np.max(np.abs(expected)), 1)
+        failed += not ok
+        print('{:<10} max error {:.2e} - {}'.format(channel.name, error, 'OK' if ok else 'FAILED'))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,98 @@
+import math
+import numpy as np
+
+
+class MinMaxPyramid:
+    """Class storing samples together with their multi-resolution min/max summary
+        Level 0 contains raw samples, each next level contains minimum and maximum of
+        pairs of elements from previous level. Levels are extended incrementally when new
+        samples are appended, so cost of append is proportional to number of new samples.
+
+    Attributes:
+        length: number of samples stored
+    """
+    INITIAL_CAPACITY = 1024
+
+    def __init__(self, data=None):
+        self.clear()
+        if data is not None:
+            self.append(data)
+
+    def __len__(self):
+        return self.length
+
+    def clear(self):
+        self.length = 0
+        self.base = np.empty(self.INITIAL_CAPACITY, dtype=np.float32)
+        self.levels = []            # list of [mins, maxs, length]
+
+    @staticmethod
+    def reserve(array, size):
+        """Returns array with capacity of at least provided size keeping its content"""
+        if len(array) >= size:
+            return array
+        grown = np.empty(max(size, len(array) * 2), dtype=array.dtype)
+        grown[:len(array)] = array
+        return grown
+
+    def samples(self):
+        """Returns array of all stored samples (without copying)"""
+        return self.base[:self.length]
+
+    def append(self, values):
+        """Appends samples and updates summary levels"""
+        values = np.asarray(values, dtype=np.float32)
+        self.base = self.reserve(self.base, self.length + len(values))
+        self.base[self.length:self.length + len(values)] = values
+        self.length += len(values)
+
+        prevMins, prevMaxs, prevLength = self.base, self.base, self.length
+        level = 0
+        while prevLength >= 2:
+            if level == len(self.levels):
+                self.levels.append([np.empty(0, dtype=np.float32), np.empty(0, dtype=np.float32), 0])
+            mins, maxs, count = self.levels[level]
+            newCount = prevLength // 2
+            if newCount > count:
+                mins = self.reserve(mins, newCount)
+                maxs = self.reserve(maxs, newCount)
+                np.minimum(prevMins[2 * count:2 * newCount:2], prevMins[2 * count + 1:2 * newCount:2],
+                           out=mins[count:newCount])
+                np.maximum(prevMaxs[2 * count:2 * newCount:2], prevMaxs[2 * count + 1:2 * newCount:2],
+                           out=maxs[count:newCount])
+                self.levels[level] = [mins, maxs, newCount]
+            prevMins, prevMaxs, prevLength = mins, maxs, newCount
+            level += 1
+
+    def level(self, no):
+        """Returns tuple (mins, maxs, length) of level, where each element summarizes 2^no samples"""
+        if no == 0:
+            return self.base, self.base, self.length
+        return tuple(self.levels[no - 1])
+
+    def query(self, start, end, columns):
+        """Splits samples from range [start, end) into provided number of columns and returns
+            tuple (positions, mins, maxs) - number of first sample, minimum and maximum value of each column
+            Columns are computed from the level with resolution closest to the requested one,
+            so cost depends only on number of columns"""
+        start = max(int(start), 0)
+        end = min(int(math.ceil(end)), self.length)
+        if end <= start or columns < 1:
+            empty = np.zeros(0, dtype=np.float32)
+            return empty, empty, empty
+
+        samplesPerColumn = (end - start) / columns
+        no = 0 if samplesPerColumn < 2 else min(int(math.log2(samplesPerColumn)), len(self.levels))
+        mins, maxs, length = self.level(no)
+
+        positions = np.linspace(start, end, columns + 1)
+        edges = np.minimum((positions.astype(np.int64) >> no), length)
+        starts = np.minimum(edges[:-1], length - 1)
+        stop = max(edges[-1], starts[-1] + 1)
+        columnMins = np.minimum.reduceat(mins[:stop], starts)
+        columnMaxs = np.maximum.reduceat(maxs[:stop], starts)
+        # Column ending inside of element shares it with the next column
+        shared = (positions[1:] > (edges[1:] << no)) & (edges[1:] < length)
+        np.minimum(columnMins, mins[np.minimum(edges[1:], length - 1)], out=columnMins, where=shared)
+        np.maximum(columnMaxs, maxs[np.minimum(edges[1:], length - 1)], out=columnMaxs, where=shared)
+        return positions[:-1], columnMins, columnMaxs
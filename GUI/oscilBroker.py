@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+import argparse
+import collections
+import os
+import socket
+import struct
+import sys
+import tempfile
+import threading
+from time import sleep, monotonic
+import numpy as np
+import serial
+from serialCom import SerialCom
+from recording import Capture, DFT_CALIBRATION
+from samples import toArray
+from oscilClient import Oscilloscope, OscilError
+from tracing import traced
+
+"""Layout of frame sent to subscribers:
+    header  - FRAME_FORMAT: magic, number of channels, samples per channel, sequence number of capture,
+              host time of trigger, frequency of samples, number of sample at which device was triggered
+    samples - channels * samples uint16 values (channel after channel) in units of DFT_CALIBRATION volts
+
+   Every capture is packed into frame once and the same bytes are queued for every subscriber.
+   Frames dropped for slow subscriber are visible as gaps in sequence numbers."""
+FRAME_MAGIC = b'OSCF'
+FRAME_FORMAT = '<4sHIQddi'
+FRAME_HEADER_SIZE = struct.calcsize(FRAME_FORMAT)
+"""Address broker listens on by default"""
+DFT_ADDRESS = 'localhost:5025'
+"""Number of frames queued for subscriber - the oldest one is dropped when the next one comes"""
+DFT_QUEUE_DEPTH = 8
+"""Size of send buffer of socket of subscriber - kept small, so frames wait in queue where they can be dropped"""
+SEND_BUFFER_SIZE = 64 * 1024
+
+
+def parseAddress(address):
+    """Returns (family, address) of socket - HOST:PORT is TCP, anything else is path of Unix socket"""
+    host, separator, port = address.rpartition(':')
+    if separator and port.isdigit() and '/' not in address:
+        return socket.AF_INET, (host or 'localhost', int(port))
+    return socket.AF_UNIX, address
+
+
+def packFrame(capture, sequence):
+    """Returns frame of capture - voltages are stored the same way as in recording file"""
+    raw = np.stack([np.clip(np.rint(toArray(channel) / DFT_CALIBRATION), 0, 0xffff).astype('<u2')
+                    for channel in capture.channels])
+    header = struct.pack(FRAME_FORMAT, FRAME_MAGIC, raw.shape[0], raw.shape[1], sequence, capture.timestamp,
+                         capture.sampleRate, capture.triggerIndex)
+    return header + raw.tobytes()
+
+
+class Client:
+    """Subscriber connected to broker - frames are sent by its own thread from queue of limited depth,
+       so slow subscriber loses the oldest frames instead of stalling acquisition or other subscribers
+
+    Attributes:
+        dropped: number of frames dropped because subscriber did not keep up
+    """
+    def __init__(self, connection, depth, onClose):
+        self.connection = connection
+        self.queue = collections.deque(maxlen=depth)
+        self.ready = threading.Condition()
+        self.dropped = 0
+        self.closed = False
+        self.onClose = onClose
+        threading.Thread(target=self.sender, daemon=True).start()
+
+    def push(self, frame):
+        with self.ready:
+            if len(self.queue) == self.queue.maxlen:
+                self.dropped += 1
+            self.queue.append(frame)
+            self.ready.notify()
+
+    def sender(self):
+        try:
+            while True:
+                with self.ready:
+                    while not self.queue and not self.closed:
+                        self.ready.wait()
+                    if self.closed:
+                        return
+                    frame = self.queue.popleft()
+                self.connection.sendall(frame)
+        except OSError:
+            pass
+        finally:
+            self.close()
+
+    def close(self):
+        with self.ready:
+            self.closed = True
+            self.ready.notify()
+            connection, self.connection = self.connection, None
+        if connection is not None:
+            try:
+                connection.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            connection.close()
+            self.onClose(self)
+
+
+class Broker:
+    """Process owning device - acquires captures and fans them out to subscribers over TCP or Unix socket
+
+    Example:
+        with Oscilloscope('/dev/ttyACM0') as scope, Broker(scope, 'localhost:5025') as broker:
+            broker.run()
+
+    Attributes:
+        clients: list of connected subscribers (Client objects)
+        published: number of captures sent so far
+    """
+    def __init__(self, scope, address=DFT_ADDRESS, depth=DFT_QUEUE_DEPTH):
+        self.scope = scope
+        self.depth = depth
+        self.clients = []
+        self.lock = threading.Lock()
+        self.published = 0
+        family, self.address = parseAddress(address)
+        if family == socket.AF_UNIX and os.path.exists(self.address):
+            os.unlink(self.address)
+        self.server = socket.socket(family, socket.SOCK_STREAM)
+        if family == socket.AF_INET:
+            self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind(self.address)
+        self.server.listen()
+        threading.Thread(target=self.acceptor, daemon=True).start()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def acceptor(self):
+        try:
+            while True:
+                connection, _ = self.server.accept()
+                connection.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, SEND_BUFFER_SIZE)
+                if connection.family != socket.AF_UNIX:
+                    connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+                with self.lock:
+                    self.clients.append(Client(connection, self.depth, self.removeClient))
+        except OSError:
+            pass
+
+    def removeClient(self, client):
+        with self.lock:
+            if client in self.clients:
+                self.clients.remove(client)
+
+    @traced('publish')
+    def publish(self, capture):
+        """Queues capture for every subscriber - returns immediately"""
+        frame = packFrame(capture, self.published)
+        self.published += 1
+        with self.lock:
+            clients = list(self.clients)
+        for client in clients:
+            client.push(frame)
+
+    def run(self, count=None, immediately=False):
+        """Publishes count captures of device (endless if None)"""
+        for capture in self.scope.captures(count, immediately):
+            self.publish(capture)
+
+    def close(self):
+        self.server.close()
+        with self.lock:
+            clients = list(self.clients)
+        for client in clients:
+            client.close()
+        if type(self.address) == str and os.path.exists(self.address):
+            os.unlink(self.address)
+
+
+class Subscriber:
+    """Client of broker - provides captures published after it has connected
+
+    Example:
+        with Subscriber('localhost:5025') as subscriber:
+            for capture in subscriber.captures(10):
+                ...
+
+    Attributes:
+        lost: number of captures dropped by broker because subscriber did not keep up
+        lastSequence: sequence number of the last received capture
+    """
+    def __init__(self, address=DFT_ADDRESS):
+        family, address = parseAddress(address)
+        self.socket = socket.socket(family, socket.SOCK_STREAM)
+        self.socket.connect(address)
+        self.lost = 0
+        self.lastSequence = None
+        self.buffer = bytearray(FRAME_HEADER_SIZE)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def close(self):
+        self.socket.close()
+
+    def receiveInto(self, view):
+        while len(view):
+            received = self.socket.recv_into(view)
+            if received == 0:
+                raise ConnectionError('Broker has closed connection')
+            view = view[received:]
+
+    def receive(self):
+        """Waits for the next capture - raises ConnectionError when broker is gone"""
+        header = memoryview(self.buffer)[:FRAME_HEADER_SIZE]
+        self.receiveInto(header)
+        magic, channels, samples, sequence, timestamp, sampleRate, triggerIndex = struct.unpack(FRAME_FORMAT, header)
+        if magic != FRAME_MAGIC:
+            raise ConnectionError('Unexpected data from broker')
+        size = FRAME_HEADER_SIZE + channels * samples * 2
+        if len(self.buffer) < size:
+            self.buffer = bytearray(size)
+        self.receiveInto(memoryview(self.buffer)[FRAME_HEADER_SIZE:size])
+
+        if self.lastSequence is not None:
+            self.lost += sequence - self.lastSequence - 1
+        self.lastSequence = sequence
+        raw = np.frombuffer(self.buffer, dtype='<u2', count=channels * samples, offset=FRAME_HEADER_SIZE)
+        volts = raw.reshape(channels, samples) * DFT_CALIBRATION
+        return Capture(list(volts), sampleRate, triggerIndex, timestamp)
+
+    def captures(self, count=None):
+        """Iterator of count captures (endless if None), ends when broker is closed"""
+        taken = 0
+        while count is None or taken < count:
+            try:
+                capture = self.receive()
+            except ConnectionError:
+                return
+            taken += 1
+            yield capture
+
+
+def loopback():
+    """Runs broker against simulated device on temporary Unix socket with fast and slow subscriber.
+       Fast one has to receive every capture intact, slow one has to lose some of them without
+       slowing acquisition down"""
+    from simDevice import SimulatedDevice, SquareSource
+    device = SimulatedDevice(SquareSource(1000, edge=1e-4), noise=2.0, realTime=True)
+    # Socket is created in its own directory, removed with it
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, 'broker.sock')
+        count, sent, results = 60, [], {}
+
+        def subscribe(name, delay):
+            with Subscriber(path) as subscriber:
+                ready.release()
+                received = []
+                for capture in subscriber.captures():
+                    received.append(capture)
+                    sleep(delay)
+                results[name] = (received, subscriber.lost)
+
+        try:
+            with Oscilloscope(device.start()) as scope, Broker(scope, path, depth=2) as broker:
+                scope.configure(freq=50000, numberOfSamples=2000, autoRearm=True)
+                ready = threading.Semaphore(0)
+                threads = [threading.Thread(target=subscribe, args=(name, delay)) for name, delay in
+                           (('fast', 0), ('slow', 0.2))]
+                for thread in threads:
+                    thread.start()
+                ready.acquire()
+                ready.acquire()
+                while len(broker.clients) < 2:
+                    sleep(0.01)
+                start = monotonic()
+                for capture in scope.captures(count):
+                    sent.append(capture)
+                    broker.publish(capture)
+                elapsed = monotonic() - start
+                # Lets fast subscriber read the last frames before connections are closed
+                sleep(0.5)
+                dropped = sum(client.dropped for client in broker.clients)
+        finally:
+            device.stop()
+        for thread in threads:
+            thread.join()
+
+    fast, fastLost = results['fast']
+    slow, _ = results['slow']
+    intact = len(fast) == count and fastLost == 0 and all(
+        np.allclose(a.channels[0], b.channels[0], atol=DFT_CALIBRATION) and a.timestamp == b.timestamp
+        for a, b in zip(fast, sent))
+    print('fast subscriber  received {}/{} captures, lost {} - {}'.format(len(fast), count, fastLost,
+                                                                          'OK' if intact else 'FAILED'))
+    dropping = dropped > 0 and len(slow) + dropped <= count
+    print('slow subscriber  received {}/{} captures, {} dropped by broker - {}'.format(
+        len(slow), count, dropped, 'OK' if dropping else 'FAILED'))
+    print('acquisition      {:.2f} captures/s'.format(count / elapsed))
+    return 0 if intact and dropping else 1
+
+
+def main():
+    """Owns device and serves its captures to subscribers"""
+    parser = argparse.ArgumentParser(description='Broker sharing captures of oscilloscope built on STM32 '
+                                                 'microcontroller between several clients')
+    parser.add_argument('port', nargs='?', help='serial port device is connected to')
+    parser.add_argument('--listen', metavar='ADDRESS', default=DFT_ADDRESS,
+                        help='HOST:PORT or path of Unix socket (default: {})'.format(DFT_ADDRESS))
+    parser.add_argument('--depth', type=int, default=DFT_QUEUE_DEPTH,
+                        help='frames queued for each subscriber before the oldest ones are dropped (default: {})'
+                        .format(DFT_QUEUE_DEPTH))
+    parser.add_argument('--freq', type=int, help='frequency of stored samples')
+    parser.add_argument('--samples', type=int, help='number of samples of each capture')
+    parser.add_argument('--level', type=float, help='trigger level in volts')
+    parser.add_argument('--digital', action='store_true', help='logic analyser mode - inputs PA0-PA7 are captured')
+    parser.add_argument('--rearm', action='store_true', help='auto re-arm - capture while previous one is sent')
+    parser.add_argument('--now', action='store_true', help='trigger immediately instead of waiting for trigger')
+    parser.add_argument('--simulate', metavar='HZ', type=float,
+                        help='use simulated device with square wave of provided frequency instead of serial port')
+    parser.add_argument('--loopback', action='store_true',
+                        help='check broker with simulated device and two local subscribers, then exit')
+    args = parser.parse_args()
+
+    if args.loopback:
+        return loopback()
+    device = None
+    if args.simulate is not None:
+        from simDevice import SimulatedDevice, SquareSource, CounterSource
+        device = SimulatedDevice(SquareSource(args.simulate, edge=0.1 / args.simulate), noise=2.0, realTime=True,
+                                 digitalSource=CounterSource(args.simulate))
+        args.port = device.start()
+    elif args.port is None:
+        parser.error('Please provide serial port or --simulate')
+
+    settings = {name: value for name, value in (('freq', args.freq), ('numberOfSamples', args.samples),
+                                                ('triggerLevel', args.level)) if value is not None}
+    settings['autoRearm'] = args.rearm
+    if args.digital:
+        settings['mode'] = SerialCom.PROBING_DIGITAL
+    try:
+        with Oscilloscope(args.port) as scope, Broker(scope, args.listen, args.depth) as broker:
+            scope.configure(**settings)
+            print('Serving captures on {}'.format(args.listen))
+            while True:
+                try:
+                    broker.run(immediately=args.now)
+                except OscilError as e:
+                    # No trigger - subscribers keep their connections until the next capture
+                    print('Warning: {}'.format(e), file=sys.stderr)
+    except KeyboardInterrupt:
+        return 0
+    except (OscilError, OSError, serial.serialutil.SerialException) as e:
+        print('Error: {}'.format(e), file=sys.stderr)
+        return 1
+    finally:
+        if device is not None:
+            device.stop()
+
+
+if __name__ == '__main__':
+    exit(main())
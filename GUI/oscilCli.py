@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+import argparse
+import sys
+import os
+from time import monotonic
+import serial
+from serialCom import SerialCom, TriggerConfig
+from oscilClient import DeviceGroup, OscilError, export, exportFormat, EXPORT_FORMATS
+from oscilBroker import Subscriber
+from maskTest import Mask, MaskTester, DFT_TOLERANCE, DFT_TIME_TOLERANCE
+import tracing
+
+"""Names of trigger conditions, in order of types of TriggerConfig"""
+TRIGGER_TYPES = ('level', 'pulse', 'runt', 'pattern')
+
+
+def subscribe(args):
+    """Writes captures published by broker - settings of device are chosen by broker"""
+    try:
+        with Subscriber(args.broker) as subscriber:
+            start = monotonic()
+            captures = list(subscriber.captures(args.count))
+            elapsed = monotonic() - start
+            lost = subscriber.lost
+    except OSError as e:
+        print('Error: could not connect to broker: {}'.format(e), file=sys.stderr)
+        return 1
+    print('Received {} captures in {:.3f} s, {} dropped by broker'.format(len(captures), elapsed, lost))
+    if args.output is not None and captures:
+        export(captures, args.output, args.format)
+        print('Written to {}'.format(args.output))
+    return 0 if captures else 1
+
+
+def main():
+    """Takes captures without display and writes them to file"""
+    parser = argparse.ArgumentParser(description='Headless client of oscilloscope built on STM32 microcontroller')
+    parser.add_argument('port', nargs='?', help='serial port device is connected to')
+    parser.add_argument('--device', metavar='PORT', action='append', default=[],
+                        help='serial port of another device armed together with the first one (can be repeated)')
+    parser.add_argument('-n', '--count', type=int, default=1, help='number of captures to take')
+    parser.add_argument('-o', '--output', metavar='FILE', help='file captures are written to')
+    parser.add_argument('--format', choices=EXPORT_FORMATS, help='format of output (default: extension of file)')
+    parser.add_argument('--freq', type=int, help='frequency of stored samples')
+    parser.add_argument('--samples', type=int, help='number of samples of each capture')
+    parser.add_argument('--level', type=float, help='trigger level in volts')
+    parser.add_argument('--decimation', type=int, help='number of readings averaged into one sample')
+    parser.add_argument('--segments', type=int, help='number of segments of segmented capture')
+    parser.add_argument('--width', type=int, choices=(16, 12, 8), help='bits of sample stored by device')
+    parser.add_argument('--digital', action='store_true',
+                        help='logic analyser mode - inputs PA0-PA7 are captured, any change triggers capture')
+    parser.add_argument('--trigger', choices=TRIGGER_TYPES, help='trigger condition (default: level)')
+    parser.add_argument('--pulse', metavar='SECONDS', type=float, default=1e-4,
+                        help='limit of pulse width of pulse trigger (default: 100us)')
+    parser.add_argument('--longer', action='store_true', help='pulse trigger fires on pulses longer than limit')
+    parser.add_argument('--negative', action='store_true', help='pulse or runt below trigger level')
+    parser.add_argument('--upper', metavar='VOLTS', type=float, default=2.5,
+                        help='upper level of runt trigger (default: 2.5)')
+    parser.add_argument('--pattern', type=TriggerConfig.parsePattern, default='1',
+                        help='pattern of digital inputs written from D0, e.g. 1x0 (default: 1)')
+    parser.add_argument('--rearm', action='store_true', help='auto re-arm - capture while previous one is downloaded')
+    parser.add_argument('--now', action='store_true', help='trigger immediately instead of waiting for trigger')
+    parser.add_argument('--timeout', type=float, default=10, help='time of waiting for trigger in seconds')
+    parser.add_argument('--simulate', metavar='HZ', type=float,
+                        help='use simulated device with square wave (or digital counter) of provided frequency '
+                             'instead of serial port')
+    parser.add_argument('--baudrate', type=int, help='speed of UART of simulated device (default: unlimited)')
+    parser.add_argument('--devices', type=int, default=1, help='number of simulated devices (default: 1)')
+    parser.add_argument('--mask', metavar='FILE',
+                        help='test captures against mask from file - if it does not exist, the first capture '
+                             'is golden and mask built from it is saved')
+    parser.add_argument('--mask-tolerance', metavar='VOLTS', type=float, default=DFT_TOLERANCE,
+                        help='distance of mask from golden capture (default: {})'.format(DFT_TOLERANCE))
+    parser.add_argument('--mask-time', metavar='SAMPLES', type=int, default=DFT_TIME_TOLERANCE,
+                        help='samples by which edges can move inside mask (default: {})'.format(DFT_TIME_TOLERANCE))
+    parser.add_argument('--mask-stop', action='store_true',
+                        help='stop on the first capture which fails mask test - it is the last one written')
+    parser.add_argument('--trace', metavar='FILE',
+                        help='record spans of waiting for trigger and downloading, written to FILE in Chrome '
+                             'trace format')
+    parser.add_argument('--broker', metavar='ADDRESS',
+                        help='receive captures from oscilBroker.py (HOST:PORT or Unix socket) instead of device')
+    args = parser.parse_args()
+
+    if args.output is not None:
+        try:
+            exportFormat(args.output, args.format)
+        except ValueError as e:
+            parser.error(str(e))
+    if args.mask is not None and args.digital:
+        parser.error('Mask test is supported only for analog captures')
+    if args.trace is not None:
+        tracing.enable()
+
+    if args.broker is not None:
+        return subscribe(args)
+    simulated = []
+    if args.simulate is not None:
+        from simDevice import SimulatedDevice, SquareSource, CounterSource
+        for _ in range(args.devices):
+            simulated.append(SimulatedDevice(SquareSource(args.simulate, edge=0.1 / args.simulate), noise=2.0,
+                                             realTime=True, baudrate=args.baudrate,
+                                             digitalSource=CounterSource(args.simulate)))
+        ports = [device.start() for device in simulated]
+    elif args.port is None:
+        parser.error('Please provide serial port or --simulate')
+    else:
+        ports = [args.port] + args.device
+
+    settings = {name: value for name, value in (('freq', args.freq), ('numberOfSamples', args.samples),
+                                                ('triggerLevel', args.level), ('decimation', args.decimation),
+                                                ('numberOfSegments', args.segments),
+                                                ('sampleWidth', args.width)) if value is not None}
+    settings['autoRearm'] = args.rearm
+    if args.digital:
+        settings['mode'] = SerialCom.PROBING_DIGITAL
+    try:
+        with DeviceGroup(ports, timeout=args.timeout) as group:
+            group.configure(**settings)
+            if args.trigger is not None:
+                pattern, mask = args.pattern
+                group.setTrigger(type=TRIGGER_TYPES.index(args.trigger), negative=args.negative, longer=args.longer,
+                                 upperLevel=args.upper, width=max(round(args.pulse * group.scopes[0].sampleClock()), 1),
+                                 pattern=pattern, mask=mask)
+            tester = None
+            if args.mask is not None and os.path.exists(args.mask):
+                tester = MaskTester(Mask.load(args.mask), args.mask_stop)
+            start = monotonic()
+            rounds = []
+            for captures in group.captures(args.count, immediately=args.now):
+                rounds.append(captures)
+                if args.mask is None:
+                    continue
+                if tester is None:
+                    golden = Mask.fromGolden(captures[0].channels[0], args.mask_tolerance, args.mask_time)
+                    golden.save(args.mask)
+                    tester = MaskTester(golden, args.mask_stop)
+                elif not tester.test(captures[0].channels[0]) and tester.isStopped():
+                    break
+            elapsed = monotonic() - start
+    except (OscilError, serial.serialutil.SerialException) as e:
+        print('Error: {}'.format(e), file=sys.stderr)
+        return 1
+    finally:
+        for device in simulated:
+            device.stop()
+        if args.trace is not None:
+            print('Written {} trace events to {}'.format(tracing.dump(args.trace), args.trace))
+
+    samples = sum(len(capture.channels[0]) for captures in rounds for capture in captures)
+    print('Captured {} ({} samples) in {:.3f} s - {:.2f} captures/s'.format(len(rounds), samples, elapsed,
+                                                                          len(rounds) / elapsed))
+    if tester is not None:
+        tested = tester.passes + tester.failures
+        print('Mask test: {} passed, {} failed - {:.2f} waveforms/s{}'.format(
+            tester.passes, tester.failures, tested / elapsed,
+            ', stopped on capture {}'.format(len(rounds)) if tester.isStopped() else ''))
+    if len(ports) > 1:
+        # Triggers of devices relative to the first one, on host clock
+        skews = [[capture.timestamp - captures[0].timestamp for capture in captures[1:]] for captures in rounds]
+        print('Trigger times relative to the first device (ms): ' +
+              ', '.join('{:+.3f}'.format(sum(column) / len(column) * 1000) for column in zip(*skews)))
+    if args.output is not None:
+        # Captures of each device are written to separate file - name of the first one is not changed
+        root, extension = os.path.splitext(args.output)
+        for no in range(len(ports)):
+            name = args.output if no == 0 else '{}-{}{}'.format(root, no + 1, extension)
+            export([captures[no] for captures in rounds], name, args.format)
+            print('Written to {}'.format(name))
+    return 0
+
+
+if __name__ == '__main__':
+    exit(main())
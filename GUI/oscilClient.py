@@ -0,0 +1,378 @@
+import asyncio
+import concurrent.futures
+import os
+from time import sleep, monotonic, time
+import numpy as np
+from serialCom import SerialCom, AcquisitionConfig, TriggerConfig
+from recording import Capture, Recorder
+from samples import toArray, expandRuns, toLanes
+from ets import reconstruct
+from tracing import span, instant
+from streamExport import CaptureSource, exportStream, EXPORT_FORMATS as STREAM_FORMATS
+
+"""Interval of polling device for finished capture"""
+POLL_INTERVAL = 0.005
+"""Time after which DOWNLOAD_NEXT refused by device (no capture ready) is sent again"""
+NEXT_RETRY_INTERVAL = 0.02
+"""Time (in seconds) of waiting for trigger, on top of duration of capture itself"""
+DFT_TIMEOUT = 10
+"""Supported formats of export - comma separated values, NumPy array, recording of recording.py,
+   formats of streamExport.py"""
+EXPORT_FORMATS = ('csv', 'npy', 'rec') + STREAM_FORMATS
+
+
+"""Number of GET_TIME exchanges used to find time of trigger - the one with the shortest round trip is used"""
+TIME_EXCHANGES = 3
+
+
+class OscilError(Exception):
+    """Raised when device does not respond, refuses command or capture does not come in time"""
+
+
+def triggerTime(serial, exchanges=TIME_EXCHANGES):
+    """Returns host time (as time()) at which the last capture of device was triggered, or None on failure.
+       Timer of device is read in the middle of exchange, so error is at most half of its round trip"""
+    best = None
+    for _ in range(exchanges):
+        sent = time()
+        times = serial.getTime()
+        received = time()
+        if times is not None and (best is None or received - sent < best[0]):
+            now, trigger = times
+            best = (received - sent, (sent + received) / 2 - ((now - trigger) & 0xffffffff) / 1e6)
+    return best[1] if best is not None else None
+
+
+class Oscilloscope:
+    """Headless interface to device for scripts and automated tests
+
+    All commands are executed by single worker thread in order of calls, so capture armed with arm()
+    can be awaited as future while the script does something else, e.g. stimulates tested board.
+
+    Example:
+        with Oscilloscope('/dev/ttyACM0') as scope:
+            scope.configure(freq=20000, numberOfSamples=1000, triggerLevel=1.5)
+            future = scope.arm()
+            ...
+            volts = future.result()[0].channels[0]
+
+    Attributes:
+        config: AcquisitionConfig applied to device
+        trigger: TriggerConfig applied to device
+        timeout: time of waiting for trigger (in seconds)
+    """
+    def __init__(self, port, timeout=DFT_TIMEOUT):
+        self.serial = SerialCom(port)
+        self.timeout = timeout
+        self.worker = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+        self.streaming = False
+        if self.call(self.serial.ping) != 0:
+            self.close()
+            raise OscilError('Device on {} is not responding'.format(port))
+
+        # Device configured before keeps its settings, otherwise defaults of AcquisitionConfig are sent
+        config = self.call(self.serial.getConfig)
+        if config is not None and config.numberOfSamples > 0:
+            self.config = config
+        else:
+            self.config = AcquisitionConfig()
+            self.configure()
+        self.trigger = self.call(self.serial.getTriggerConfig) or TriggerConfig()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def call(self, job, *args):
+        """Runs job in worker thread and waits for its result"""
+        return self.worker.submit(job, *args).result()
+
+    def close(self):
+        """Stops device and closes serial port"""
+        try:
+            self.call(self.stopStreaming)
+        finally:
+            self.worker.shutdown()
+            self.serial.serial.close()
+
+    def configure(self, **settings):
+        """Changes provided attributes of AcquisitionConfig (e.g. freq=20000, autoRearm=True) and sends
+           whole configuration to device. Raises OscilError if device refuses it"""
+        config = AcquisitionConfig(**vars(self.config))
+        for name, value in settings.items():
+            if not hasattr(config, name):
+                raise TypeError('Unknown setting: {}'.format(name))
+            setattr(config, name, value)
+        status = self.call(self.applyConfig, config)
+        if status != 0:
+            raise OscilError('Device refused configuration ({})'.format('busy' if status == 2 else 'invalid settings'))
+        self.config = config
+        # Pulse, runt and pattern triggers fall back to level trigger in modes which do not support them
+        self.trigger = self.call(self.serial.getTriggerConfig) or TriggerConfig()
+
+    def setTrigger(self, **settings):
+        """Changes provided attributes of TriggerConfig (e.g. type=TriggerConfig.PULSE, width=100) and sends
+           trigger condition to device. Raises OscilError if device refuses it"""
+        trigger = TriggerConfig(**vars(self.trigger))
+        for name, value in settings.items():
+            if not hasattr(trigger, name):
+                raise TypeError('Unknown trigger setting: {}'.format(name))
+            setattr(trigger, name, value)
+        status = self.call(self.serial.setTriggerConfig, trigger)
+        if status != 0:
+            raise OscilError('Device refused trigger ({})'.format('busy' if status == 2 else 'invalid condition'))
+        self.trigger = trigger
+
+    def sampleClock(self):
+        """Returns frequency of sample clock trigger conditions are measured in"""
+        return self.config.freq * self.config.decimation
+
+    def applyConfig(self, config):
+        self.stopStreaming()
+        return self.serial.setConfig(config)
+
+    def submitConfig(self, config, trigger):
+        """Sends configuration and trigger condition from worker thread without waiting for it.
+           Returns future of status of device (0 - accepted)"""
+        def job():
+            status = self.applyConfig(config) or self.serial.setTriggerConfig(trigger)
+            if status == 0:
+                self.config, self.trigger = config, trigger
+            return status
+        return self.worker.submit(job)
+
+    def sampleRate(self):
+        """Returns rate of samples in captures - in equivalent-time mode it is multiple of probing frequency"""
+        return self.config.freq * self.config.etsSteps
+
+    def deadline(self):
+        """Returns time by which capture with current settings should be finished"""
+        config = self.config
+        return monotonic() + self.timeout + config.numberOfSamples * config.numberOfSegments / config.freq
+
+    def arm(self, immediately=False):
+        """Arms trigger (or triggers immediately) and returns future of list of captures - one per segment
+           in segmented mode, single one otherwise. Future raises OscilError on failure"""
+        return self.worker.submit(self.takeCapture, immediately)
+
+    def takeCapture(self, immediately):
+        self.stopStreaming()
+        command = self.serial.triggerNow if immediately else self.serial.trigMode
+        if command() != 0:
+            raise OscilError('Device refused to start capture')
+        deadline = self.deadline()
+        with span('wait for trigger'):
+            while not self.serial.isDataAvail():
+                if monotonic() > deadline:
+                    self.serial.turnOff()
+                    raise OscilError('Capture did not finish in time - no trigger')
+                sleep(POLL_INTERVAL)
+        instant('capture ready')
+
+        # Captures are stamped with host time of trigger, so captures of several devices can be aligned
+        start = triggerTime(self.serial) or time()
+        if self.config.mode == SerialCom.PROBING_DIGITAL:
+            # Capture armed for trigger starts with snapshot before change of inputs
+            status, runs = self.serial.downloadRuns()
+            captures = [Capture(toLanes(expandRuns(runs), SerialCom.LOGIC_CHANNELS), self.sampleRate(),
+                                triggerIndex=0 if immediately else 1, timestamp=start)]
+        elif self.config.numberOfSegments == 1:
+            status, data = self.serial.downloadData()
+            captures = [Capture([toArray(data)], self.sampleRate(), timestamp=start)]
+        else:
+            status, segments = self.serial.downloadSegments()
+            if self.config.etsSteps > 1:
+                record = reconstruct([data for _, data in segments], self.config.etsSteps)
+                captures = [Capture([record], self.sampleRate(), timestamp=start)]
+            else:
+                captures = [Capture([toArray(data)], self.sampleRate(),
+                                    timestamp=start + ((timestamp - segments[0][0]) & 0xffffffff) / 1e6)
+                            for timestamp, data in segments]
+        if not status:
+            raise OscilError('Downloading samples failed')
+        return captures
+
+    def startStreaming(self, immediately):
+        """Arms device in auto re-arm mode and requests the first capture"""
+        command = self.serial.triggerNow if immediately else self.serial.trigMode
+        if command() != 0:
+            raise OscilError('Device refused to start capture')
+        self.serial.requestNext()
+        self.streaming = True
+
+    def stopStreaming(self):
+        if self.streaming:
+            self.serial.turnOff()
+            self.serial.cancelNext()
+            self.streaming = False
+
+    def nextCapture(self):
+        """Waits for capture of auto re-arm mode, the next one is requested before this one is returned.
+           Request refused by device is sent again after NEXT_RETRY_INTERVAL"""
+        deadline = self.deadline()
+        while True:
+            while not self.serial.nextAvailable() and monotonic() <= deadline:
+                sleep(POLL_INTERVAL)
+            if self.serial.nextAvailable():
+                status, data = self.serial.receiveNext()
+                if status:
+                    instant('capture ready')
+                    self.serial.requestNext()
+                    return Capture([toArray(data)], self.sampleRate(), timestamp=time())
+            if monotonic() > deadline:
+                self.stopStreaming()
+                raise OscilError('Capture did not finish in time - no trigger')
+            sleep(NEXT_RETRY_INTERVAL)
+            self.serial.requestNext()
+
+    def captures(self, count=None, immediately=False):
+        """Iterator of count captures (endless if None). In auto re-arm mode device takes the next capture
+           while the previous one is downloaded, otherwise every capture is armed separately.
+           Segments of segmented capture are returned as separate captures"""
+        taken = 0
+        if not self.config.autoRearm:
+            while count is None or taken < count:
+                for capture in self.arm(immediately).result():
+                    if count is not None and taken >= count:
+                        return
+                    taken += 1
+                    yield capture
+            return
+
+        self.call(self.startStreaming, immediately)
+        try:
+            while count is None or taken < count:
+                taken += 1
+                yield self.call(self.nextCapture)
+        finally:
+            self.call(self.stopStreaming)
+
+    async def stream(self, count=None, immediately=False):
+        """Asynchronous version of captures(), to be used with async for"""
+        loop = asyncio.get_running_loop()
+        iterator = self.captures(count, immediately)
+        try:
+            while True:
+                capture = await loop.run_in_executor(None, next, iterator, None)
+                if capture is None:
+                    return
+                yield capture
+        finally:
+            iterator.close()
+
+
+class DeviceGroup:
+    """Several devices used together, each with its own worker thread, so they are armed and downloaded
+       concurrently. Captures are stamped with host time of trigger and can be placed on common time axis.
+
+    Example:
+        with DeviceGroup(['/dev/ttyACM0', '/dev/ttyACM1']) as group:
+            group.configure(freq=20000, numberOfSamples=1000)
+            for captures in group.captures(10):     # one capture of every device
+                offsets = [capture.timestamp - captures[0].timestamp for capture in captures]
+
+    Attributes:
+        scopes: list of Oscilloscope objects, in order of ports
+    """
+    def __init__(self, ports, timeout=DFT_TIMEOUT):
+        self.scopes = []
+        try:
+            for port in ports:
+                self.scopes.append(Oscilloscope(port, timeout))
+        except Exception:
+            self.close()
+            raise
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return len(self.scopes)
+
+    def close(self):
+        for scope in self.scopes:
+            scope.close()
+
+    def configure(self, **settings):
+        """Applies the same settings to all devices (see Oscilloscope.configure)"""
+        for scope in self.scopes:
+            scope.configure(**settings)
+
+    def setTrigger(self, **settings):
+        for scope in self.scopes:
+            scope.setTrigger(**settings)
+
+    def arm(self, immediately=False):
+        """Broadcasts arm (or trigger now) - every device is armed by its own worker at the same time.
+           Returns list of futures, one per device (see Oscilloscope.arm)"""
+        return [scope.arm(immediately) for scope in self.scopes]
+
+    def captures(self, count=None, immediately=False):
+        """Iterator of count lists holding capture of every device. Devices are armed together for every
+           round, segments of segmented capture form separate lists. In auto re-arm mode every device streams
+           on its own and its consecutive captures are paired in order of arrival"""
+        if all(scope.config.autoRearm for scope in self.scopes):
+            yield from zip(*(scope.captures(count, immediately) for scope in self.scopes))
+            return
+        taken = 0
+        while count is None or taken < count:
+            rounds = [future.result() for future in self.arm(immediately)]
+            for captures in zip(*rounds):
+                if count is not None and taken >= count:
+                    return
+                taken += 1
+                yield list(captures)
+
+
+def exportFormat(path, fmt=None):
+    """Returns format of export - provided one or guessed from extension of file"""
+    if fmt is None:
+        fmt = os.path.splitext(path)[1][1:].lower()
+    if fmt not in EXPORT_FORMATS:
+        raise ValueError('Unsupported format of export: {} (expected one of {})'.format(fmt, ', '.join(EXPORT_FORMATS)))
+    return fmt
+
+
+def export(captures, path, fmt=None):
+    """Writes captures to file. Formats:
+        csv - row per sample: number of capture, time relative to trigger (in seconds), voltage of every channel
+        npy - float32 array, row per capture (of shape channels x samples if there is more than one channel),
+              shorter captures are padded with NaN
+        rec - recording file, which can be displayed with OscilGUI.py --replay
+        vcd, sr - Value Change Dump and sigrok session, captures one after another (see streamExport.py)
+       Captures of logic analyser have channel per input. Returns number of written captures"""
+    fmt = exportFormat(path, fmt)
+    captures = list(captures)
+    channels = len(captures[0].channels) if captures else 1
+    if fmt == 'csv':
+        with open(path, 'w') as file:
+            names = ['voltage'] if channels == 1 else ['D{}'.format(no) for no in range(channels)]
+            file.write(','.join(['capture', 'time'] + names) + '\n')
+            for no, capture in enumerate(captures):
+                volts = [toArray(channel) for channel in capture.channels]
+                times = (np.arange(len(volts[0])) - capture.triggerIndex) / capture.sampleRate
+                np.savetxt(file, np.column_stack([np.full(len(times), no), times] + volts),
+                           fmt=['%d', '%.9g'] + ['%.4f'] * channels, delimiter=',')
+    elif fmt == 'npy':
+        length = max((len(capture.channels[0]) for capture in captures), default=0)
+        array = np.full((len(captures), channels, length), np.nan, dtype=np.float32)
+        for no, capture in enumerate(captures):
+            for channel, data in enumerate(capture.channels):
+                volts = toArray(data)
+                array[no, channel, :len(volts)] = volts
+        np.save(path, array[:, 0] if channels == 1 else array)
+    elif fmt in STREAM_FORMATS:
+        exportStream(CaptureSource(captures), path, fmt)
+    else:
+        recorder = Recorder(path, captures[0].sampleRate if captures else 0, channels=channels)
+        try:
+            for capture in captures:
+                recorder.write(capture.channels, sampleRate=capture.sampleRate, timestamp=capture.timestamp)
+        finally:
+            recorder.close()
+    return len(captures)
@@ -0,0 +1,107 @@
+from time import monotonic
+import numpy as np
+import pygame
+
+"""Period (in seconds) over which histogram fades by decay factor"""
+DECAY_INTERVAL = 0.1
+
+
+def buildColorMap(size=256):
+    """Returns array of colors (size x 3) used to display intensity - from dark blue through orange to white"""
+    keys = np.array([0.0, 0.15, 0.5, 0.8, 1.0])
+    colors = np.array([(0, 0, 0), (20, 30, 140), (255, 126, 0), (255, 220, 60), (255, 255, 255)], dtype=np.float32)
+    levels = np.linspace(0, 1, size)
+    return np.stack([np.interp(levels, keys, colors[:, i]) for i in range(3)], axis=1).astype(np.uint8)
+
+
+class PersistenceMap:
+    """Class accumulating captures in 2D histogram (time x voltage) of screen resolution
+        Each new capture is rasterised as vertical span per column between the lowest and the highest
+        value drawn in that column and added to histogram. Histogram fades according to time elapsed
+        since it was last faded - on every capture and every render - so fading does not depend on timebase
+        or speed of link, and traces fade out when captures stop arriving.
+
+    Attributes:
+        size: tuple (width, height) of histogram
+        decay: factor by which histogram is multiplied every DECAY_INTERVAL seconds, 1.0 - infinite persistence
+    """
+    def __init__(self, size, decay=0.85):
+        self.size = size
+        self.decay = decay
+        self.histogram = np.zeros(size, dtype=np.float32)
+        self.spans = np.zeros((size[0], size[1] + 1), dtype=np.float32)
+        self.filled = np.zeros(size, dtype=np.float32)
+        self.levels = np.zeros(size, dtype=np.float32)
+        self.indices = np.zeros(size, dtype=np.uint8)
+        # Palette surface - intensity is converted to color by pygame during blit
+        self.surface = pygame.Surface(size, depth=8)
+        self.surface.set_palette([tuple(color) for color in buildColorMap()])
+        self.surface.set_colorkey(0)
+        self.captures = 0
+        self.lastTime = None
+        # Peak of histogram after the last capture - intensity is relative to it, so fading is visible
+        self.reference = 0.0
+
+    def clear(self):
+        self.histogram.fill(0)
+        self.captures = 0
+        self.lastTime = None
+        self.reference = 0.0
+
+    def fade(self, now=None):
+        """Multiplies histogram by decay for time elapsed since it was faded last, now is time in seconds
+           (by default monotonic clock of host)"""
+        now = monotonic() if now is None else now
+        if self.decay < 1.0 and self.lastTime is not None:
+            self.histogram *= np.float32(self.decay ** (max(now - self.lastTime, 0) / DECAY_INTERVAL))
+        self.lastTime = now
+
+    def isFading(self, now=None):
+        """Checks if histogram is still visible and has not been faded for DECAY_INTERVAL"""
+        now = monotonic() if now is None else now
+        if self.decay >= 1.0 or self.lastTime is None or now - self.lastTime < DECAY_INTERVAL:
+            return False
+        # The dimmest color above background is 1/255 of intensity, which is square root of histogram
+        return self.histogram.max() > self.reference / 255 ** 2
+
+    def accumulate(self, xs, tops, bottoms, now=None):
+        """Adds capture to histogram. xs are X cords of columns covered by trace, tops and bottoms
+           are the lowest and the highest Y cords covered by trace in these columns, now is time
+           of capture in seconds (by default monotonic clock of host)"""
+        width, height = self.size
+        xs = np.rint(xs).astype(np.int64)
+        visible = (xs >= 0) & (xs < width)
+        xs = xs[visible]
+        tops, bottoms = np.minimum(tops, bottoms)[visible], np.maximum(tops, bottoms)[visible]
+        tops = np.clip(np.rint(tops), 0, height - 1).astype(np.int64)
+        bottoms = np.clip(np.rint(bottoms), 0, height - 1).astype(np.int64)
+        columns = xs * (height + 1)
+
+        # Span [top, bottom] of each column is marked by +1 at top and -1 after bottom,
+        # cumulative sum along Y axis fills it
+        self.spans.fill(0)
+        flat = self.spans.reshape(-1)
+        np.add.at(flat, columns + tops, 1)
+        np.add.at(flat, columns + bottoms + 1, -1)
+        np.cumsum(self.spans[:, :height], axis=1, out=self.filled)
+
+        self.fade(now)
+        self.histogram += self.filled
+        self.reference = self.histogram.max()
+        self.captures += 1
+
+    def render(self, now=None):
+        """Fades histogram and returns surface with it converted to colors. Empty cells are transparent"""
+        self.fade(now)
+        peak = self.reference
+        if peak > 0:
+            # Square root makes rarely hit cells (glitches) visible next to frequently hit ones
+            np.multiply(self.histogram, np.float32(1 / peak), out=self.levels)
+            np.sqrt(self.levels, out=self.levels)
+            np.multiply(self.levels, np.float32(255), out=self.levels)
+            np.ceil(self.levels, out=self.levels)
+            self.indices[...] = self.levels
+        else:
+            self.indices.fill(0)
+        pygame.surfarray.blit_array(self.surface, self.indices)
+        return self.surface
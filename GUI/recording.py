@@ -0,0 +1,197 @@
+import mmap
+import struct
+import time
+import numpy as np
+from samples import toArray
+
+"""Layout of recording file:
+    header  - HEADER_FORMAT, session parameters and location of index
+    chunks  - fixed size records, each consists of CHUNK_FORMAT header and
+              chunkSamples * channels samples (uint16, channel after channel)
+    index   - INDEX_FORMAT entry per capture, written when recording is closed
+
+   Captures are split into chunks, so location of any chunk is known without reading the file.
+   If recording was not closed properly, index is rebuilt from headers of chunks."""
+MAGIC = b'STMOSCIL'
+VERSION = 1
+HEADER_FORMAT = '<8sHHdfiHIQQ'
+HEADER_SIZE = 64
+CHUNK_FORMAT = '<IIQdfi'
+CHUNK_HEADER_SIZE = struct.calcsize(CHUNK_FORMAT)
+INDEX_DTYPE = np.dtype([('firstChunk', '<u8'), ('chunks', '<u4'), ('samples', '<u4'),
+                        ('timestamp', '<f8'), ('sampleRate', '<f4'), ('triggerIndex', '<i4')])
+CHUNK_DTYPE = np.dtype([('capture', '<u4'), ('samples', '<u4'), ('firstSample', '<u8'),
+                        ('timestamp', '<f8'), ('sampleRate', '<f4'), ('triggerIndex', '<i4')])
+
+"""Samples are stored as integers - voltage of single unit"""
+DFT_CALIBRATION = 0.001
+DFT_CHUNK_SAMPLES = 4096
+
+
+class Capture:
+    """Class representing capture read from recording
+
+    Attributes:
+        channels: list of arrays of voltages, one per channel
+        sampleRate: frequency at which samples were taken
+        triggerIndex: number of sample at which device was triggered
+        timestamp: host time at which capture was recorded
+    """
+    def __init__(self, channels, sampleRate, triggerIndex=0, timestamp=0.0):
+        self.channels = channels
+        self.sampleRate = sampleRate
+        self.triggerIndex = triggerIndex
+        self.timestamp = timestamp
+
+
+class Recorder:
+    """Class writing captures to recording file. Data is only appended to the file,
+       header is updated when recording is closed"""
+    def __init__(self, path, sampleRate, channels=1, triggerIndex=0, calibration=DFT_CALIBRATION,
+                 chunkSamples=DFT_CHUNK_SAMPLES):
+        self.file = open(path, 'wb')
+        self.sampleRate = sampleRate
+        self.channels = channels
+        self.triggerIndex = triggerIndex
+        self.calibration = calibration
+        self.chunkSamples = chunkSamples
+        self.chunkCount = 0
+        self.index = []
+        self.file.write(self.packHeader(0))
+
+    def packHeader(self, indexOffset):
+        header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, HEADER_SIZE, self.sampleRate, self.calibration,
+                             self.triggerIndex, self.channels, self.chunkSamples, self.chunkCount, indexOffset)
+        return header.ljust(HEADER_SIZE, b'\0')
+
+    def write(self, data, sampleRate=None, triggerIndex=None, timestamp=None):
+        """Appends capture to recording. data is single channel (list of (no, sample) tuples or array of voltages)
+           or list of such channels"""
+        sampleRate = self.sampleRate if sampleRate is None else sampleRate
+        triggerIndex = self.triggerIndex if triggerIndex is None else triggerIndex
+        timestamp = time.time() if timestamp is None else timestamp
+
+        channels = data if type(data) == list and data and type(data[0]) != tuple else [data]
+        if len(channels) != self.channels:
+            raise ValueError('Recording expects {} channels, got {}'.format(self.channels, len(channels)))
+        raw = np.stack([np.clip(np.rint(toArray(channel) / self.calibration), 0, 0xffff).astype('<u2')
+                        for channel in channels])
+
+        length = raw.shape[1]
+        chunks = max((length + self.chunkSamples - 1) // self.chunkSamples, 1)
+        block = np.zeros((self.channels, self.chunkSamples), dtype='<u2')
+        for no in range(chunks):
+            part = raw[:, no * self.chunkSamples:(no + 1) * self.chunkSamples]
+            block[:, :part.shape[1]] = part
+            block[:, part.shape[1]:] = 0
+            self.file.write(struct.pack(CHUNK_FORMAT, len(self.index), part.shape[1], no * self.chunkSamples,
+                                        timestamp, sampleRate, triggerIndex))
+            self.file.write(block.tobytes())
+
+        self.index.append((self.chunkCount, chunks, length, timestamp, sampleRate, triggerIndex))
+        self.chunkCount += chunks
+
+    def flush(self):
+        self.file.flush()
+
+    def close(self):
+        """Writes index of captures and updates header"""
+        indexOffset = self.file.tell()
+        self.file.write(np.array(self.index, dtype=INDEX_DTYPE).tobytes())
+        self.file.seek(0)
+        self.file.write(self.packHeader(indexOffset))
+        self.file.close()
+
+
+class Replay:
+    """Class providing access to captures stored in recording file
+        File is memory mapped, so only accessed chunks are read from disk.
+
+    Attributes:
+        position: number of currently selected capture
+    """
+    def __init__(self, path):
+        self.file = open(path, 'rb')
+        self.map = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
+
+        (magic, version, headerSize, self.sampleRate, self.calibration, self.triggerIndex, self.channels,
+         self.chunkSamples, self.chunkCount, indexOffset) = struct.unpack_from(HEADER_FORMAT, self.map)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError('{} is not supported recording file'.format(path))
+        self.headerSize = headerSize
+        self.recordSize = CHUNK_HEADER_SIZE + self.chunkSamples * self.channels * 2
+
+        if indexOffset:
+            count = (len(self.map) - indexOffset) // INDEX_DTYPE.itemsize
+            self.index = np.frombuffer(self.map, dtype=INDEX_DTYPE, count=count, offset=indexOffset).copy()
+        else:
+            self.index = self.rebuildIndex()
+        self.position = 0
+
+    def rebuildIndex(self):
+        """Recreates index from headers of chunks - used for recordings which were not closed"""
+        self.chunkCount = (len(self.map) - self.headerSize) // self.recordSize
+        headers = np.ndarray((self.chunkCount, ), dtype=CHUNK_DTYPE, buffer=self.map, offset=self.headerSize,
+                             strides=(self.recordSize, ))
+        firstChunks = np.flatnonzero(headers['firstSample'] == 0)
+        index = np.zeros(len(firstChunks), dtype=INDEX_DTYPE)
+        index['firstChunk'] = firstChunks
+        index['chunks'] = np.diff(np.append(firstChunks, self.chunkCount))
+        lastChunks = firstChunks + index['chunks'] - 1
+        index['samples'] = headers['firstSample'][lastChunks] + headers['samples'][lastChunks]
+        for field in ('timestamp', 'sampleRate', 'triggerIndex'):
+            index[field] = headers[field][firstChunks]
+        return index
+
+    def __len__(self):
+        return len(self.index)
+
+    def chunk(self, no):
+        """Returns header and samples (array of shape channels x chunkSamples) of chunk"""
+        if not 0 <= no < self.chunkCount:
+            raise IndexError('Chunk {} out of range'.format(no))
+        offset = self.headerSize + no * self.recordSize
+        header = struct.unpack_from(CHUNK_FORMAT, self.map, offset)
+        # Copy, so no view of mapping outlives close()
+        raw = np.frombuffer(self.map, dtype='<u2', count=self.chunkSamples * self.channels,
+                            offset=offset + CHUNK_HEADER_SIZE).reshape(self.channels, self.chunkSamples)
+        return header, raw.copy()
+
+    def capture(self, no):
+        """Returns Capture object with provided number"""
+        entry = self.index[no]
+        first, count, length = int(entry['firstChunk']), int(entry['chunks']), int(entry['samples'])
+        raw = self.view(first, count)
+        channels = raw.transpose(1, 0, 2).reshape(self.channels, -1)[:, :length] * np.float32(self.calibration)
+        return Capture(list(channels), float(entry['sampleRate']), int(entry['triggerIndex']), float(entry['timestamp']))
+
+    def blocks(self, no, maxChunks=256):
+        """Iterator of consecutive parts of capture with provided number - arrays of voltages of shape
+           channels x samples, each read from at most maxChunks chunks, so capture never has to fit in memory"""
+        entry = self.index[no]
+        first, count, length = int(entry['firstChunk']), int(entry['chunks']), int(entry['samples'])
+        for start in range(0, count, maxChunks):
+            chunks = min(maxChunks, count - start)
+            raw = self.view(first + start, chunks)
+            samples = min(chunks * self.chunkSamples, length - start * self.chunkSamples)
+            volts = raw.transpose(1, 0, 2).reshape(self.channels, -1)[:, :samples] * np.float32(self.calibration)
+            # Suspended iterator must not keep view of mapping
+            del raw
+            yield volts
+
+    def view(self, first, chunks):
+        """Returns samples of consecutive chunks as array of shape chunks x channels x chunkSamples, sharing
+           memory with mapping of file - it must be dropped before recording is closed"""
+        return np.ndarray((chunks, self.channels, self.chunkSamples), dtype='<u2', buffer=self.map,
+                          offset=self.headerSize + first * self.recordSize + CHUNK_HEADER_SIZE,
+                          strides=(self.recordSize, self.chunkSamples * 2, 2))
+
+    def seek(self, no):
+        """Selects capture with provided number (clamped to available range)"""
+        self.position = int(min(max(no, 0), len(self) - 1))
+
+    def close(self):
+        """Closes recording. Arrays returned by Replay are copies, so mapping is not referenced anymore"""
+        self.map.close()
+        self.map = None
+        self.file.close()
@@ -0,0 +1,38 @@
+import numpy as np
+
+"""Voltage above which sample is treated as logical one"""
+LOGIC_THRESHOLD = 1.1
+"""Voltage of logical one used when drawing digital approximation"""
+LOGIC_HIGH = 3.3
+
+
+def toArray(data):
+    """Converts samples in form returned by SerialCom.downloadData (list of (no, sample) tuples)
+       to numpy array of voltages. Arrays are passed through without copying"""
+    if isinstance(data, np.ndarray):
+        return data
+    if not data:
+        return np.zeros(0, dtype=np.float32)
+    return np.fromiter((point[1] for point in data), dtype=np.float32, count=len(data))
+
+
+def toDigital(volts, threshold=LOGIC_THRESHOLD):
+    """Returns array of booleans representing samples approximated to digital signal"""
+    return toArray(volts) > threshold
+
+
+def findEdges(bits):
+    """Returns indices of samples at which digital signal changes its level"""
+    return np.flatnonzero(bits[1:] != bits[:-1]) + 1
+
+
+def expandRuns(runs):
+    """Converts runs downloaded from logic analyser (SerialCom.downloadRuns) to array of port snapshots"""
+    runs = np.asarray(runs, dtype=np.uint32)
+    return np.repeat((runs & 0xff).astype(np.uint8), runs >> 8)
+
+
+def toLanes(snapshots, channels=8):
+    """Splits port snapshots into list of arrays - one per input, logical one is drawn at LOGIC_HIGH"""
+    snapshots = np.asarray(snapshots, dtype=np.uint8)
+    return [((snapshots >> bit) & 1).astype(np.float32) * LOGIC_HIGH for bit in range(channels)]
@@ -1,5 +1,204 @@
 import serial
 import struct
+import numpy as np
+from tracing import traced
+
+
+class AcquisitionConfig:
+    """All acquisition parameters of device, exchanged at once by SET_CONFIG and GET_CONFIG commands
+        Layout is the same as of struct acquisitionConfig in probe.h
+
+    Attributes:
+        triggerLevel: trigger level in volts
+        mode: probing mode
+        freq: frequency of stored samples (sample clock is faster by decimation)
+        numberOfSamples: number of samples in each segment
+        numberOfSegments: number of segments, 1 - segmented capture disabled
+        etsSteps: number of phases of equivalent-time sampling, 1 - disabled
+        decimation: number of readings averaged into one sample
+        autoRearm: if True device captures into the second half of memory while the first one is downloaded
+        sampleWidth: bits of sample stored by device - 16, 12 (packed) or 8
+    """
+    FORMAT = '<BBHIHBBBBBx'
+    VERSION = 1
+    SIZE = struct.calcsize(FORMAT)
+    AUTO_REARM = 0x01
+
+    def __init__(self, triggerLevel=1.0, mode=0, freq=10000, numberOfSamples=2000, numberOfSegments=1,
+                 etsSteps=1, decimation=1, autoRearm=False, sampleWidth=16):
+        self.triggerLevel = triggerLevel
+        self.mode = mode
+        self.freq = freq
+        self.numberOfSamples = numberOfSamples
+        self.numberOfSegments = numberOfSegments
+        self.etsSteps = etsSteps
+        self.decimation = decimation
+        self.autoRearm = autoRearm
+        self.sampleWidth = sampleWidth
+
+    def __eq__(self, other):
+        return isinstance(other, AcquisitionConfig) and self.pack() == other.pack()
+
+    def __repr__(self):
+        return 'AcquisitionConfig({})'.format(', '.join('{}={}'.format(k, v) for k, v in vars(self).items()))
+
+    def pack(self):
+        return struct.pack(self.FORMAT, self.VERSION, self.mode, round(self.triggerLevel * 1000), int(self.freq),
+                           self.numberOfSamples, self.numberOfSegments, self.etsSteps, self.decimation,
+                           self.AUTO_REARM if self.autoRearm else 0, self.sampleWidth)
+
+    @classmethod
+    def unpack(cls, data):
+        """Returns config decoded from bytes or None if its version is not supported"""
+        version, mode, level, freq, samples, segments, steps, decimation, flags, width = struct.unpack(cls.FORMAT, data)
+        if version != cls.VERSION:
+            return None
+        return cls(level / 1000, mode, freq, samples, segments, steps, decimation, bool(flags & cls.AUTO_REARM),
+                   width or 16)
+
+
+class TriggerConfig:
+    """Trigger condition of device, exchanged by SET_TRIGGER_CONFIG and GET_TRIGGER_CONFIG commands
+        Layout is the same as of struct triggerConfig in probe.h. Level of trigger is part of AcquisitionConfig
+
+    Attributes:
+        type: LEVEL, PULSE (pulse shorter or longer than width), RUNT (pulse crossing trigger level, which does not
+              reach upperLevel) or PATTERN (of digital inputs, logic analyser only)
+        negative: pulse or runt is on the low side of trigger level
+        longer: pulse trigger fires on pulses longer than width instead of shorter ones
+        upperLevel: upper level of runt trigger in volts
+        width: limit of pulse width in ticks of sample clock (frequency multiplied by decimation)
+        pattern: values of digital inputs, bit n - input Dn
+        mask: digital inputs compared with pattern
+    """
+    FORMAT = '<BBHIBB2x'
+    SIZE = struct.calcsize(FORMAT)
+    LEVEL, PULSE, RUNT, PATTERN = range(4)
+    NEGATIVE = 0x01
+    LONGER = 0x02
+
+    def __init__(self, type=0, negative=False, longer=False, upperLevel=3.3, width=1, pattern=0, mask=0):
+        self.type = type
+        self.negative = negative
+        self.longer = longer
+        self.upperLevel = upperLevel
+        self.width = width
+        self.pattern = pattern
+        self.mask = mask
+
+    def __eq__(self, other):
+        return isinstance(other, TriggerConfig) and self.pack() == other.pack()
+
+    def __repr__(self):
+        return 'TriggerConfig({})'.format(', '.join('{}={}'.format(k, v) for k, v in vars(self).items()))
+
+    def pack(self):
+        flags = (self.NEGATIVE if self.negative else 0) | (self.LONGER if self.longer else 0)
+        return struct.pack(self.FORMAT, self.type, flags, round(self.upperLevel * 1000), int(self.width),
+                           self.pattern & 0xff, self.mask & 0xff)
+
+    @classmethod
+    def unpack(cls, data):
+        type, flags, upper, width, pattern, mask = struct.unpack(cls.FORMAT, data)
+        return cls(type, bool(flags & cls.NEGATIVE), bool(flags & cls.LONGER), upper / 1000, width, pattern, mask)
+
+    @staticmethod
+    def parsePattern(text):
+        """Converts pattern written from D0, e.g. '1x0' (D0 high, D1 any, D2 low), to tuple (pattern, mask)"""
+        pattern = mask = 0
+        for bit, char in enumerate(text.lower()):
+            if char not in '01x' or bit >= SerialCom.LOGIC_CHANNELS:
+                raise ValueError('Invalid pattern of inputs: {}'.format(text))
+            if char != 'x':
+                mask |= 1 << bit
+                pattern |= int(char) << bit
+        return pattern, mask
+
+    @staticmethod
+    def formatPattern(pattern, mask, channels=8):
+        """Reverse of parsePattern - trailing inputs which are not compared are omitted"""
+        text = ''.join(str((pattern >> bit) & 1) if mask & (1 << bit) else 'x' for bit in range(channels))
+        return text.rstrip('x') or 'x'
+
+
+class AdcTiming:
+    """Sample time and clock of ADC chosen by device for sample clock and impedance of source (SET_ADC_TIMING)
+        Layout is the same as of struct adcTiming in adc.h, choose() follows chooseAdcTiming() of adc.c
+
+    Attributes:
+        frequency: sample clock timing is chosen for, 0 - current one of device
+        impedance: output impedance of measured source in ohms
+        sampleTime: index of sample time in SAMPLE_TIMES
+        prescaler: divider of PCLK2 giving ADC clock
+        maxFrequency: the highest sample clock ADC keeps RATE_MARGIN with, 0 - source not supported
+    """
+    FORMAT = '<IIBB2xI'
+    SIZE = struct.calcsize(FORMAT)
+    # Sample times in halves of ADC clock cycle - conversion takes 12.5 cycles more
+    SAMPLE_TIMES = (3, 15, 27, 57, 83, 111, 143, 479)
+    PRESCALERS = (2, 4, 6, 8)
+    PCLK2 = 72000000
+    MAX_ADC_CLOCK = 14000000
+    MAX_IMPEDANCE = 50000
+    ADC_RESISTANCE = 1000
+    # Time (in 1/100 ps) needed to charge sample and hold capacitor to 1/4 LSB through one ohm
+    SETTLING_PER_OHM = 7763
+    # Chosen conversions are this many times faster than sample clock, as reading lags it by up to one conversion
+    RATE_MARGIN = 8
+    # Highest sample clock SysTick_Handler keeps up with (MAX_SAMPLE_CLOCK of capture.h)
+    MAX_SAMPLE_CLOCK = 200000
+
+    def __init__(self, frequency=0, impedance=0, sampleTime=0, prescaler=6, maxFrequency=0):
+        self.frequency = frequency
+        self.impedance = impedance
+        self.sampleTime = sampleTime
+        self.prescaler = prescaler
+        self.maxFrequency = maxFrequency
+
+    def __repr__(self):
+        return 'AdcTiming({})'.format(', '.join('{}={}'.format(k, v) for k, v in vars(self).items()))
+
+    def __str__(self):
+        return '{} cycles at {:g} MHz, up to {} Hz'.format(self.SAMPLE_TIMES[self.sampleTime] / 2,
+                                                           self.PCLK2 / self.prescaler / 1e6, self.maxFrequency)
+
+    @property
+    def conversionTime(self):
+        """Time of one conversion in seconds"""
+        return (self.SAMPLE_TIMES[self.sampleTime] + 25) * self.prescaler / self.PCLK2 / 2
+
+    def pack(self):
+        return struct.pack(self.FORMAT, int(self.frequency), int(self.impedance), self.sampleTime, self.prescaler,
+                           int(self.maxFrequency))
+
+    @classmethod
+    def unpack(cls, data):
+        return cls(*struct.unpack(cls.FORMAT, data))
+
+    @classmethod
+    def choose(cls, frequency, impedance, pclk2=PCLK2):
+        """Returns timing with the longest sample time whose conversions are RATE_MARGIN times faster than frequency
+           (the fastest one if none is) and which lets source of impedance settle, or None if impedance is too high"""
+        if impedance > cls.MAX_IMPEDANCE:
+            return None
+        candidates = []
+        for prescaler in cls.PRESCALERS:
+            clock = pclk2 // prescaler
+            if clock > cls.MAX_ADC_CLOCK:
+                continue
+            for no, halfCycles in enumerate(cls.SAMPLE_TIMES):
+                if halfCycles * 50000000000000 >= (impedance + cls.ADC_RESISTANCE) * cls.SETTLING_PER_OHM * clock:
+                    candidates.append((clock * 2 // (halfCycles + 25), halfCycles * prescaler, no, prescaler))
+        if not candidates:
+            return None
+        maxRate = max(rate for rate, *_ in candidates)
+        fitting = [c for c in candidates if c[0] >= frequency * cls.RATE_MARGIN]
+        if fitting:
+            # The longest sample time, of equal ones the faster ADC clock - the first one found
+            best = max(fitting, key=lambda c: (c[1], -c[3]))
+        else:
+            best = max(candidates, key=lambda c: (c[0], -c[3]))
+        return cls(frequency, impedance, best[2], best[3], min(maxRate // cls.RATE_MARGIN, cls.MAX_SAMPLE_CLOCK))
 
 
 class SerialCom:
@@ -15,13 +214,72 @@ class SerialCom:
                     'DOWNLOAD_DATA':  6,
                     'TURN_OFF':       7,
                     'TRIG_MODE':      8,
-                    'SET_PRECISION':  4}
+                    'SET_PRECISION':  4,
+                    'SET_SEGMENTS':   10,
+                    'DOWNLOAD_SEGMENTS': 11,
+                    'SET_ETS':        12,
+                    'SET_DECIMATION': 13,
+                    'GET_PROFILE':    14,
+                    'SET_CONFIG':     15,
+                    'GET_CONFIG':     16,
+                    'DOWNLOAD_NEXT':  17,
+                    'SET_TRIGGER_CONFIG': 18,
+                    'GET_TRIGGER_CONFIG': 19,
+                    'GET_TIME':       20,
+                    'SET_ADC_TIMING': 21}
+
+    """Names of capture stages, in the same order as in capture.h"""
+    captureStages = ['idle', 'level trigger', 'pulse trigger', 'runt trigger', 'store', 'average 2', 'average 4',
+                     'average 8', 'average 16']
+    """Measurements of communication sent after capture stages, the same order as in pcCom.h: cycles from the last
+       byte of command to its execution and time (in microseconds) firmware has slept waiting for command"""
+    pcComProfiles = ['command dispatch', 'sleep']
+
+    """Limits of device memory"""
+    SAMPLES_MEMORY_SIZE = 8000
+    MAX_NUMBER_OF_SAMPLES = 4000
+    MAX_NUMBER_OF_SEGMENTS = 32
+    MAX_ETS_STEPS = 32
+    MAX_DECIMATION = 16
+    SAMPLE_WIDTHS = (16, 12, 8)
+
+    """Probing modes - ADC readings of PC4 or logic analyser sampling PA0-PA7"""
+    PROBING_ANALOG = 0
+    PROBING_DIGITAL = 1
+    """Limits of logic analyser - snapshots are timed by 16-bit timer running at core clock"""
+    LOGIC_CHANNELS = 8
+    MAX_LOGIC_FREQ = 4000000
+    MIN_LOGIC_FREQ = 1099
+    MAX_LOGIC_SAMPLES = 0xffff
+    MAX_LOGIC_RUNS = SAMPLES_MEMORY_SIZE // 4
+
+    @staticmethod
+    def samplesSize(count, width=16):
+        """Returns number of bytes of device memory occupied by samples - the same as samplesSize() in capture.c"""
+        return (count + 1) // 2 * 3 if width == 12 else count * (width // 8)
+
+    @classmethod
+    def maxNumberOfSamples(cls, width=16, segments=1, autoRearm=False):
+        """Returns the highest number of samples of each segment which fits in memory of device"""
+        memory = (cls.SAMPLES_MEMORY_SIZE // 2 if autoRearm else cls.SAMPLES_MEMORY_SIZE) // segments
+        return memory // 3 * 2 if width == 12 else memory // (width // 8)
+
+    @classmethod
+    def maxNumberOfSegments(cls, count, width=16):
+        """Returns the highest number of segments of provided number of samples which fit in memory of device"""
+        return min(cls.MAX_NUMBER_OF_SEGMENTS, cls.SAMPLES_MEMORY_SIZE // max(cls.samplesSize(count, width), 1))
 
     def __init__(self, devicePath):
         self.serial = serial.Serial(devicePath, 38400, timeout=3)
+        # Request sent by requestNext, whose response has not been read yet
+        self.pendingNext = False
+        self.pendingResult = None
 
     def sendPacket(self, cmd='PING', payload=b''):
-        """Sends command and its payload to MCU"""
+        """Sends command and its payload to MCU. Response to pending DOWNLOAD_NEXT is read before,
+           so it does not get mixed with response to this command"""
+        if self.pendingNext:
+            self.pendingResult = self.receiveNext()
         data = struct.pack('B', self.commandCodes[cmd]) + payload
         self.serial.write(data)
         self.serial.flush()
@@ -54,6 +312,93 @@ class SerialCom:
         self.sendPacket(cmd='SET_PRECISION', payload=struct.pack('I', prec))
         return self.getResponseStatus()
 
+    def setSegments(self, count):
+        self.sendPacket(cmd='SET_SEGMENTS', payload=struct.pack('I', count))
+        return self.getResponseStatus()
+
+    def setEts(self, steps):
+        self.sendPacket(cmd='SET_ETS', payload=struct.pack('B', steps))
+        return self.getResponseStatus()
+
+    def setDecimation(self, count):
+        self.sendPacket(cmd='SET_DECIMATION', payload=struct.pack('B', count))
+        return self.getResponseStatus()
+
+    def setConfig(self, config):
+        """Sends all acquisition parameters at once. Device applies either all or none of them"""
+        self.sendPacket(cmd='SET_CONFIG', payload=config.pack())
+        return self.getResponseStatus()
+
+    def getConfig(self):
+        """Reads acquisition parameters from device. Returns AcquisitionConfig or None on failure"""
+        self.sendPacket(cmd='GET_CONFIG')
+        if self.getResponseStatus() != 0:
+            return None
+        data = self.serial.read(AcquisitionConfig.SIZE + 1)
+        if len(data) != AcquisitionConfig.SIZE + 1 or data[-1] != 0xff:
+            return None
+        return AcquisitionConfig.unpack(data[:-1])
+
+    def setTriggerConfig(self, trigger):
+        """Sends trigger condition. Trigger which is already armed is re-armed with it"""
+        self.sendPacket(cmd='SET_TRIGGER_CONFIG', payload=trigger.pack())
+        return self.getResponseStatus()
+
+    def getTriggerConfig(self):
+        """Reads trigger condition from device. Returns TriggerConfig or None on failure"""
+        self.sendPacket(cmd='GET_TRIGGER_CONFIG')
+        if self.getResponseStatus() != 0:
+            return None
+        data = self.serial.read(TriggerConfig.SIZE + 1)
+        if len(data) != TriggerConfig.SIZE + 1 or data[-1] != 0xff:
+            return None
+        return TriggerConfig.unpack(data[:-1])
+
+    def getTime(self):
+        """Reads timestamp timer of device - returns tuple (current time, time at which the last capture was
+           triggered) in microseconds, or None on failure. Timer wraps around every 2^32 microseconds"""
+        self.sendPacket(cmd='GET_TIME')
+        if self.getResponseStatus() != 0:
+            return None
+        data = self.serial.read(9)
+        if len(data) != 9 or data[-1] != 0xff:
+            return None
+        return struct.unpack('<II', data[:-1])
+
+    def setAdcTiming(self, frequency, impedance):
+        """Lets device choose sample time and clock of ADC for sample clock (0 - current one) and impedance of source
+           in ohms. Returns AdcTiming chosen by device or None on failure (e.g. impedance is too high)"""
+        self.sendPacket(cmd='SET_ADC_TIMING', payload=AdcTiming(frequency, impedance).pack())
+        if self.getResponseStatus() != 0:
+            return None
+        data = self.serial.read(AdcTiming.SIZE + 1)
+        if len(data) != AdcTiming.SIZE + 1 or data[-1] != 0xff:
+            return None
+        return AdcTiming.unpack(data[:-1])
+
+    def getProfile(self):
+        """Downloads cost of capture stages measured by device since previous call
+                Returns tuple consisting of: (state, profile), where
+                    state   = True | False  -  indicated if operation succedded
+                    profile = dict {stage name: (calls, cycles, max cycles)}"""
+        self.sendPacket(cmd='GET_PROFILE')
+
+        resp = self.getResponseStatus()
+        if resp != 0:
+            return False, {}
+
+        count = struct.unpack("I", self.serial.read(4))[0]
+        profile = {}
+        names = self.captureStages + self.pcComProfiles
+        for i in range(count):
+            name = names[i] if i < len(names) else 'stage {}'.format(i)
+            profile[name] = struct.unpack("III", self.serial.read(12))
+
+        endBlock = struct.unpack("B", self.serial.read(1))[0]
+        if endBlock != 0xff:
+            return False, {}
+        return True, profile
+
     def triggerNow(self):
         self.sendPacket(cmd='TRIG_NOW')
         return self.getResponseStatus()
@@ -70,23 +415,102 @@ class SerialCom:
         self.sendPacket(cmd='TRIG_MODE')
         return self.getResponseStatus()
 
+    def readSamples(self, length):
+        """Reads provided number of samples and returns them as list of tuples (no, sample)"""
+        samples = []
+        for i in range(length):
+            sample = (i, struct.unpack("H", self.serial.read(2))[0]/1000)
+            samples.append(sample)
+        return samples
+
+    @traced('serial read')
+    def downloadSegments(self):
+        """Tries to download all segments of segmented capture
+                Returns tuple consisting of: (state, segments), where
+                    state    = True | False  -  indicated if operation succedded
+                    segments = list of tuples (timestamp, data) - time of trigger in microseconds
+                               and samples in the same form as returned by downloadData"""
+        self.sendPacket(cmd='DOWNLOAD_SEGMENTS')
+
+        resp = self.getResponseStatus()
+        if resp != 0:
+            return False, []
+
+        count, length = struct.unpack("II", self.serial.read(8))
+        segments = []
+        for i in range(count):
+            timestamp = struct.unpack("I", self.serial.read(4))[0]
+            segments.append((timestamp, self.readSamples(length)))
+
+        endBlock = struct.unpack("B", self.serial.read(1))[0]
+        if endBlock != 0xff:
+            return False, []
+        return True, segments
+
+    @traced('serial read')
+    def downloadRuns(self):
+        """Tries to download capture of logic analyser
+                Returns tuple consisting of: (state, runs), where
+                    state = True | False  -  indicated if operation succedded
+                    runs  = numpy array of uint32 - value of inputs in 8 LSB, number of snapshots in 24 MSB"""
+        self.sendPacket(cmd='DOWNLOAD_DATA')
+
+        resp = self.getResponseStatus()
+        if resp != 0:
+            return False, np.zeros(0, dtype=np.uint32)
+
+        count = struct.unpack("I", self.serial.read(4))[0]
+        data = self.serial.read(4 * count)
+        endBlock = self.serial.read(1)
+        if len(data) != 4 * count or endBlock != b'\xff':
+            return False, np.zeros(0, dtype=np.uint32)
+        return True, np.frombuffer(data, dtype='<u4')
+
+    def requestNext(self):
+        """Asks for the next capture of auto re-arm mode without waiting for response, which is read by
+           receiveNext. Device transmits it while host is still processing the previous one"""
+        if self.pendingNext or self.pendingResult is not None:
+            return
+        self.sendPacket(cmd='DOWNLOAD_NEXT')
+        self.pendingNext = True
+
+    def nextAvailable(self):
+        """Checks without blocking if response to requestNext has started to arrive"""
+        return self.pendingResult is not None or (self.pendingNext and self.serial.in_waiting > 0)
+
+    def receiveNext(self):
+        """Reads response to requestNext. Returns tuple (state, data) in the same form as downloadData,
+           state is False also if no capture was ready"""
+        if self.pendingResult is not None:
+            result, self.pendingResult = self.pendingResult, None
+            return result
+        if not self.pendingNext:
+            return False, []
+        self.pendingNext = False
+        return self.readData()
+
+    def cancelNext(self):
+        """Drops response to requestNext which is no longer needed, e.g. after auto re-arm mode was stopped"""
+        self.receiveNext()
+
     def downloadData(self):
         """Tries to download samples from device
                 Returns tuple consisting of: (state, data), where
                     state = True | False  -  indicated if operation succedded
                     data  = list of tuples - samples sent by MCU in form (no, sample)"""
         self.sendPacket(cmd='DOWNLOAD_DATA')
+        return self.readData()
 
+    @traced('serial read')
+    def readData(self):
+        """Reads response to DOWNLOAD_DATA or DOWNLOAD_NEXT command"""
         resp = self.getResponseStatus()
         if resp != 0:
             return False, []
 
         # Downloading data
-        samples = []
         length = struct.unpack("I", self.serial.read(4))[0]
-        for i in range(length):
-            sample = (i, struct.unpack("H", self.serial.read(2))[0]/1000)
-            samples.append(sample)
+        samples = self.readSamples(length)
 
         endBlock = struct.unpack("B", self.serial.read(1))[0]
         if endBlock != 0xff:
@@ -0,0 +1,557 @@
+#!/usr/bin/env python3
+import os
+import pty
+import struct
+import sys
+import threading
+import time
+import tty
+import numpy as np
+from serialCom import SerialCom, AcquisitionConfig, TriggerConfig, AdcTiming
+from triggers import createTrigger
+
+"""Clock of the MCU and parameters of its ADC"""
+SYSTEM_CORE_CLOCK = 72000000
+ADC_MAX = 4095
+ADC_VREF = 3.3
+"""Input threshold of GPIO used as trigger of equivalent-time sampling and latency of its interrupt"""
+EXTI_THRESHOLD = 1.4
+EXTI_LATENCY = 12 / SYSTEM_CORE_CLOCK
+
+"""States of probing, the same as in probe.h"""
+OFF, WAITING_FOR_TRIG, WORKING, FINISHED = range(4)
+
+
+class SineSource:
+    """Periodic sine signal - callable returning voltage for array of times (in seconds)"""
+    def __init__(self, freq=1000.0, amplitude=1.5, offset=1.65, phase=0.0):
+        self.freq, self.amplitude, self.offset, self.phase = freq, amplitude, offset, phase
+
+    def __call__(self, t):
+        return self.offset + self.amplitude * np.sin(2 * np.pi * self.freq * t + self.phase)
+
+
+class SquareSource:
+    """Periodic square signal with provided duty cycle and edge time (in seconds)"""
+    def __init__(self, freq=1000.0, duty=0.5, low=0.0, high=3.3, edge=0.0):
+        self.freq, self.duty, self.low, self.high, self.edge = freq, duty, low, high, edge
+
+    def __call__(self, t):
+        phase = np.mod(t * self.freq, 1.0) / self.freq
+        highTime = self.duty / self.freq
+        if self.edge <= 0:
+            level = (phase < highTime).astype(np.float64)
+        else:
+            rising = np.clip(phase / self.edge, 0, 1)
+            falling = np.clip((phase - highTime) / self.edge, 0, 1)
+            level = np.where(phase < highTime, rising, 1 - falling)
+        return self.low + (self.high - self.low) * level
+
+
+class CounterSource:
+    """Digital inputs driven by binary counter incremented with provided frequency - input n toggles
+       with frequency freq / 2^(n+1). Callable returning values of port for array of times"""
+    def __init__(self, freq=1000.0, channels=SerialCom.LOGIC_CHANNELS):
+        self.freq, self.channels = freq, channels
+
+    def __call__(self, t):
+        return (np.floor(np.asarray(t) * self.freq).astype(np.int64) & ((1 << self.channels) - 1)).astype(np.uint8)
+
+
+class SimulatedDevice:
+    """Stand-in for the MCU speaking the same protocol over pseudo terminal
+        Captures are computed from source signal on the sampling grid of simulated SysTick,
+        including trigger search, segmented capture and equivalent-time sampling.
+
+    Attributes:
+        source: callable returning voltages for array of times
+        digitalSource: callable returning values of digital inputs PA0-PA7 for array of times
+        noise: standard deviation of ADC noise (in ADC units)
+        realTime: if True capture is reported as ready only after time it would take on device
+        baudrate: if provided, responses are sent not faster than through UART of device (8N1)
+        path: path of pseudo terminal to be opened by SerialCom
+    """
+    PAYLOAD_LENGTHS = {SerialCom.commandCodes['SET_TRIGGER']: 4, SerialCom.commandCodes['SET_MODE']: 1,
+                       SerialCom.commandCodes['SET_SAMPLES']: 4, SerialCom.commandCodes['SET_PRECISION']: 4,
+                       SerialCom.commandCodes['SET_SEGMENTS']: 4, SerialCom.commandCodes['SET_ETS']: 1,
+                       SerialCom.commandCodes['SET_DECIMATION']: 1,
+                       SerialCom.commandCodes['SET_CONFIG']: AcquisitionConfig.SIZE,
+                       SerialCom.commandCodes['SET_TRIGGER_CONFIG']: TriggerConfig.SIZE,
+                       SerialCom.commandCodes['SET_ADC_TIMING']: AdcTiming.SIZE}
+    TRIGGER_SEARCH_TIME = 2.0
+
+    def __init__(self, source=None, noise=0.0, realTime=False, seed=None, baudrate=None, digitalSource=None):
+        self.source = source if source is not None else SquareSource()
+        self.digitalSource = digitalSource if digitalSource is not None else CounterSource()
+        self.noise = noise
+        self.realTime = realTime
+        self.baudrate = baudrate
+        self.random = np.random.default_rng(seed)
+        # ADC converts continuously - it starts with the fastest timing, as device does after reset
+        self.sourceImpedance = 0
+        self.adcTiming = AdcTiming.choose(0xFFFFFFFF, 0)
+        self.adcPhase = self.random.uniform(0, self.adcTiming.conversionTime)
+
+        self.state = OFF
+        self.maxNumberOfSamples = 0
+        self.numberOfSegments = 1
+        self.etsSteps = 1
+        self.decimation = 1
+        self.autoRearm = False
+        self.sampleWidth = 16
+        # Captures of auto re-arm mode waiting for download - list of tuples (ready at, samples)
+        self.pipeline = []
+        self.lastEnd = 0.0
+        self.probingMode = 0
+        self.triggerLevel = 0
+        self.trigger = TriggerConfig()
+        self.reload = SYSTEM_CORE_CLOCK // 1000
+        self.clock = 0.0
+        self.readyAt = 0.0
+        self.segments = []
+
+        self.master, slave = pty.openpty()
+        tty.setraw(slave)
+        self.slave = slave
+        self.path = os.ttyname(slave)
+        self.running = False
+        self.thread = None
+
+    def start(self):
+        """Starts serving commands in background thread. Returns path of pseudo terminal"""
+        self.running = True
+        self.thread = threading.Thread(target=self.serve, daemon=True)
+        self.thread.start()
+        return self.path
+
+    def stop(self):
+        self.running = False
+        os.close(self.slave)
+        if self.thread is not None:
+            self.thread.join(1)
+        os.close(self.master)
+
+    def serve(self):
+        buffer = b''
+        while self.running:
+            try:
+                data = os.read(self.master, 4096)
+            except OSError:
+                break
+            buffer += data
+            while buffer:
+                length = 1 + self.PAYLOAD_LENGTHS.get(buffer[0], 0)
+                if len(buffer) < length:
+                    break
+                command, payload = buffer[0], buffer[1:length]
+                buffer = buffer[length:]
+                value = struct.unpack('<I', payload[:4].ljust(4, b'\0'))[0]
+                self.write(self.process(command, value, payload))
+
+    def write(self, data):
+        view = memoryview(data)
+        chunk = len(view) if self.baudrate is None else max(self.baudrate // 1000, 1)
+        while view:
+            written = os.write(self.master, view[:chunk])
+            view = view[written:]
+            if self.baudrate is not None:
+                time.sleep(written * 10 / self.baudrate)
+
+    @property
+    def sampleRate(self):
+        return SYSTEM_CORE_CLOCK / self.reload
+
+    def isBusy(self):
+        return self.state == WORKING or (self.state == WAITING_FOR_TRIG and len(self.segments) > 0)
+
+    def fits(self, count, segments, width, autoRearm):
+        """Checks if segments fit in memory of device, the same as fitsInMemory() in probe.c"""
+        memory = SerialCom.SAMPLES_MEMORY_SIZE // 2 if autoRearm else SerialCom.SAMPLES_MEMORY_SIZE
+        return count >= 0 and segments * SerialCom.samplesSize(count, width) <= memory
+
+    def fitsLogic(self, segments, steps, decimation, autoRearm, reload):
+        """Checks if settings can be used by logic analyser, the same as fitsLogic() in probe.c"""
+        return segments == 1 and steps == 1 and decimation == 1 and not autoRearm and \
+            SYSTEM_CORE_CLOCK // SerialCom.MAX_LOGIC_FREQ <= reload <= 0x10000
+
+    @property
+    def digital(self):
+        return self.probingMode == SerialCom.PROBING_DIGITAL
+
+    def setProbingMode(self, mode):
+        if mode == SerialCom.PROBING_DIGITAL:
+            if not self.fitsLogic(self.numberOfSegments, self.etsSteps, self.decimation, self.autoRearm, self.reload):
+                return 1
+        elif mode != SerialCom.PROBING_ANALOG or \
+                not self.fits(self.maxNumberOfSamples, self.numberOfSegments, self.sampleWidth, self.autoRearm):
+            return 1
+        if self.isBusy():
+            return 2
+        if mode != self.probingMode:
+            self.state, self.segments, self.pipeline = OFF, [], []
+        self.probingMode = mode
+        self.updateAdcTiming()
+        self.validateTrigger()
+        return 0
+
+    def updateAdcTiming(self):
+        """Chooses timing of ADC for current sample clock, the same as updateAdcTiming() in probe.c"""
+        if not self.digital:
+            self.adcTiming = AdcTiming.choose(SYSTEM_CORE_CLOCK // self.reload * self.etsSteps, self.sourceImpedance)
+
+    def setAdcTiming(self, timing):
+        """Returns response to SET_ADC_TIMING, the same as setAdcTiming() in probe.c"""
+        if timing.impedance > AdcTiming.MAX_IMPEDANCE:
+            return self.ack(1)
+        if self.isBusy():
+            return self.ack(2)
+        self.sourceImpedance = timing.impedance
+        chosen = AdcTiming.choose(timing.frequency or SYSTEM_CORE_CLOCK // self.reload * self.etsSteps,
+                                  timing.impedance)
+        if not self.digital:
+            self.adcTiming = chosen
+        return b'\0' + chosen.pack() + b'\xff'
+
+    def isValidTrigger(self, trigger, digital, steps):
+        """Checks if trigger condition is available in mode, the same as isValidTrigger() in probe.c"""
+        if trigger.type == TriggerConfig.LEVEL:
+            return True
+        if digital:
+            return trigger.type == TriggerConfig.PATTERN and trigger.mask != 0
+        if steps > 1:
+            return False
+        return trigger.type == TriggerConfig.RUNT or (trigger.type == TriggerConfig.PULSE and trigger.width > 0)
+
+    def validateTrigger(self):
+        """Falls back to level trigger after change of mode or ETS, the same as probe.c"""
+        if not self.isValidTrigger(self.trigger, self.digital, self.etsSteps):
+            self.trigger = TriggerConfig()
+
+    def setTriggerConfig(self, trigger):
+        if not 0 <= trigger.type <= TriggerConfig.PATTERN or not self.isValidTrigger(trigger, self.digital,
+                                                                                      self.etsSteps):
+            return 1
+        if self.isBusy():
+            return 2
+        self.trigger = trigger
+        if self.state == WAITING_FOR_TRIG:
+            self.arm(immediately=False)
+        return 0
+
+    def readyCapture(self):
+        """Returns response with capture of auto re-arm mode and starts the next one or None if none is ready"""
+        if not self.pipeline or self.pipeline[0][0] > time.monotonic():
+            return None
+        samples = self.pipeline.pop(0)[1]
+        self.rearm()
+        return b'\0' + struct.pack('<I', len(samples)) + self.toMillivolts(samples).tobytes() + b'\xff'
+
+    def process(self, command, value, payload=b''):
+        """Executes command and returns bytes of response"""
+        codes = SerialCom.commandCodes
+        self.update()
+        if command == codes['PING']:
+            return b'\0'
+        elif command == codes['SET_TRIGGER']:
+            return self.ack(2 if self.isBusy() else self.set('triggerLevel', (value * 10000) // 8059))
+        elif command == codes['SET_MODE']:
+            return self.ack(self.setProbingMode(value & 0xff))
+        elif command == codes['SET_SAMPLES']:
+            if (value > SerialCom.MAX_LOGIC_SAMPLES if self.digital else
+                    not self.fits(value, self.numberOfSegments, self.sampleWidth, self.autoRearm)):
+                return self.ack(1)
+            return self.ack(2 if self.isBusy() else self.set('maxNumberOfSamples', value))
+        elif command == codes['SET_PRECISION']:
+            if self.isBusy() or value == 0 or SYSTEM_CORE_CLOCK // value > 0xFFFFFF:
+                return self.ack(2)
+            if self.digital and not self.fitsLogic(1, 1, 1, False, SYSTEM_CORE_CLOCK // value):
+                return self.ack(1)
+            self.reload = SYSTEM_CORE_CLOCK // value
+            self.updateAdcTiming()
+            return self.ack(0)
+        elif command == codes['SET_SEGMENTS']:
+            if not 1 <= value <= SerialCom.MAX_NUMBER_OF_SEGMENTS or \
+                    ((self.autoRearm or self.digital) and value > 1) or \
+                    not self.fits(self.maxNumberOfSamples, value, self.sampleWidth, self.autoRearm):
+                return self.ack(1)
+            return self.ack(2 if self.isBusy() else self.set('numberOfSegments', value))
+        elif command == codes['SET_ETS']:
+            if not 1 <= value <= SerialCom.MAX_NUMBER_OF_SEGMENTS or (self.digital and value > 1):
+                return self.ack(1)
+            if self.isBusy():
+                return self.ack(2)
+            self.etsSteps = value
+            self.updateAdcTiming()
+            self.validateTrigger()
+            return self.ack(0)
+        elif command == codes['SET_DECIMATION']:
+            if value not in [2 ** i for i in range(SerialCom.MAX_DECIMATION.bit_length())] or \
+                    (self.digital and not self.fitsLogic(self.numberOfSegments, self.etsSteps, value, self.autoRearm,
+                                                         self.reload)):
+                return self.ack(1)
+            return self.ack(2 if self.isBusy() else self.set('decimation', value))
+        elif command == codes['SET_CONFIG']:
+            return self.ack(self.setConfig(AcquisitionConfig.unpack(payload)))
+        elif command == codes['GET_CONFIG']:
+            config = AcquisitionConfig(((self.triggerLevel * 8059 + 5000) // 10000) / 1000, self.probingMode,
+                                       SYSTEM_CORE_CLOCK // (self.reload * self.decimation), self.maxNumberOfSamples,
+                                       self.numberOfSegments, self.etsSteps, self.decimation, self.autoRearm,
+                                       self.sampleWidth)
+            return b'\0' + config.pack() + b'\xff'
+        elif command == codes['SET_TRIGGER_CONFIG']:
+            return self.ack(self.setTriggerConfig(TriggerConfig.unpack(payload)))
+        elif command == codes['GET_TIME']:
+            # Timer follows time of signal - the last capture ends when it is ready, then timer runs with host clock
+            trigger = self.segments[0][0] if self.segments else 0
+            now = self.clock + max(time.monotonic() - self.readyAt, 0) if self.readyAt != float('inf') else self.clock
+            return b'\0' + struct.pack('<II', int(now * 1e6) & 0xffffffff, trigger) + b'\xff'
+        elif command == codes['SET_ADC_TIMING']:
+            return self.setAdcTiming(AdcTiming.unpack(payload))
+        elif command == codes['GET_TRIGGER_CONFIG']:
+            return b'\0' + self.trigger.pack() + b'\xff'
+        elif command == codes['GET_PROFILE']:
+            # Cycle counter of MCU is not simulated - only number of stages is reported
+            stages = len(SerialCom.captureStages) + len(SerialCom.pcComProfiles)
+            return b'\0' + struct.pack('<I', stages) + bytes(12 * stages) + b'\xff'
+        elif command == codes['TRIG_NOW']:
+            return self.ack(2 if self.state == WORKING else self.arm(immediately=True))
+        elif command == codes['TRIG_MODE']:
+            return self.ack(2 if self.state == WORKING else self.arm(immediately=False))
+        elif command == codes['TURN_OFF']:
+            self.state, self.segments, self.pipeline = OFF, [], []
+            return self.ack(0)
+        elif command == codes['IS_DATA_AVAIL']:
+            ready = len(self.pipeline) > 0 and self.pipeline[0][0] <= time.monotonic()
+            return self.ack(self.state == FINISHED or ready)
+        elif command == codes['DOWNLOAD_NEXT']:
+            return self.readyCapture() or self.ack(1)
+        elif command == codes['DOWNLOAD_DATA']:
+            ready = self.readyCapture()
+            if ready is not None:
+                return ready
+            if self.state != FINISHED:
+                return self.ack(2 if self.state == WORKING else 1)
+            if self.digital:
+                runs = self.segments[0][1]
+                return b'\0' + struct.pack('<I', len(runs)) + runs.astype('<u4').tobytes() + b'\xff'
+            samples = self.segments[0][1]
+            return b'\0' + struct.pack('<I', len(samples)) + self.toMillivolts(samples).tobytes() + b'\xff'
+        elif command == codes['DOWNLOAD_SEGMENTS']:
+            if self.state != FINISHED:
+                return self.ack(2 if self.state in (WORKING, WAITING_FOR_TRIG) else 1)
+            response = [b'\0', struct.pack('<II', len(self.segments), self.maxNumberOfSamples)]
+            for timestamp, samples in self.segments:
+                response += [struct.pack('<I', timestamp), self.toMillivolts(samples).tobytes()]
+            return b''.join(response) + b'\xff'
+        return b'\2'
+
+    def setConfig(self, config):
+        """Validates all parameters and applies them at once, the same as setConfig() in probe.c"""
+        digital = config is not None and config.mode == SerialCom.PROBING_DIGITAL
+        if config is None or not 1 <= config.numberOfSegments <= SerialCom.MAX_NUMBER_OF_SEGMENTS or \
+                config.mode not in (SerialCom.PROBING_ANALOG, SerialCom.PROBING_DIGITAL) or \
+                config.sampleWidth not in SerialCom.SAMPLE_WIDTHS or \
+                (not digital and not self.fits(config.numberOfSamples, config.numberOfSegments, config.sampleWidth,
+                                               config.autoRearm)) or \
+                (config.autoRearm and (config.numberOfSegments > 1 or config.etsSteps > 1)) or \
+                not 1 <= config.etsSteps <= SerialCom.MAX_NUMBER_OF_SEGMENTS or \
+                config.decimation not in [2 ** i for i in range(SerialCom.MAX_DECIMATION.bit_length())]:
+            return 1
+        clock = config.freq * config.decimation
+        if clock == 0 or not 0 < SYSTEM_CORE_CLOCK // clock <= 0x1000000:
+            return 1
+        if digital and not self.fitsLogic(config.numberOfSegments, config.etsSteps, config.decimation,
+                                          config.autoRearm, SYSTEM_CORE_CLOCK // clock):
+            return 1
+        if self.isBusy():
+            return 2
+        if config.mode != self.probingMode:
+            self.state, self.segments = OFF, []
+        self.triggerLevel = (round(config.triggerLevel * 1000) * 10000) // 8059
+        self.probingMode = config.mode
+        self.maxNumberOfSamples = config.numberOfSamples
+        self.numberOfSegments = config.numberOfSegments
+        self.etsSteps = config.etsSteps
+        self.decimation = config.decimation
+        self.autoRearm = config.autoRearm
+        self.sampleWidth = config.sampleWidth
+        self.pipeline = []
+        self.reload = SYSTEM_CORE_CLOCK // clock
+        self.updateAdcTiming()
+        self.validateTrigger()
+        return 0
+
+    @staticmethod
+    def ack(status):
+        return struct.pack('B', int(status))
+
+    def set(self, name, value):
+        setattr(self, name, value)
+        return 0
+
+    @staticmethod
+    def toMillivolts(samples):
+        return ((samples.astype(np.uint32) * 8059) // 10000).astype('<u2')
+
+    def sample(self, times):
+        """Returns ADC readings at provided times - result of the last finished conversion"""
+        conversion = self.adcTiming.conversionTime
+        times = np.floor((times - self.adcPhase) / conversion) * conversion + self.adcPhase
+        values = self.source(times) / ADC_VREF * ADC_MAX
+        if self.noise:
+            values = values + self.random.normal(0, self.noise, len(times))
+        return np.clip(np.rint(values), 0, ADC_MAX).astype(np.uint16)
+
+    def store(self, times):
+        """Returns samples stored by device when the first of them is read at provided times,
+            each sample averages readings from the following ticks of sample clock when decimation is set.
+            8-bit samples keep only most significant bits of reading"""
+        if self.decimation == 1:
+            samples = self.sample(times)
+        else:
+            period = self.reload / SYSTEM_CORE_CLOCK
+            readings = self.sample((times[:, None] + period * np.arange(self.decimation)).reshape(-1))
+            samples = (readings.reshape(-1, self.decimation).sum(axis=1, dtype=np.uint32) //
+                       self.decimation).astype(np.uint16)
+        return samples & 0xff0 if self.sampleWidth == 8 else samples
+
+    def findTrigger(self, start):
+        """Returns time of sampling tick at which device would be triggered by selected condition
+            (level, pulse width or runt) or None if signal does not fulfill it"""
+        period = self.reload / SYSTEM_CORE_CLOCK
+        trigger = createTrigger(self.trigger, self.triggerLevel)
+        block = 4096
+        for first in range(0, max(int(self.TRIGGER_SEARCH_TIME / period), 1), block):
+            times = start + (first + np.arange(block)) * period
+            hit = trigger.feed(self.sample(times))
+            if hit is not None:
+                return times[hit]
+        return None
+
+    def findEdge(self, start):
+        """Returns time at which source falls through input threshold of EXTI trigger
+            or None if there is no such edge"""
+        step = 1e-6
+        block = 65536
+        for first in range(0, int(self.TRIGGER_SEARCH_TIME / step), block):
+            times = start + (first + np.arange(block + 1)) * step
+            high = self.source(times) > EXTI_THRESHOLD
+            hits = np.flatnonzero(high[:-1] & ~high[1:])
+            if len(hits):
+                low, high = times[hits[0]], times[hits[0] + 1]
+                for _ in range(30):
+                    middle = (low + high) / 2
+                    low, high = (middle, high) if self.source(np.array([middle]))[0] > EXTI_THRESHOLD else (low, middle)
+                return high
+        return None
+
+    def arm(self, immediately):
+        """Fills all segments as device would do it after TRIG_NOW or TRIG_MODE command"""
+        self.pipeline = []
+        if self.autoRearm:
+            # Device keeps sampling until it is turned off
+            self.state, self.readyAt = WORKING, float('inf')
+            self.lastEnd = time.monotonic()
+            self.rearm(immediately)
+            return 0
+        duration = self.captureLogic(immediately) if self.digital else self.capture(immediately)
+        if duration is None:
+            self.state = WAITING_FOR_TRIG
+            return 0
+        self.readyAt = time.monotonic() + (duration if self.realTime else 0)
+        self.state = WORKING if self.realTime else FINISHED
+        return 0
+
+    def rearm(self, immediately=False):
+        """Auto re-arm mode - takes captures while there is free buffer. Capture starts when the previous
+           one has finished and its buffer has been downloaded"""
+        while len(self.pipeline) < 2:
+            duration = self.capture(immediately and not self.pipeline)
+            if duration is None:
+                return
+            self.lastEnd = max(self.lastEnd, time.monotonic()) + (duration if self.realTime else 0)
+            self.pipeline.append((self.lastEnd, self.segments[0][1]))
+
+    def capture(self, immediately):
+        """Computes all segments of capture. Returns its duration (in seconds) or None if trigger was not found"""
+        period = self.reload * self.decimation / SYSTEM_CORE_CLOCK
+        self.segments = []
+        start = self.clock + self.random.uniform(0, period)
+        for no in range(self.numberOfSegments):
+            if immediately and no == 0:
+                tick = start
+                times = tick + period * np.arange(self.maxNumberOfSamples)
+            elif self.etsSteps > 1:
+                tick = self.findEdge(start)
+                if tick is None:
+                    return None
+                # Sample clock restarts after edge, delayed by phase offset of segment
+                delay = (no % self.etsSteps) * (self.reload * self.decimation // self.etsSteps) / SYSTEM_CORE_CLOCK
+                times = tick + EXTI_LATENCY + delay + period * np.arange(1, self.maxNumberOfSamples + 1)
+            else:
+                tick = self.findTrigger(start)
+                if tick is None:
+                    return None
+                times = tick + period * np.arange(self.maxNumberOfSamples)
+            self.segments.append((int(tick * 1e6) & 0xffffffff, self.store(times)))
+            start = times[-1] + period if len(times) else tick + period
+
+        duration = start - self.clock
+        self.clock = start
+        return duration
+
+    def captureLogic(self, immediately):
+        """Computes runs of logic analyser capture, the same as encode() in logic.c - without immediately
+           the first change of inputs (or appearance of pattern) triggers it and snapshot before is its first one.
+           Returns its duration (in seconds) or None if no input has changed"""
+        period = self.reload / SYSTEM_CORE_CLOCK
+        start = self.clock + self.random.uniform(0, period)
+        count = self.maxNumberOfSamples
+        if not immediately and count > 0:
+            trigger = createTrigger(self.trigger, self.triggerLevel, True, self.digitalSource(np.array([start]))[0])
+            block = 4096
+            for first in range(0, max(int(self.TRIGGER_SEARCH_TIME / period), 1), block):
+                times = start + (first + np.arange(block)) * period
+                hit = trigger.feed(self.digitalSource(times))
+                if hit is not None:
+                    start = times[hit] - period
+                    break
+            else:
+                return None
+
+        values = self.digitalSource(start + period * np.arange(count)).astype(np.uint32)
+        starts = np.flatnonzero(np.diff(values, prepend=-1) != 0)
+        lengths = np.diff(np.append(starts, count)).astype(np.uint32)
+        runs = (lengths << 8) | values[starts]
+        if len(runs) > SerialCom.MAX_LOGIC_RUNS:
+            # Memory of runs is full - the last slot holds the first snapshot of the next run
+            runs = runs[:SerialCom.MAX_LOGIC_RUNS]
+            runs[-1] = (1 << 8) | (runs[-1] & 0xff)
+            count = int(np.sum(runs >> 8))
+        self.segments = [(int(start * 1e6) & 0xffffffff, runs)]
+
+        end = start + count * period
+        duration = end - self.clock
+        self.clock = end
+        return duration
+
+    def update(self):
+        """Finishes capture when its time has passed"""
+        if self.state == WORKING and time.monotonic() >= self.readyAt:
+            self.state = FINISHED
+
+
+def main():
+    """Runs simulated device until interrupted, so it can be used with OscilGUI"""
+    freq = float(sys.argv[1]) if len(sys.argv) > 1 else 1000.0
+    device = SimulatedDevice(SquareSource(freq, edge=0.1 / freq), noise=2.0, realTime=True)
+    print('Simulated device with {} Hz square wave is available at {}'.format(freq, device.start()))
+    try:
+        while True:
+            time.sleep(1)
+    except KeyboardInterrupt:
+        device.stop()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,35 @@
+import numpy as np
+
+
+class SincInterpolator:
+    """Band-limited interpolation of samples between their positions, used when graph is zoomed in
+        Windowed-sinc (Lanczos) kernel is precomputed for fixed number of phases between two samples,
+        so value at any position is dot product of the nearest row of table with neighbouring samples.
+        Cost is proportional to number of requested positions (columns of screen), not to length of capture.
+
+    Attributes:
+        phases: number of precomputed fractional positions between two samples
+        taps: number of samples contributing to each interpolated value (even)
+    """
+    def __init__(self, phases=64, taps=16):
+        self.phases = phases
+        self.taps = taps
+        # Row p holds weights of samples floor(x) - taps/2 + 1 ... floor(x) + taps/2 for x with fraction p/phases
+        offsets = np.arange(-taps // 2 + 1, taps // 2 + 1)
+        distances = offsets[None, :] - np.arange(phases + 1)[:, None] / phases
+        table = np.sinc(distances) * np.sinc(distances / (taps / 2))
+        # Each row is normalised, so constant signal stays constant
+        self.table = (table / table.sum(axis=1, keepdims=True)).astype(np.float32)
+        self.offsets = offsets
+
+    def interpolate(self, samples, positions):
+        """Returns values of samples at provided fractional positions. Samples beyond ends of capture are
+           replaced with the first or the last one"""
+        samples = np.asarray(samples, dtype=np.float32)
+        positions = np.asarray(positions, dtype=np.float64)
+        if len(samples) < 2 or not len(positions):
+            return np.interp(positions, np.arange(len(samples)), samples) if len(samples) else positions
+        whole = np.floor(positions).astype(np.int64)
+        phase = np.rint((positions - whole) * self.phases).astype(np.int64)
+        indices = np.clip(whole[:, None] + self.offsets[None, :], 0, len(samples) - 1)
+        return np.einsum('ij,ij->i', self.table[phase], samples[indices])
@@ -0,0 +1,384 @@
+#!/usr/bin/env python3
+import argparse
+import os
+import shutil
+import sys
+import tempfile
+import threading
+import zipfile
+from time import perf_counter
+import numpy as np
+from recording import Recorder, Replay
+from samples import LOGIC_THRESHOLD, toArray
+from tracing import traced
+
+"""Streaming export of captures to formats of other tools:
+    vcd - Value Change Dump (GTKWave, PulseView), analog channel as real variable and
+          digital channel (analog one compared with LOGIC_THRESHOLD) as wire
+    sr  - sigrok session (PulseView, sigrok-cli), zip archive of logic and analog data in parts
+
+   Data is written block by block as it is read, so recording of any size can be exported with little
+   memory. Both formats describe single continuous acquisition - captures are written one after another
+   at sample rate of the first one and start of every capture is marked in VCD with comment."""
+EXPORT_FORMATS = ('vcd', 'sr')
+"""Number of chunks of recording read at once"""
+BLOCK_CHUNKS = 256
+"""Analog values of VCD are written with resolution of recording - millivolts"""
+VCD_RESOLUTION = 0.001
+"""Identifiers of VCD variables - printable characters, without $ which starts keywords"""
+VCD_IDENTIFIERS = [chr(code) for code in range(33, 127) if chr(code) != '$']
+SIGROK_COMPRESSION = 1
+
+
+def words(texts, count):
+    """Returns array of texts stored as rows of count 8-byte words, padded with zero bytes"""
+    return np.frombuffer(b''.join(text.encode().ljust(8 * count, b'\0') for text in texts),
+                         dtype='<u8').reshape(len(texts), count)
+
+
+"""Text of every number from 0 to 9999 as 4-byte word - padded with leading zeros, then without them
+   (padded with zero bytes), the last entry is empty"""
+DIGIT_GROUPS = words(['{:04d}'.format(no) for no in range(10000)] + ['{:d}'.format(no) for no in range(10000)] + [''],
+                     1).view('<u4')[:, 0]
+TIME_PREFIX = words(['\n#'], 1)[0, 0]
+
+
+class StreamWriter:
+    """Base of writers - receives consecutive blocks of voltages (arrays of shape channels x samples)
+
+    Attributes:
+        sampleRate: frequency at which samples were taken
+        channels: number of channels
+        analog: if set, channels are written as analog and digital signal, otherwise only as digital one
+            (channels of logic analyser)
+        position: number of samples written so far
+    """
+    def __init__(self, path, sampleRate, channels=1, analog=True):
+        self.path = path
+        self.sampleRate = sampleRate
+        self.channels = channels
+        self.analog = analog
+        self.position = 0
+
+    def names(self):
+        return ['D{}'.format(no) for no in range(self.channels)], \
+               ['A{}'.format(no) for no in range(self.channels)] if self.analog else []
+
+    def mark(self, text):
+        """Marks current position, e.g. start of capture - ignored by formats without comments"""
+
+    def write(self, volts):
+        raise NotImplementedError
+
+    def close(self):
+        raise NotImplementedError
+
+
+class VcdWriter(StreamWriter):
+    """Writes Value Change Dump - only samples which change any variable are written.
+
+       Text is composed without formatting numbers one by one: every sample is row of 8-byte words (time and
+       looked up text of every variable), parts which are not written are left zero and all zero bytes are
+       removed at once. Every value starts with new line, so row does not need terminator"""
+    def __init__(self, path, sampleRate, channels=1, analog=True):
+        super().__init__(path, sampleRate, channels, analog)
+        self.file = open(path, 'wb')
+        digital, analogNames = self.names()
+        self.digitalIds = VCD_IDENTIFIERS[:self.channels]
+        self.analogIds = VCD_IDENTIFIERS[self.channels:self.channels + len(analogNames)]
+        header = ['$timescale 1 ns $end', '$scope module STM32Oscil $end']
+        header += ['$var real 64 {} {} $end'.format(id, name) for id, name in zip(self.analogIds, analogNames)]
+        header += ['$var wire 1 {} {} $end'.format(id, name) for id, name in zip(self.digitalIds, digital)]
+        header += ['$upscope $end', '$enddefinitions $end']
+        self.file.write('\n'.join(header).encode())
+        # Text of every value of every variable, analog values are in range of recording
+        levels = ['\nr{:g} '.format(level * VCD_RESOLUTION) for level in range(1 << 16)]
+        self.analogTexts = [words([level + id for level in levels] + [''], 2) for id in self.analogIds]
+        self.digitalTexts = [words(['\n0' + id, '\n1' + id, ''], 1)[:, 0] for id in self.digitalIds]
+        self.last = None
+        self.buffer = np.empty(0, dtype='<u8')
+
+    def mark(self, text):
+        self.file.write('\n$comment {} $end'.format(text).encode())
+
+    @staticmethod
+    def decimal(numbers, groups):
+        """Returns text of non-negative integers as rows of groups 8-byte words, with zero bytes in place of
+           leading zeros. Numbers are split into groups of 4 digits, text of which is looked up"""
+        parts = np.empty((len(numbers), 2 * groups), dtype='<u4')
+        rest = numbers
+        for no in range(2 * groups - 1, -1, -1):
+            quotient = rest // 10000
+            # The most significant group is written without leading zeros, groups above it are empty
+            index = rest - quotient * 10000 + 10000 * (quotient == 0)
+            if no != 2 * groups - 1:
+                index[rest == 0] = 20000
+            parts[:, no] = DIGIT_GROUPS[index]
+            rest = quotient
+        return parts.view('<u8')
+
+    @traced('export vcd')
+    def write(self, volts):
+        volts = np.atleast_2d(volts)
+        levels = np.clip(np.rint(volts / VCD_RESOLUTION), 0, (1 << 16) - 1).astype(np.int32)
+        bits = volts > LOGIC_THRESHOLD
+        state = np.concatenate((levels, bits)) if self.analog else bits.astype(np.int32)
+        previous = np.empty_like(state)
+        previous[:, 1:] = state[:, :-1]
+        # Everything is written at the first sample of file, afterwards only changes
+        previous[:, 0] = -1 if self.last is None else self.last
+        changed = state != previous
+        self.last = state[:, -1].copy()
+        samples = np.flatnonzero(changed.any(axis=0))
+
+        times = np.rint((self.position + samples) * (1e9 / self.sampleRate)).astype(np.int64)
+        groups = (len(str(int(times[-1]))) + 7) // 8 if len(times) else 1
+        columns = 1 + groups + 2 * len(self.analogIds) + len(self.digitalIds)
+        # Buffer is reused, as touching new memory costs more than filling it
+        if len(self.buffer) < len(samples) * columns:
+            self.buffer = np.empty(len(samples) * columns, dtype='<u8')
+        text = self.buffer[:len(samples) * columns].reshape(len(samples), columns)
+        text[:, 0] = TIME_PREFIX
+        text[:, 1:groups + 1] = self.decimal(times, groups)
+        column = groups + 1
+        # Unchanged variables get empty text - the last entry of table
+        for row, texts in enumerate(self.analogTexts):
+            index = np.where(changed[row, samples], levels[row, samples], len(texts) - 1)
+            np.take(texts[:, 0], index, out=text[:, column])
+            np.take(texts[:, 1], index, out=text[:, column + 1])
+            column += 2
+        for channel, texts in enumerate(self.digitalTexts):
+            index = np.where(changed[len(self.analogIds) + channel, samples], bits[channel, samples], len(texts) - 1)
+            np.take(texts, index, out=text[:, column])
+            column += 1
+        text = text.view(np.uint8)
+        self.file.write(text[text != 0].tobytes())
+        self.position += volts.shape[1]
+
+    def close(self):
+        self.file.write('\n#{:.0f}\n'.format(self.position * 1e9 / self.sampleRate).encode())
+        self.file.close()
+
+
+class SigrokWriter(StreamWriter):
+    """Writes sigrok session - digital channels are packed in byte per sample, analog ones are stored as float32.
+       Every block is stored in separate member of archive, as sigrok does"""
+    def __init__(self, path, sampleRate, channels=1, analog=True):
+        super().__init__(path, sampleRate, channels, analog)
+        if channels > 8:
+            raise ValueError('Sigrok export supports up to 8 channels')
+        self.archive = zipfile.ZipFile(path, 'w', zipfile.ZIP_DEFLATED, compresslevel=SIGROK_COMPRESSION)
+        self.archive.writestr('version', '2')
+        digital, analogNames = self.names()
+        metadata = ['[global]', 'sigrok version=0.5.2', '', '[device 1]', 'capturefile=logic-1',
+                    'total probes={}'.format(len(digital)), 'samplerate={:.0f}'.format(sampleRate),
+                    'total analog={}'.format(len(analogNames))]
+        metadata += ['probe{}={}'.format(no + 1, name) for no, name in enumerate(digital)]
+        metadata += ['analog{}={}'.format(len(digital) + no + 1, name) for no, name in enumerate(analogNames)]
+        metadata += ['unitsize=1', '']
+        self.archive.writestr('metadata', '\n'.join(metadata))
+        self.weights = (1 << np.arange(channels, dtype=np.uint8))[:, None]
+        self.blockNo = 0
+
+    @traced('export sr')
+    def write(self, volts):
+        volts = np.atleast_2d(volts)
+        self.blockNo += 1
+        logic = ((volts > LOGIC_THRESHOLD) * self.weights).sum(axis=0, dtype=np.uint8)
+        self.archive.writestr('logic-1-{}'.format(self.blockNo), logic.tobytes())
+        if self.analog:
+            for channel in range(self.channels):
+                self.archive.writestr('analog-1-{}-{}'.format(self.channels + channel + 1, self.blockNo),
+                                      volts[channel].astype('<f4').tobytes())
+        self.position += volts.shape[1]
+
+    def close(self):
+        self.archive.close()
+
+
+WRITERS = {'vcd': VcdWriter, 'sr': SigrokWriter}
+
+
+def exportFormat(path, fmt=None):
+    """Returns format of export - provided one or guessed from extension of file"""
+    if fmt is None:
+        fmt = os.path.splitext(path)[1][1:].lower()
+    if fmt not in EXPORT_FORMATS:
+        raise ValueError('Unsupported format of export: {} (expected one of {})'.format(fmt, ', '.join(EXPORT_FORMATS)))
+    return fmt
+
+
+class Source:
+    """Blocks of captures to export
+
+    Attributes:
+        sampleRate: sample rate of the first capture
+        channels: number of channels
+        samples: total number of samples of every channel
+        captures: number of captures
+    """
+    def __init__(self, sampleRate, channels, samples, captures):
+        self.sampleRate = sampleRate
+        self.channels = channels
+        self.samples = samples
+        self.captures = captures
+
+    def blocks(self):
+        """Iterator of pairs (number of capture, array of voltages of shape channels x samples)"""
+        raise NotImplementedError
+
+
+class ReplaySource(Source):
+    """Every capture of recording - read chunk after chunk, without loading it whole"""
+    def __init__(self, replay, blockChunks=BLOCK_CHUNKS):
+        super().__init__(replay.sampleRate if not len(replay) else float(replay.index['sampleRate'][0]),
+                         replay.channels, int(replay.index['samples'].sum()), len(replay))
+        self.replay = replay
+        self.blockChunks = blockChunks
+
+    def blocks(self):
+        for no in range(len(self.replay)):
+            for volts in self.replay.blocks(no, self.blockChunks):
+                yield no, volts
+
+
+class CaptureSource(Source):
+    """Captures kept in memory - objects with channels and sampleRate, as returned by Oscilloscope"""
+    def __init__(self, captures):
+        self.list = list(captures)
+        first = self.list[0] if self.list else None
+        super().__init__(first.sampleRate if first else 1.0, len(first.channels) if first else 1,
+                         sum(len(capture.channels[0]) for capture in self.list), len(self.list))
+
+    def blocks(self):
+        for no, capture in enumerate(self.list):
+            yield no, np.array([toArray(channel) for channel in capture.channels], dtype=np.float32)
+
+
+def exportStream(source, path, fmt=None, progress=None):
+    """Writes blocks of source to file, progress (if provided) is called with number of samples written so far
+       and returns False to cancel export. Returns number of written samples"""
+    writer = WRITERS[exportFormat(path, fmt)](path, source.sampleRate, source.channels, analog=source.channels == 1)
+    current = None
+    try:
+        for no, volts in source.blocks():
+            if no != current:
+                current = no
+                writer.mark('capture {}'.format(no))
+            writer.write(volts)
+            if progress is not None and progress(writer.position) is False:
+                break
+    finally:
+        writer.close()
+    return writer.position
+
+
+class ExportJob(threading.Thread):
+    """Export running in background - state is read by GUI between frames
+
+    Attributes:
+        written: number of samples written so far
+        error: message of exception which stopped export, None if there was not any
+        finished: set when export ended (successfully or not)
+    """
+    def __init__(self, source, path, fmt=None):
+        super().__init__(daemon=True)
+        self.source = source
+        self.path = path
+        self.fmt = exportFormat(path, fmt)
+        self.written = 0
+        self.error = None
+        self.finished = False
+        self.cancelled = False
+        self.started = self.ended = None
+
+    def run(self):
+        self.started = perf_counter()
+        try:
+            exportStream(self.source, self.path, self.fmt, self.update)
+        except Exception as e:
+            self.error = str(e)
+        self.ended = perf_counter()
+        self.finished = True
+
+    def update(self, written):
+        self.written = written
+        return not self.cancelled
+
+    def cancel(self):
+        self.cancelled = True
+
+    def throughput(self):
+        """Returns speed of export in MB/s of recorded data (2 bytes per sample of every channel)"""
+        elapsed = (self.ended or perf_counter()) - (self.started or perf_counter())
+        return self.written * self.source.channels * 2 / 1e6 / elapsed if elapsed > 0 else 0.0
+
+    def describe(self):
+        name = os.path.basename(self.path)
+        if self.error is not None:
+            return 'Export of {} failed: {}'.format(name, self.error)
+        if self.finished:
+            return 'Exported {} ({:.3g} MB/s){}'.format(name, self.throughput(),
+                                                        ' - cancelled' if self.cancelled else '')
+        return 'Exporting {} {:.0f}% ({:.3g} MB/s)'.format(name, 100 * self.written / max(self.source.samples, 1),
+                                                          self.throughput())
+
+
+def benchmark(megabytes):
+    """Writes synthetic recordings of provided size and reports speed of their export to every format.
+       Noisy signal changes analog value at every sample - the worst case of VCD, clean one only at edges"""
+    directory = tempfile.mkdtemp()
+    rng = np.random.default_rng(1)
+    sampleRate, length = 1000000, 1 << 20
+    t = np.arange(length) / sampleRate
+    square = np.where(np.mod(t * 1000, 1.0) < 0.5, 3.0, 0.3)
+    try:
+        for name, volts in (('noisy', square + rng.normal(0, 0.01, length)), ('clean', square)):
+            path = os.path.join(directory, name + '.rec')
+            recorder = Recorder(path, sampleRate)
+            for _ in range(max(1, int(megabytes * 1e6 / 2 / length))):
+                recorder.write([volts])
+            recorder.close()
+            replay = Replay(path)
+            size = replay.index['samples'].sum() * 2 / 1e6
+            for fmt in EXPORT_FORMATS:
+                output = os.path.join(directory, name + '.' + fmt)
+                start = perf_counter()
+                exportStream(ReplaySource(replay), output)
+                elapsed = perf_counter() - start
+                print('{} signal to {}: {:.1f} MB of recording in {:.2f} s - {:.1f} MB/s, output {:.1f} MB'.format(
+                    name, fmt, size, elapsed, size / elapsed, os.path.getsize(output) / 1e6))
+                os.remove(output)
+            replay.close()
+            os.remove(path)
+    finally:
+        shutil.rmtree(directory)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Exports recording to VCD or sigrok session')
+    parser.add_argument('input', nargs='?', help='recording file written by OscilGUI.py --record')
+    parser.add_argument('output', nargs='?', help='file to write, format is chosen by extension (.vcd or .sr)')
+    parser.add_argument('--format', choices=EXPORT_FORMATS, help='format of output, if it has other extension')
+    parser.add_argument('--benchmark', type=float, metavar='MB',
+                        help='measure speed of export of synthetic recording of provided size')
+    args = parser.parse_args()
+    if args.benchmark is not None:
+        return benchmark(args.benchmark)
+    if args.input is None or args.output is None:
+        parser.error('input and output are required')
+
+    replay = Replay(args.input)
+    job = ExportJob(ReplaySource(replay), args.output, args.format)
+    job.start()
+    while job.is_alive():
+        job.join(0.5)
+        print('\r' + job.describe(), end='', flush=True)
+    print('\r' + job.describe())
+    replay.close()
+    return 1 if job.error is not None else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+import functools
+import itertools
+import json
+import os
+import sys
+import tempfile
+import threading
+from time import perf_counter_ns
+import numpy as np
+
+"""Tracing of host pipeline - spans of work (download, decode, render, ...) are stored in preallocated ring
+   buffer with monotonic timestamps and written on demand as Chrome trace_event JSON (chrome://tracing,
+   Perfetto). When tracing is disabled span() returns shared object doing nothing, so instrumented code
+   costs a single function call.
+
+   Example:
+        with span('render'):
+            ...
+        instant('capture ready')
+
+        @traced('serial read')
+        def downloadData(self):
+            ..."""
+DFT_CAPACITY = 65536
+
+
+class Tracer:
+    """Ring buffer of trace events - the oldest ones are overwritten when it is full
+
+    Attributes:
+        capacity: maximal number of stored events
+    """
+    def __init__(self, capacity=DFT_CAPACITY):
+        self.capacity = capacity
+        # Lists are preallocated - storing into them is cheaper than into numpy arrays
+        self.starts = [0] * capacity
+        self.durations = [0] * capacity
+        self.names = [0] * capacity
+        self.threads = [0] * capacity
+        self.nameIds = {}
+        self.threadIds = {}
+        # next() of itertools.count is atomic, so threads never get the same slot
+        self.counter = itertools.count()
+        self.recorded = 0
+        self.origin = perf_counter_ns()
+
+    def idOf(self, table, key):
+        value = table.get(key)
+        if value is None:
+            value = table.setdefault(key, len(table))
+        return value
+
+    def record(self, name, start, end):
+        """Stores event which lasted from start to end (perf_counter_ns), instant event has end of -1"""
+        no = next(self.counter)
+        slot = no % self.capacity
+        self.starts[slot] = start
+        self.durations[slot] = end - start if end >= 0 else -1
+        self.names[slot] = self.idOf(self.nameIds, name)
+        self.threads[slot] = self.idOf(self.threadIds, threading.get_ident())
+        self.recorded = max(self.recorded, no + 1)
+
+    def events(self):
+        """Returns list of stored events in trace_event format, in order of start"""
+        count = min(self.recorded, self.capacity)
+        names = {value: name for name, value in self.nameIds.items()}
+        order = np.argsort(self.starts[:count], kind='stable')
+        events = []
+        pid = os.getpid()
+        for slot in order:
+            event = {'name': names[self.names[slot]], 'pid': pid, 'tid': self.threads[slot],
+                     'ts': (self.starts[slot] - self.origin) / 1000}
+            if self.durations[slot] < 0:
+                event.update(ph='i', s='t')
+            else:
+                event.update(ph='X', dur=self.durations[slot] / 1000)
+            events.append(event)
+        return events
+
+    def dump(self, path):
+        """Writes events to file in Chrome trace_event JSON format, returns number of written events"""
+        events = self.events()
+        with open(path, 'w') as file:
+            json.dump({'traceEvents': events, 'displayTimeUnit': 'ms'}, file)
+        return len(events)
+
+
+class Span:
+    """Context manager recording time of code inside with statement"""
+    __slots__ = ('name', 'start')
+
+    def __init__(self, name):
+        self.name = name
+
+    def __enter__(self):
+        self.start = perf_counter_ns()
+        return self
+
+    def __exit__(self, *args):
+        if tracer is not None:
+            tracer.record(self.name, self.start, perf_counter_ns())
+
+
+class NullSpan:
+    """Span used when tracing is disabled"""
+    __slots__ = ()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        pass
+
+
+NULL_SPAN = NullSpan()
+"""Active Tracer, None if tracing is disabled"""
+tracer = None
+
+
+def enable(capacity=DFT_CAPACITY):
+    global tracer
+    tracer = Tracer(capacity)
+    return tracer
+
+
+def disable():
+    global tracer
+    tracer = None
+
+
+def span(name):
+    """Returns context manager recording span of provided name"""
+    return NULL_SPAN if tracer is None else Span(name)
+
+
+def traced(name):
+    """Decorator recording every call of function as span of provided name"""
+    def decorate(function):
+        @functools.wraps(function)
+        def wrapper(*args, **kwargs):
+            if tracer is None:
+                return function(*args, **kwargs)
+            with Span(name):
+                return function(*args, **kwargs)
+        return wrapper
+    return decorate
+
+
+def instant(name):
+    """Records event without duration, e.g. arrival of capture"""
+    if tracer is not None:
+        tracer.record(name, perf_counter_ns(), -1)
+
+
+def dump(path):
+    """Writes events recorded so far to file - returns number of events, 0 if tracing is disabled"""
+    return tracer.dump(path) if tracer is not None else 0
+
+
+def main():
+    """Measures cost of span with tracing disabled and enabled, and checks that ring buffer keeps the newest
+       events and writes valid trace"""
+    def measure(count=200000):
+        start = perf_counter_ns()
+        for _ in range(count):
+            with span('work'):
+                pass
+        return (perf_counter_ns() - start) / count
+
+    disable()
+    off = measure()
+    enable(1000)
+    on = measure()
+    print('span costs {:.0f} ns with tracing disabled, {:.0f} ns enabled'.format(off, on))
+
+    enable(4)
+    for no in range(10):
+        with span('span{}'.format(no)):
+            pass
+    instant('marker')
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, 'trace.json')
+        written = dump(path)
+        with open(path) as file:
+            names = [event['name'] for event in json.load(file)['traceEvents']]
+    ok = written == 4 and names == ['span7', 'span8', 'span9', 'marker']
+    print('ring buffer keeps {} - {}'.format(', '.join(names), 'OK' if ok else 'FAILED'))
+    disable()
+    return 0 if ok else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
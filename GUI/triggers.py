@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import numpy as np
+from serialCom import TriggerConfig
+
+"""Models of trigger stages of device (capture.c) and pattern trigger of logic analyser (logic.c), used by
+   simulated device. Trigger is fed with consecutive blocks of readings and keeps its state between them,
+   the same as state machine run by device for every sample. feed() returns index of reading which fires
+   trigger (the first stored one) or None"""
+
+"""Phases of runt trigger, the same as in capture.c"""
+RUNT_LOW, RUNT_MIDDLE, RUNT_FULL = range(3)
+
+"""Host build of trigger stages of capture.c - stub of STM32 library and harness feeding SysTick_Handler
+   with readings. Harness reads lines 'type flags level upper width count readings...' and prints index
+   of reading which fired trigger (-1 if none) for each of them"""
+FIRMWARE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'MCU')
+HOST_STUB = r"""
+#include <stdint.h>
+typedef struct { uint32_t DR; } ADC_TypeDef;
+typedef struct { uint32_t DEMCR; } CoreDebug_Type;
+typedef struct { uint32_t CTRL, CYCCNT; } DWT_Type;
+extern CoreDebug_Type coreDebugStub;
+extern DWT_Type dwtStub;
+#define ADC1 ((ADC_TypeDef*)0)
+#define CoreDebug (&coreDebugStub)
+#define DWT (&dwtStub)
+#define CoreDebug_DEMCR_TRCENA_Msk 0x01000000
+#define DWT_CTRL_CYCCNTENA_Msk 0x00000001
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+uint16_t ADC_GetConversionValue(ADC_TypeDef*);
+"""
+HOST_HARNESS = r"""
+#include <stdio.h>
+#include "stm32f10x.h"
+#include "capture.h"
+#include "probe.h"
+
+CoreDebug_Type coreDebugStub;
+DWT_Type dwtStub;
+// Variables of probe.c describing segment being filled
+uint16_t currentNumberOfSamples;
+int maxNumberOfSamples;
+uint8_t* segment;
+int triggerLevel;
+
+static uint16_t reading;
+static int position, fired;
+
+uint16_t ADC_GetConversionValue(ADC_TypeDef* adc) {
+	(void)adc;
+	return reading;
+}
+
+void segmentTriggered(void) {
+	fired = position;
+	captureIdle();
+}
+
+void segmentFilled(void) {
+}
+
+int main(void) {
+	int type, flags, upper, count;
+	unsigned width;
+	initCapture();
+	while(scanf("%d %d %d %d %u %d", &type, &flags, &triggerLevel, &upper, &width, &count) == 6) {
+		setTriggerCondition(type, flags, upper, width);
+		captureWaitForTrigger();
+		fired = -1;
+		for(position = 0; position < count; position++) {
+			int value;
+			if(scanf("%d", &value) != 1)
+				return 1;
+			reading = value;
+			SysTick_Handler();
+		}
+		captureIdle();
+		printf("%d\n", fired);
+	}
+	return 0;
+}
+"""
+
+
+class LevelTrigger:
+    """Fires on the first reading at or below trigger level"""
+    def __init__(self, level):
+        self.level = level
+
+    def feed(self, readings):
+        hits = np.flatnonzero(np.asarray(readings) <= self.level)
+        return int(hits[0]) if len(hits) else None
+
+
+class PulseTrigger:
+    """Fires on the first reading after pulse on the high (or low, if negative) side of trigger level, which is
+       shorter (or longer) than limit in ticks of sample clock. Pulse in progress when trigger was armed is ignored"""
+    def __init__(self, level, limit, negative=False, longer=False):
+        self.level, self.limit, self.negative, self.longer = level, limit, negative, longer
+        self.length = 0
+        self.armed = False
+
+    def feed(self, readings):
+        inside = (np.asarray(readings) > self.level) != self.negative
+        outside = np.flatnonzero(~inside)
+        if not len(outside):
+            if self.armed:
+                self.length += len(inside)
+            return None
+
+        # Every reading outside of pulse ends pulse formed by readings inside since the previous one
+        lengths = outside - np.concatenate(([-1], outside[:-1])) - 1
+        lengths[0] = lengths[0] + self.length if self.armed else 0
+        fires = (lengths != 0) & (lengths > self.limit if self.longer else lengths < self.limit)
+        hits = np.flatnonzero(fires)
+        if len(hits):
+            return int(outside[hits[0]])
+        self.armed = True
+        self.length = len(inside) - outside[-1] - 1
+        return None
+
+
+class RuntTrigger:
+    """Fires on the first reading below lower level after pulse which crossed it, but has not reached upper level.
+       Negative runt is detected as positive one in inverted readings. Pulse which has reached upper level
+       before trigger was armed is not a runt"""
+    def __init__(self, lower, upper, negative=False, adcMax=0xfff):
+        self.invert = adcMax if negative else 0
+        self.lower = adcMax - upper if negative else lower
+        self.upper = adcMax - lower if negative else upper
+        self.phase = RUNT_FULL
+
+    def feed(self, readings):
+        values = np.asarray(readings, dtype=np.int32) ^ self.invert
+        indices = np.arange(len(values))
+        # Index of the last reading of each zone up to every reading, state of previous block is virtual index -1
+        initial = {RUNT_FULL: (-2, -3, -1), RUNT_MIDDLE: (-2, -1, -3), RUNT_LOW: (-1, -3, -2)}[self.phase]
+        last = []
+        for zone, start in zip((values <= self.lower, (values > self.lower) & (values <= self.upper),
+                                values > self.upper), initial):
+            last.append(np.maximum.accumulate(np.concatenate(([start], np.where(zone, indices, -4)))))
+        low, middle, full = last
+        # Phase before reading i depends on which zone was visited last - values at position i
+        fires = (values <= self.lower) & (low[:-1] > full[:-1]) & (middle[:-1] > low[:-1])
+        hits = np.flatnonzero(fires)
+        if len(hits):
+            return int(hits[0])
+        if full[-1] > low[-1]:
+            self.phase = RUNT_FULL
+        else:
+            self.phase = RUNT_MIDDLE if middle[-1] > low[-1] else RUNT_LOW
+        return None
+
+
+class PatternTrigger:
+    """Fires on snapshot of digital inputs which matches pattern when the previous one does not,
+       or on any change of inputs if mask is 0. Capture starts with the snapshot before the one returned"""
+    def __init__(self, pattern, mask, initial):
+        self.pattern, self.mask = pattern & mask, mask
+        self.previous = initial
+
+    def feed(self, values):
+        values = np.asarray(values)
+        if not len(values):
+            return None
+        previous = np.concatenate(([self.previous], values[:-1]))
+        if self.mask:
+            fires = ((values & self.mask) == self.pattern) & ((previous & self.mask) != self.pattern)
+        else:
+            fires = values != previous
+        hits = np.flatnonzero(fires)
+        if len(hits):
+            return int(hits[0])
+        self.previous = values[-1]
+        return None
+
+
+def createTrigger(trigger, level, digital=False, initial=0):
+    """Returns model of trigger condition of device - TriggerConfig and trigger level in ADC units.
+       initial is the first snapshot of inputs taken by logic analyser"""
+    if digital:
+        isPattern = trigger.type == TriggerConfig.PATTERN
+        return PatternTrigger(trigger.pattern if isPattern else 0, trigger.mask if isPattern else 0, initial)
+    if trigger.type == TriggerConfig.PULSE:
+        return PulseTrigger(level, trigger.width, trigger.negative, trigger.longer)
+    if trigger.type == TriggerConfig.RUNT:
+        return RuntTrigger(level, (round(trigger.upperLevel * 1000) * 10000) // 8059, trigger.negative)
+    return LevelTrigger(level)
+
+
+def firmwareParity(count=300, seed=2):
+    """Builds trigger stages of capture.c for host and checks that they fire on the same reading as models,
+       which are fed with the same random signals in blocks of random size. Returns number of mismatching
+       signals, None if no C compiler is available"""
+    compiler = shutil.which('gcc') or shutil.which('cc')
+    if compiler is None:
+        return None
+    rng = np.random.default_rng(seed)
+    cases = []
+    for _ in range(count):
+        # Steps of random level and duration - pulses and runts of every width around trigger levels
+        durations = rng.integers(1, 40, 30)
+        signal = np.repeat(rng.integers(0, 0x1000, len(durations)), durations)
+        signal = np.clip(signal + rng.integers(-20, 21, len(signal)), 0, 0xfff)
+        kind = int(rng.integers(0, 3))
+        flags = int(rng.integers(0, 4))
+        level = int(rng.integers(500, 3000))
+        upper = int(rng.integers(level + 1, 0x1000))
+        width = int(rng.integers(1, 40))
+        cases.append((kind, flags, level, upper, width, signal))
+
+    with tempfile.TemporaryDirectory() as directory:
+        with open(os.path.join(directory, 'stm32f10x.h'), 'w') as file:
+            file.write(HOST_STUB)
+        with open(os.path.join(directory, 'harness.c'), 'w') as file:
+            file.write(HOST_HARNESS)
+        harness = os.path.join(directory, 'harness')
+        subprocess.run([compiler, '-std=gnu11', '-O1', '-I', directory, '-I', os.path.join(FIRMWARE_DIR, 'inc'),
+                        os.path.join(FIRMWARE_DIR, 'src', 'capture.c'), os.path.join(directory, 'harness.c'),
+                        '-o', harness], check=True)
+        lines = ['{} {} {} {} {} {} {}'.format(kind, flags, level, upper, width, len(signal),
+                                               ' '.join(map(str, signal)))
+                 for kind, flags, level, upper, width, signal in cases]
+        output = subprocess.run([harness], input='\n'.join(lines) + '\n', capture_output=True, text=True,
+                                check=True).stdout.split()
+
+    mismatches = 0
+    for (kind, flags, level, upper, width, signal), fired in zip(cases, output):
+        negative, longer = bool(flags & TriggerConfig.NEGATIVE), bool(flags & TriggerConfig.LONGER)
+        trigger = (PulseTrigger(level, width, negative, longer) if kind == TriggerConfig.PULSE else
+                   RuntTrigger(level, upper, negative) if kind == TriggerConfig.RUNT else LevelTrigger(level))
+        expected, start = -1, 0
+        while start < len(signal):
+            block = signal[start:start + int(rng.integers(1, 100))]
+            index = trigger.feed(block)
+            if index is not None:
+                expected = start + index
+                break
+            start += len(block)
+        mismatches += int(fired) != expected
+    return mismatches if len(output) == len(cases) else len(cases)
+
+
+def main():
+    """Simulation harness - captures synthetic signals with rare faults from simulated device and checks
+       that capture starts at the fault: glitch of clock, break of UART and runt pulse"""
+    from simDevice import SimulatedDevice
+    from serialCom import SerialCom, AcquisitionConfig
+
+    sampleRate, length = 100000, 200
+
+    def clockWithGlitch(t):
+        # 1 kHz clock with 30us pulse at 12.7 ms
+        level = (np.mod(t * 1000, 1.0) < 0.5) | ((t >= 0.0127) & (t < 0.01273))
+        return np.where(level, 3.3, 0.0)
+
+    def uartWithBreak(t):
+        # Byte 0x55 at 9600 baud every 2 ms, one of them replaced by break - line held low for 12 bits
+        bit = np.floor(np.mod(t, 0.002) * 9600).astype(int)
+        level = np.where(bit == 0, 0, np.where(bit <= 8, (0x55 >> np.clip(bit - 1, 0, 7)) & 1, 1))
+        frame = (t >= 0.014) & (t < 0.016) & (bit < 12)
+        return np.where(frame, 0.0, level * 3.3)
+
+    def pulsesWithRunt(t):
+        # 1 kHz pulses reaching 3 V, the one at 8 ms only 1.5 V
+        high = np.mod(t * 1000, 1.0) < 0.3
+        return np.where(high, np.where((t >= 0.008) & (t < 0.009), 1.5, 3.0), 0.2)
+
+    cases = (('clock glitch', clockWithGlitch, TriggerConfig(TriggerConfig.PULSE, width=100e-6 * sampleRate),
+              0.01273, 1.5),
+             ('UART break', uartWithBreak,
+              TriggerConfig(TriggerConfig.PULSE, negative=True, longer=True, width=9.5 / 9600 * sampleRate),
+              0.014 + 12 / 9600, 1.5),
+             ('runt pulse', pulsesWithRunt, TriggerConfig(TriggerConfig.RUNT, upperLevel=2.5), 0.0083, 1.0))
+    failed = 0
+    for name, source, trigger, expected, level in cases:
+        device = SimulatedDevice(source, seed=1)
+        serial = SerialCom(device.start())
+        serial.setConfig(AcquisitionConfig(level, 0, sampleRate, length))
+        status = serial.setTriggerConfig(trigger)
+        serial.trigMode()
+        timestamp = device.segments[0][0] / 1e6 if device.segments else None
+        device.stop()
+        ok = status == 0 and timestamp is not None and abs(timestamp - expected) <= 2 / sampleRate
+        failed += not ok
+        print('{:<20} triggered at {} (expected {:.5f} s) - {}'.format(
+            name, 'none' if timestamp is None else '{:.5f} s'.format(timestamp), expected, 'OK' if ok else 'FAILED'))
+
+    mismatches = firmwareParity()
+    if mismatches is None:
+        print('capture.c trigger stages not checked - no C compiler')
+    else:
+        failed += mismatches != 0
+        print('capture.c trigger stages fire like models - {}'.format(
+            'OK' if not mismatches else 'FAILED ({} signals)'.format(mismatches)))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
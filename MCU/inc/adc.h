@@ -0,0 +1,41 @@
+/*
+ * adc.h
+ * Header of file adc.c
+ */
+
+#ifndef ADC_H_
+#define ADC_H_
+
+#include <stdint.h>
+
+// Number of sample times of ADC (1.5 to 239.5 cycles of ADC clock)
+#define NUMBER_OF_SAMPLE_TIMES		8
+// Highest ADC clock allowed by datasheet
+#define MAX_ADC_CLOCK				14000000
+// Highest output impedance of measured source given by datasheet for the longest sample time
+#define MAX_SOURCE_IMPEDANCE		50000
+// Resistance of sampling switch in ohms
+#define ADC_RESISTANCE				1000
+// Chosen conversions are at least this many times faster than sample clock - reading is the last finished
+// conversion, so it lags sample clock by up to one conversion
+#define ADC_RATE_MARGIN				8
+// Time (in 1/100 ps) needed to charge sample and hold capacitor (8 pF) to 1/4 LSB through one ohm - ln(2^14) * 8 pF
+#define ADC_SETTLING_PER_OHM		7763
+
+// Timing of ADC, exchanged with host by SET_ADC_TIMING command - host fills requested sample clock
+// and impedance of source, device responds with the same structure with chosen timing
+struct __attribute__((packed)) adcTiming {
+	uint32_t frequency;				// sample clock (readings per second) timing is chosen for, 0 - current one
+	uint32_t impedance;				// output impedance of measured source in ohms
+	uint8_t sampleTime;				// ADC_SampleTime_* (0 - 1.5 cycles ... 7 - 239.5 cycles)
+	uint8_t prescaler;				// divider of PCLK2 giving ADC clock
+	uint8_t reserved[2];
+	uint32_t maxFrequency;			// the highest sample clock for which ADC keeps ADC_RATE_MARGIN with the source
+};
+
+// Definitions of functions
+void initAdc(void);
+void chooseAdcTiming(struct adcTiming*);
+void applyAdcTiming(const struct adcTiming*);
+
+#endif /* ADC_H_ */
@@ -0,0 +1,58 @@
+/*
+ * capture.h
+ * Header of file capture.c
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+
+// Set to 1 (e.g. -DCAPTURE_PROFILING=1) to measure capture stages with DWT cycle counter in SysTick_Handler
+#ifndef CAPTURE_PROFILING
+#define CAPTURE_PROFILING		0
+#endif
+
+// Highest sample clock (readings per second) SysTick_Handler keeps up with
+#define MAX_SAMPLE_CLOCK		200000
+
+// Maximum number of ADC readings averaged into one stored sample (power of 2)
+#define MAX_DECIMATION			16
+
+// Highest reading of 12-bit ADC
+#define ADC_MAX					0xFFF
+
+// Number of bits of stored sample: whole reading, two readings packed in 3 bytes or 8 MSB of reading
+#define SAMPLE_WIDTH_16			16
+#define SAMPLE_WIDTH_12			12
+#define SAMPLE_WIDTH_8			8
+
+// Enum representing routines which can be run on every tick of sample clock
+enum captureStages {STAGE_IDLE, STAGE_LEVEL_TRIGGER, STAGE_PULSE_TRIGGER, STAGE_RUNT_TRIGGER, STAGE_STORE,
+	STAGE_AVERAGE_2, STAGE_AVERAGE_4, STAGE_AVERAGE_8, STAGE_AVERAGE_16, NUMBER_OF_STAGES};
+
+// Cost of capture stage measured with DWT cycle counter
+struct stageProfile {
+	uint32_t calls;
+	uint32_t cycles;
+	uint32_t maxCycles;
+};
+
+// Definitions of functions
+void initCapture(void);
+void captureIdle(void);
+void captureWaitForTrigger(void);
+void captureStart(void);
+int setTriggerCondition(int, int, uint16_t, uint32_t);
+int isValidDecimation(int);
+int setDecimation(int);
+int getDecimation(void);
+int isValidSampleWidth(int);
+int setSampleWidth(int);
+int getSampleWidth(void);
+uint32_t samplesSize(int, int);
+uint16_t loadSample(const uint8_t*, int);
+void takeProfiles(struct stageProfile*);
+void SysTick_Handler(void);
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,34 @@
+/*
+ * logic.h
+ * Header of file logic.c
+ */
+
+#ifndef LOGIC_H_
+#define LOGIC_H_
+
+#include <stdint.h>
+
+// Number of digital inputs - PA0-PA7 are sampled together as low byte of GPIOA->IDR
+#define LOGIC_CHANNELS			8
+// Size (in bytes) of circular buffer DMA writes port snapshots to - each half is encoded while the other is filled
+#define LOGIC_RING_SIZE			512
+// Highest frequency of port snapshots - encoding of half of ring has to finish before the other half is filled
+#define MAX_LOGIC_FREQ			4000000
+// Maximum number of snapshots of one capture
+#define MAX_LOGIC_SAMPLES		0xFFFF
+
+// Captured signal is stored as runs: value of port in 8 LSB, number of snapshots it lasted for in 24 MSB
+#define RUN_VALUE(run)			((run) & 0xFF)
+#define RUN_LENGTH(run)			((run) >> 8)
+#define MAX_RUN_LENGTH			0xFFFFFF
+
+// Definitions of functions
+int isValidLogicPeriod(uint32_t);
+void setLogicPeriod(uint32_t);
+void setLogicPattern(uint8_t, uint8_t);
+void logicStart(uint32_t*, int, uint32_t, int);
+void logicStop(void);
+int getLogicRuns(void);
+void DMA1_Channel3_IRQHandler(void);
+
+#endif /* LOGIC_H_ */
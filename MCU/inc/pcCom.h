@@ -9,23 +9,50 @@
 #ifndef PCCOM_H_
 #define PCCOM_H_
 
+#include "capture.h"
+#include "probe.h"
+
 // Definition of union used to store different size of incoming data
 union payload_t {
-	char bytes[4];
+	char bytes[sizeof(struct acquisitionConfig)];
 	int dword;
+	struct acquisitionConfig config;
+	struct triggerConfig trigger;
+	struct adcTiming timing;
 };
 
 // Definition of enum representing states of transmission
 enum pcComStates {NEW_DATA, WAIT_FOR_PAYLOAD};
 
+// Number of complete commands USART interrupt can hold for main loop (one slot is always free)
+#define COMMAND_MAILBOX_SIZE	4
+
+// Measurements of communication sent after profiles of capture stages in response to GET_PROFILE:
+//		dispatch - core cycles from the last byte of command to its execution in main loop
+//		sleep - time (in microseconds) main loop has spent in WFI waiting for command - core cycles would
+//				overflow 32 bits after a minute of sleep
+enum pcComProfiles {PROFILE_DISPATCH, PROFILE_SLEEP, NUMBER_OF_PC_COM_PROFILES};
+
 // Definition of enum representing commands host can send
 enum pcComCommands {INVALID_COMMAND = -2, WAIT_FOR_DATA = -1, SET_TRIGGER = 0, SET_MODE,
 	PING, SET_SAMPLES, SET_PRECISION, IS_DATA_AVAIL, DOWNLOAD_DATA, TURN_OFF, TRIG_MODE,
-	TRIG_NOW};
+	TRIG_NOW, SET_SEGMENTS, DOWNLOAD_SEGMENTS, SET_ETS, SET_DECIMATION, GET_PROFILE,
+	SET_CONFIG, GET_CONFIG, DOWNLOAD_NEXT, SET_TRIGGER_CONFIG, GET_TRIGGER_CONFIG, GET_TIME,
+	SET_ADC_TIMING, NUMBER_OF_COMMANDS};
 
 // Definitions of functions
+void receiveByte(uint8_t);
 int processPcCom(void);
+void waitForCommand(void);
+void takePcComProfiles(struct stageProfile*);
 void sendAck(uint8_t);
-void sendProbes(int length, uint16_t* samples);
+void sendProbes(int length, const uint8_t* samples);
+void sendSegments(int count, int length, uint32_t* timestamps, const uint8_t* samples);
+void sendRuns(int count, const uint32_t* runs);
+void sendProfiles(int count, struct stageProfile* profiles);
+void sendConfig(const struct acquisitionConfig* config);
+void sendTriggerConfig(const struct triggerConfig* config);
+void sendTime(uint32_t now, uint32_t trigger);
+void sendAdcTiming(const struct adcTiming* timing);
 
 #endif /* PCCOM_H_ */
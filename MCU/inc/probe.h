@@ -9,21 +9,88 @@
 #ifndef PROBE_H_
 #define PROBE_H_
 
-// Maximum number of samples that could be taken
-#define MAX_NUMBER_OF_SAMPLES		4000
+#include <stdint.h>
+#include "adc.h"
+
+// Size (in bytes) of memory samples are stored in
+#define SAMPLES_MEMORY_SIZE			8000
+// Maximum number of 16-bit samples that could be taken (packed samples take less memory)
+#define MAX_NUMBER_OF_SAMPLES		(SAMPLES_MEMORY_SIZE / 2)
+// Maximum number of segments samples memory can be divided into
+#define MAX_NUMBER_OF_SEGMENTS		32
 
 // Enum representing various states of probing
 enum probbingStates {OFF, WAITING_FOR_TRIG, WORKING, FINISHED};
+// Enum representing probing modes - ADC reading of PC4 or snapshots of digital inputs PA0-PA7
+enum probingModes {PROBING_ANALOG, PROBING_DIGITAL};
+
+// Version of acquisitionConfig layout - has to be increased whenever layout changes
+#define CONFIG_VERSION				1
+
+// All acquisition parameters, exchanged with host by SET_CONFIG and GET_CONFIG commands
+struct __attribute__((packed)) acquisitionConfig {
+	uint8_t version;
+	uint8_t probingMode;
+	uint16_t triggerLevel;			// in millivolts
+	uint32_t frequency;				// of stored samples, sample clock is faster by decimation
+	uint16_t numberOfSamples;		// in each segment
+	uint8_t numberOfSegments;
+	uint8_t etsSteps;
+	uint8_t decimation;
+	uint8_t flags;					// CONFIG_* flags
+	uint8_t sampleWidth;			// bits of stored sample: 16, 12 or 8 (0 - 16)
+	uint8_t reserved[1];
+};
+
+// Capture is re-armed automatically into the second half of memory while the first one is downloaded
+#define CONFIG_AUTO_REARM			0x01
+
+// Conditions of trigger - level is crossed, pulse shorter or longer than limit, runt pulse which does not
+// reach upper level, pattern of digital inputs (logic analyser only)
+enum triggerTypes {TRIGGER_LEVEL, TRIGGER_PULSE, TRIGGER_RUNT, TRIGGER_PATTERN};
+
+// Trigger condition, exchanged with host by SET_TRIGGER_CONFIG and GET_TRIGGER_CONFIG commands
+struct __attribute__((packed)) triggerConfig {
+	uint8_t type;					// triggerTypes
+	uint8_t flags;					// TRIGGER_* flags
+	uint16_t upperLevel;			// in millivolts - upper level of runt trigger, the lower one is trigger level
+	uint32_t width;					// limit of pulse width in ticks of sample clock
+	uint8_t pattern;				// values of inputs of pattern trigger
+	uint8_t mask;					// inputs compared with pattern
+	uint8_t reserved[2];
+};
+
+// Pulse (or runt) is on the low side of trigger level instead of the high one
+#define TRIGGER_NEGATIVE			0x01
+// Pulse trigger fires on pulses longer than width limit instead of shorter ones
+#define TRIGGER_LONGER				0x02
 
 // Definitions of functions
 int setMaxNumberOfSamples(int);
+int setNumberOfSegments(int);
+int setEtsSteps(int);
+int setAveraging(int);
 int setProbingMode(int);
 int setTriggerLevel(int);
 int setFreq(uint32_t);
+int setAdcTiming(struct adcTiming*);
+int setConfig(const struct acquisitionConfig*);
+void getConfig(struct acquisitionConfig*);
+int setTriggerConfig(const struct triggerConfig*);
+void getTriggerConfig(struct triggerConfig*);
+uint8_t* getReadyCapture(int*);
+void releaseReadyCapture(void);
 void printState(void);
 int triggerNow(void);
 int setOff(void);
 int setTrigMode(void);
-void SysTick_Handler(void);
+uint32_t getTimestamp(void);
+uint32_t getTimestampWithIrqOff(void);
+void segmentTriggered(void);
+void segmentFilled(void);
+void logicTriggered(void);
+void logicFinished(void);
+void TIM2_IRQHandler(void);
+void EXTI9_5_IRQHandler(void);
 
 #endif /* PROBE_H_ */
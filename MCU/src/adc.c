@@ -0,0 +1,120 @@
+/*
+ * adc.c
+ * Module choosing timing of ADC - sample time and ADC clock
+ * 		ADC converts continuously and sample clock reads the last finished conversion. Longer sample time
+ * 		lets sample and hold capacitor settle from sources of higher impedance, but conversions have to keep
+ * 		up with sample clock, otherwise the same conversion is read several times.
+ */
+
+#include "stm32f10x.h"
+#include "../inc/adc.h"
+#include "../inc/capture.h"
+
+// Sample times in halves of ADC clock cycle, in order of ADC_SampleTime_* - conversion takes 12.5 cycles more
+static const uint16_t sampleHalfCycles[NUMBER_OF_SAMPLE_TIMES] = {3, 15, 27, 57, 83, 111, 143, 479};
+// Dividers of PCLK2 available for ADC clock and their RCC_PCLK2_Div* values
+#define NUMBER_OF_PRESCALERS		4
+static const uint8_t prescalers[NUMBER_OF_PRESCALERS] = {2, 4, 6, 8};
+static const uint32_t prescalerConfigs[NUMBER_OF_PRESCALERS] = {RCC_PCLK2_Div2, RCC_PCLK2_Div4, RCC_PCLK2_Div6,
+		RCC_PCLK2_Div8};
+
+// Timing currently applied to ADC (index of prescaler), -1 before the first one
+static int currentSampleTime = -1;
+static int currentPrescaler = -1;
+
+static uint32_t adcClock(int prescaler) {
+	RCC_ClocksTypeDef clocks;
+	RCC_GetClocksFreq(&clocks);
+	return clocks.PCLK2_Frequency / prescalers[prescaler];
+}
+
+// Returns number of conversions per second with provided timing
+static uint32_t conversionRate(int sampleTime, int prescaler) {
+	return adcClock(prescaler) * 2 / (sampleHalfCycles[sampleTime] + 25);
+}
+
+// Checks if sample and hold capacitor settles to 1/4 LSB from source of provided impedance within sample time
+static int settles(int sampleTime, int prescaler, uint32_t impedance) {
+	// Sample time in 1/100 ps is half cycles * 5 * 10^13 / ADC clock
+	return (uint64_t)sampleHalfCycles[sampleTime] * 50000000000000ULL >=
+			(uint64_t)(impedance + ADC_RESISTANCE) * ADC_SETTLING_PER_OHM * adcClock(prescaler);
+}
+
+// Choose timing for impedance and sample clock of provided structure - the longest sample time whose conversions
+// are ADC_RATE_MARGIN times faster than sample clock, or the fastest timing if none of them is. Timing has to let
+// source of given impedance settle, the highest sample clock for which such timing exists (at most MAX_SAMPLE_CLOCK)
+// is written to maxFrequency (0 if impedance is too high)
+void chooseAdcTiming(struct adcTiming* timing) {
+	int best = -1, fastest = -1;
+	uint32_t bestDuration = 0, maxRate = 0;
+
+	timing->maxFrequency = 0;
+	if(timing->impedance > MAX_SOURCE_IMPEDANCE)
+		return;
+	for(int prescaler = 0; prescaler < NUMBER_OF_PRESCALERS; prescaler++) {
+		if(adcClock(prescaler) > MAX_ADC_CLOCK)
+			continue;
+		for(int sampleTime = 0; sampleTime < NUMBER_OF_SAMPLE_TIMES; sampleTime++) {
+			if(!settles(sampleTime, prescaler, timing->impedance))
+				continue;
+			uint32_t rate = conversionRate(sampleTime, prescaler);
+			// Duration in halves of PCLK2 cycle - comparable between prescalers
+			uint32_t duration = sampleHalfCycles[sampleTime] * prescalers[prescaler];
+			if(rate > maxRate) {
+				maxRate = rate;
+				fastest = prescaler * NUMBER_OF_SAMPLE_TIMES + sampleTime;
+			}
+			if(rate >= (uint64_t)timing->frequency * ADC_RATE_MARGIN && duration > bestDuration) {
+				bestDuration = duration;
+				best = prescaler * NUMBER_OF_SAMPLE_TIMES + sampleTime;
+			}
+		}
+	}
+	if(best < 0)
+		best = fastest;
+	if(best < 0)
+		return;
+	timing->sampleTime = best % NUMBER_OF_SAMPLE_TIMES;
+	timing->prescaler = prescalers[best / NUMBER_OF_SAMPLE_TIMES];
+	timing->maxFrequency = maxRate / ADC_RATE_MARGIN;
+	if(timing->maxFrequency > MAX_SAMPLE_CLOCK)
+		timing->maxFrequency = MAX_SAMPLE_CLOCK;
+}
+
+// Apply timing chosen by chooseAdcTiming. ADC is stopped for the time of change and calibrated again,
+// as calibration depends on ADC clock - nothing is done if timing has not changed
+void applyAdcTiming(const struct adcTiming* timing) {
+	int prescaler = 0;
+	while(prescaler < NUMBER_OF_PRESCALERS - 1 && prescalers[prescaler] != timing->prescaler)
+		prescaler++;
+	if(timing->maxFrequency == 0 || (timing->sampleTime == currentSampleTime && prescaler == currentPrescaler))
+		return;
+
+	ADC_Cmd(ADC1, DISABLE);
+	RCC_ADCCLKConfig(prescalerConfigs[prescaler]);
+	// Select 14th ADC channel (PC4) with chosen sample time
+	ADC_RegularChannelConfig(ADC1, ADC_Channel_14, 1, timing->sampleTime);
+	ADC_Cmd(ADC1, ENABLE);
+
+	ADC_ResetCalibration(ADC1);
+	// Wait till ADC reset its calibration
+	while (ADC_GetResetCalibrationStatus(ADC1))
+		;
+
+	ADC_StartCalibration(ADC1);
+	// Wait till ADC finish its calibration
+	while (ADC_GetCalibrationStatus(ADC1))
+		;
+
+	// Start ADC conversion
+	ADC_SoftwareStartConvCmd(ADC1, ENABLE);
+	currentSampleTime = timing->sampleTime;
+	currentPrescaler = prescaler;
+}
+
+// Apply the fastest timing (for source of low impedance), as no sample clock has been set yet
+void initAdc(void) {
+	struct adcTiming timing = {.frequency = 0xFFFFFFFF, .impedance = 0};
+	chooseAdcTiming(&timing);
+	applyAdcTiming(&timing);
+}
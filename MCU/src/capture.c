@@ -0,0 +1,318 @@
+/*
+ * capture.c
+ * Module providing path of samples from ADC to memory
+ * 		On every tick of sample clock SysTick_Handler runs one routine (stage) chosen when probing
+ * 		state or configuration changes, so no checks of state and mode are done for each sample.
+ * 		Stages are chained: trigger stage passes sample which fired it to store stage, averaging
+ * 		stages (decimators) pass every n-th accumulated value to store stage.
+ * 		Store stage writes samples in format selected by sample width - 16-bit, packed 12-bit or 8-bit.
+ */
+
+#include "stm32f10x.h"
+#include "../inc/capture.h"
+#include "../inc/probe.h"
+
+// Routine run on every tick of sample clock with fresh ADC reading
+typedef void (*captureStage_t)(uint16_t sample);
+// Routine writing sample at position currentNumberOfSamples of current segment
+typedef void (*sampleWriter_t)(uint16_t sample);
+
+// Variables of probe.c describing segment being filled
+extern uint16_t currentNumberOfSamples;
+extern int maxNumberOfSamples;
+extern uint8_t* segment;
+extern int triggerLevel;
+
+// Stage currently run by SysTick_Handler
+static captureStage_t stage;
+static uint8_t currentStage = STAGE_IDLE;
+// Stage storing samples after trigger - depends on decimation
+static uint8_t storeStage = STAGE_STORE;
+// Number of ADC readings averaged into one sample
+static int decimation = 1;
+// State of averaging stages
+static uint32_t accumulator = 0;
+static uint32_t accumulated = 0;
+// Measured cost of each stage
+static struct stageProfile profiles[NUMBER_OF_STAGES];
+
+// Stage waiting for trigger and parameters of its condition (in ADC units and ticks of sample clock)
+static uint8_t triggerStage = STAGE_LEVEL_TRIGGER;
+static uint8_t triggerNegative = 0;
+static uint8_t triggerLonger = 0;
+static uint16_t upperLevel = ADC_MAX;
+static uint32_t pulseLimit = 1;
+// State of pulse trigger - length of current pulse, set once signal has been seen outside of pulse
+static uint32_t pulseLength = 0;
+static uint32_t pulseArmed = 0;
+// Phases of runt trigger - signal is below lower level, between levels or has reached upper level
+enum runtPhases {RUNT_LOW, RUNT_MIDDLE, RUNT_FULL};
+// State of runt trigger - levels are swapped and readings inverted for negative runt
+static uint8_t runtPhase = RUNT_FULL;
+static uint16_t runtInvert = 0;
+static uint16_t runtLower = 0;
+static uint16_t runtUpper = ADC_MAX;
+
+// Stored samples are 16-bit words
+static void write16(uint16_t sample) {
+	((uint16_t*)segment)[currentNumberOfSamples] = sample;
+}
+
+// Two 12-bit samples a, b are packed in 3 bytes: a[7:0], b[3:0] a[11:8], b[11:4]
+static void write12(uint16_t sample) {
+	uint8_t* pair = segment + currentNumberOfSamples + (currentNumberOfSamples >> 1);
+	if(currentNumberOfSamples & 1) {
+		pair[0] |= sample << 4;
+		pair[1] = sample >> 4;
+	} else {
+		pair[0] = sample;
+		pair[1] = sample >> 8;
+	}
+}
+
+// Only 8 most significant bits of reading are stored
+static void write8(uint16_t sample) {
+	segment[currentNumberOfSamples] = sample >> 4;
+}
+
+// Format of stored samples - chosen together with sample width, not checked for each sample
+static sampleWriter_t writeSample = write16;
+static int sampleWidth = SAMPLE_WIDTH_16;
+
+// Stage used when samples are not taken
+static void idle(uint16_t sample) {
+	(void)sample;
+}
+
+// Stores sample in current segment or reports that segment is full
+static inline void store(uint16_t sample) {
+	if(currentNumberOfSamples < maxNumberOfSamples) {
+		writeSample(sample);
+		currentNumberOfSamples++;
+	} else
+		segmentFilled();
+}
+
+// Waits until signal falls to trigger level, sample which fired trigger is the first one stored
+static void levelTrigger(uint16_t sample) {
+	if(sample <= triggerLevel) {
+		segmentTriggered();
+		stage(sample);
+	}
+}
+
+// Waits for pulse on the high (or low, if negative) side of trigger level, which is shorter (or longer) than limit.
+// Pulse in progress when trigger was armed is not measured. Sample ending the pulse is the first one stored
+static void pulseTrigger(uint16_t sample) {
+	if((sample > triggerLevel) != triggerNegative) {
+		pulseLength += pulseArmed;
+		return;
+	}
+	if(pulseLength != 0 && (triggerLonger ? pulseLength > pulseLimit : pulseLength < pulseLimit)) {
+		segmentTriggered();
+		stage(sample);
+		return;
+	}
+	pulseArmed = 1;
+	pulseLength = 0;
+}
+
+// Waits for pulse which crosses lower level, but returns below it without reaching upper level.
+// Sample which returns below lower level is the first one stored
+static void runtTrigger(uint16_t sample) {
+	uint16_t value = sample ^ runtInvert;
+	if(value > runtUpper)
+		runtPhase = RUNT_FULL;
+	else if(value > runtLower) {
+		if(runtPhase == RUNT_LOW)
+			runtPhase = RUNT_MIDDLE;
+	} else if(runtPhase == RUNT_MIDDLE) {
+		segmentTriggered();
+		stage(sample);
+	} else
+		runtPhase = RUNT_LOW;
+}
+
+// Definition of stage averaging 2^SHIFT readings into one sample
+#define DEFINE_AVERAGING_STAGE(name, SHIFT)					\
+	static void name(uint16_t sample) {						\
+		accumulator += sample;								\
+		if(++accumulated < (1u << (SHIFT)))					\
+			return;											\
+		store(accumulator >> (SHIFT));						\
+		accumulator = 0;									\
+		accumulated = 0;									\
+	}
+
+DEFINE_AVERAGING_STAGE(average2, 1)
+DEFINE_AVERAGING_STAGE(average4, 2)
+DEFINE_AVERAGING_STAGE(average8, 3)
+DEFINE_AVERAGING_STAGE(average16, 4)
+
+static void storeOnly(uint16_t sample) {
+	store(sample);
+}
+
+static const captureStage_t stages[NUMBER_OF_STAGES] = {
+	[STAGE_IDLE] = idle, [STAGE_LEVEL_TRIGGER] = levelTrigger, [STAGE_PULSE_TRIGGER] = pulseTrigger,
+	[STAGE_RUNT_TRIGGER] = runtTrigger, [STAGE_STORE] = storeOnly,
+	[STAGE_AVERAGE_2] = average2, [STAGE_AVERAGE_4] = average4, [STAGE_AVERAGE_8] = average8,
+	[STAGE_AVERAGE_16] = average16
+};
+
+static void selectStage(uint8_t no) {
+	currentStage = no;
+	stage = stages[no];
+}
+
+// Enables DWT cycle counter used to profile stages
+void initCapture(void) {
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	selectStage(STAGE_IDLE);
+}
+
+// Stop taking samples
+void captureIdle(void) {
+	selectStage(STAGE_IDLE);
+}
+
+// Check every sample with selected trigger condition
+void captureWaitForTrigger(void) {
+	pulseLength = 0;
+	pulseArmed = 0;
+	// Pulse which has already reached upper level when trigger was armed is not a runt
+	runtPhase = RUNT_FULL;
+	// Negative runt is detected as positive one in inverted readings
+	runtInvert = triggerNegative ? ADC_MAX : 0;
+	runtLower = triggerNegative ? ADC_MAX - upperLevel : triggerLevel;
+	runtUpper = triggerNegative ? ADC_MAX - triggerLevel : upperLevel;
+	selectStage(triggerStage);
+}
+
+// Start storing samples into current segment
+void captureStart(void) {
+	accumulator = 0;
+	accumulated = 0;
+	selectStage(storeStage);
+}
+
+// Select condition checked while waiting for trigger - upper level of runt trigger in ADC units,
+// width limit of pulse trigger in ticks of sample clock. Condition takes effect when trigger is armed
+//		Returns: 0 on success, 2 if samples are being stored
+int setTriggerCondition(int type, int flags, uint16_t upper, uint32_t width) {
+	if(currentStage >= STAGE_STORE)
+		return 2;
+
+	if(type == TRIGGER_PULSE)
+		triggerStage = STAGE_PULSE_TRIGGER;
+	else if(type == TRIGGER_RUNT)
+		triggerStage = STAGE_RUNT_TRIGGER;
+	else
+		triggerStage = STAGE_LEVEL_TRIGGER;
+	triggerNegative = (flags & TRIGGER_NEGATIVE) != 0;
+	triggerLonger = (flags & TRIGGER_LONGER) != 0;
+	upperLevel = upper;
+	pulseLimit = width;
+	return 0;
+}
+
+// Returns log2 of number of averaged readings
+static int decimationShift(int no) {
+	int shift = 0;
+	while((1 << shift) < no && (1 << shift) < MAX_DECIMATION)
+		shift++;
+	return shift;
+}
+
+// Checks if number of averaged readings is power of 2 up to MAX_DECIMATION
+int isValidDecimation(int no) {
+	return no == (1 << decimationShift(no));
+}
+
+// Set number of ADC readings averaged into one sample - sample clock has to be faster by the same factor
+//		Returns: 0 on success, 1 if value is not power of 2 up to MAX_DECIMATION, 2 if samples are being stored
+int setDecimation(int no) {
+	if(currentStage >= STAGE_STORE)
+		return 2;
+	if(!isValidDecimation(no))
+		return 1;
+
+	decimation = no;
+	storeStage = STAGE_STORE + decimationShift(no);
+	return 0;
+}
+
+int getDecimation(void) {
+	return decimation;
+}
+
+int isValidSampleWidth(int width) {
+	return width == SAMPLE_WIDTH_16 || width == SAMPLE_WIDTH_12 || width == SAMPLE_WIDTH_8;
+}
+
+// Set number of bits of stored sample - narrower samples allow longer captures in the same memory
+//		Returns: 0 on success, 1 if width is not supported, 2 if samples are being stored
+int setSampleWidth(int width) {
+	if(currentStage >= STAGE_STORE)
+		return 2;
+	if(!isValidSampleWidth(width))
+		return 1;
+
+	sampleWidth = width;
+	writeSample = (width == SAMPLE_WIDTH_12) ? write12 : (width == SAMPLE_WIDTH_8) ? write8 : write16;
+	return 0;
+}
+
+int getSampleWidth(void) {
+	return sampleWidth;
+}
+
+// Returns number of bytes occupied by provided number of samples of provided width
+uint32_t samplesSize(int count, int width) {
+	if(width == SAMPLE_WIDTH_12)
+		return ((count + 1) / 2) * 3;
+	return count * (width / 8);
+}
+
+// Returns 12-bit reading stored at provided position of buffer in current format
+uint16_t loadSample(const uint8_t* buffer, int no) {
+	const uint8_t* pair;
+	switch(sampleWidth) {
+	case SAMPLE_WIDTH_12:
+		pair = buffer + no + (no >> 1);
+		return (no & 1) ? (pair[0] >> 4) | (pair[1] << 4) : pair[0] | ((pair[1] & 0x0f) << 8);
+	case SAMPLE_WIDTH_8:
+		return buffer[no] << 4;
+	default:
+		return ((const uint16_t*)buffer)[no];
+	}
+}
+
+// Copies profiles of all stages to provided array and starts new measurement
+void takeProfiles(struct stageProfile* out) {
+	__disable_irq();
+	for(int i = 0; i < NUMBER_OF_STAGES; i++) {
+		out[i] = profiles[i];
+		profiles[i].calls = profiles[i].cycles = profiles[i].maxCycles = 0;
+	}
+	__enable_irq();
+}
+
+// Hander for SysTick interrupt
+void SysTick_Handler(void) {
+#if CAPTURE_PROFILING
+	uint8_t no = currentStage;
+	uint32_t start = DWT->CYCCNT;
+	stage(ADC_GetConversionValue(ADC1));
+	uint32_t cycles = DWT->CYCCNT - start;
+
+	profiles[no].calls++;
+	profiles[no].cycles += cycles;
+	if(cycles > profiles[no].maxCycles)
+		profiles[no].maxCycles = cycles;
+#else
+	stage(ADC_GetConversionValue(ADC1));
+#endif
+}
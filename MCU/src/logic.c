@@ -0,0 +1,170 @@
+/*
+ * logic.c
+ * Module providing logic analyser - digital inputs sampled together as snapshots of port
+ * 		TIM3 update requests DMA1 channel 3 transfer of GPIOA->IDR into circular ring, so no CPU time
+ * 		is spent per snapshot. When half of ring is full, interrupt encodes it into runs of
+ * 		(value, length) - lines which do not change take one run regardless of duration of capture.
+ */
+
+#include "stm32f10x.h"
+#include "../inc/logic.h"
+#include "../inc/probe.h"
+
+// Circular buffer filled by DMA - aligned, so halves can be compared word by word
+uint8_t logicRing[LOGIC_RING_SIZE] __attribute__((aligned(4)));
+
+// Memory runs are written to and its capacity
+static uint32_t* runs;
+static int maxRuns = 0;
+// Number of runs already written
+static volatile int numberOfRuns = 0;
+// Number of snapshots left to the end of capture
+static uint32_t remaining = 0;
+// Value of port in current run and number of snapshots it has lasted for so far
+static uint8_t current = 0;
+static uint32_t runLength = 0;
+// Set while waiting for trigger - capture starts with snapshot before the one which fired it
+static int waiting = 0;
+// Inputs compared with pattern of trigger - if none, any change of inputs fires trigger
+static uint8_t patternMask = 0;
+static uint8_t patternValue = 0;
+// Set while capture is in progress
+static volatile int running = 0;
+
+// Checks if snapshots of port can be taken every provided number of core cycles
+int isValidLogicPeriod(uint32_t cycles) {
+	return cycles >= SystemCoreClock / MAX_LOGIC_FREQ && cycles <= 0x10000;
+}
+
+// Set number of core cycles between snapshots of port
+void setLogicPeriod(uint32_t cycles) {
+	TIM_SetAutoreload(TIM3, cycles - 1);
+}
+
+// Set pattern of inputs which fires trigger when it appears, mask 0 - any change fires it
+void setLogicPattern(uint8_t pattern, uint8_t mask) {
+	patternValue = pattern & mask;
+	patternMask = mask;
+}
+
+// Checks if snapshot of port matches pattern of trigger
+static inline int matchesPattern(uint8_t value) {
+	return (value & patternMask) == patternValue;
+}
+
+// Close current run (if it is not empty) and start a new one with provided value
+static void emitRun(uint8_t value) {
+	if(runLength > 0)
+		runs[numberOfRuns++] = (runLength << 8) | current;
+	current = value;
+	runLength = 0;
+}
+
+// Checks if all snapshots in block are equal to provided value
+static int isUniform(const uint8_t* block, int count, uint8_t value) {
+	const uint32_t* words = (const uint32_t*)block;
+	uint32_t pattern = value * 0x01010101u;
+	for(int i = 0; i < count / 4; i++)
+		if(words[i] != pattern)
+			return 0;
+	return 1;
+}
+
+// Close the last run and end capture
+static void finishCapture(uint8_t value) {
+	emitRun(value);
+	logicStop();
+	logicFinished();
+}
+
+// Encode block of snapshots into runs
+static void encode(const uint8_t* block, int count) {
+	// Idle lines - whole block extends current run (or does not fire trigger, as nothing changes)
+	if(isUniform(block, count, current)) {
+		if(waiting)
+			return;
+		if(remaining > (uint32_t)count && runLength + count <= MAX_RUN_LENGTH) {
+			runLength += count;
+			remaining -= count;
+			return;
+		}
+	}
+
+	for(int i = 0; i < count; i++) {
+		uint8_t value = block[i];
+		if(waiting) {
+			if(patternMask ? !matchesPattern(value) || matchesPattern(current) : value == current) {
+				current = value;
+				continue;
+			}
+			// Trigger - snapshot before change is the first run of capture and counts to its length
+			waiting = 0;
+			logicTriggered();
+			runLength = 1;
+			if(--remaining == 0) {
+				finishCapture(value);
+				return;
+			}
+		}
+
+		if(value != current || runLength == MAX_RUN_LENGTH)
+			emitRun(value);
+		runLength++;
+
+		// The last slot is kept for run in progress
+		if(--remaining == 0 || numberOfRuns == maxRuns - 1) {
+			finishCapture(value);
+			return;
+		}
+	}
+}
+
+// Start capture of provided number of snapshots into runs
+//		If immediately is not set, capture is started by appearance of trigger pattern (any change without one)
+void logicStart(uint32_t* memory, int capacity, uint32_t length, int immediately) {
+	logicStop();
+	runs = memory;
+	maxRuns = capacity;
+	numberOfRuns = 0;
+	remaining = length;
+	runLength = 0;
+	current = GPIO_ReadInputData(GPIOA);
+	waiting = !immediately;
+	if(length == 0) {
+		logicFinished();
+		return;
+	}
+
+	DMA_ClearITPendingBit(DMA1_IT_GL3);
+	DMA_SetCurrDataCounter(DMA1_Channel3, LOGIC_RING_SIZE);
+	DMA_Cmd(DMA1_Channel3, ENABLE);
+	TIM_SetCounter(TIM3, 0);
+	running = 1;
+	TIM_Cmd(TIM3, ENABLE);
+}
+
+// Stop taking snapshots
+void logicStop(void) {
+	TIM_Cmd(TIM3, DISABLE);
+	DMA_Cmd(DMA1_Channel3, DISABLE);
+	running = 0;
+}
+
+// Returns number of runs of finished capture
+int getLogicRuns(void) {
+	return numberOfRuns;
+}
+
+// Handler for DMA1 channel 3 interrupt - half of ring has been filled
+void DMA1_Channel3_IRQHandler(void) {
+	if(DMA_GetITStatus(DMA1_IT_HT3) != RESET) {
+		DMA_ClearITPendingBit(DMA1_IT_HT3);
+		if(running)
+			encode(logicRing, LOGIC_RING_SIZE / 2);
+	}
+	if(DMA_GetITStatus(DMA1_IT_TC3) != RESET) {
+		DMA_ClearITPendingBit(DMA1_IT_TC3);
+		if(running)
+			encode(logicRing + LOGIC_RING_SIZE / 2, LOGIC_RING_SIZE / 2);
+	}
+}
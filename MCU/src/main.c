@@ -9,6 +9,8 @@
 #include "../inc/pcCom.h"
 #include "../inc/queue.h"
 #include "../inc/probe.h"
+#include "../inc/capture.h"
+#include "../inc/logic.h"
 
 // Local functions definitions
 void ConfigRCC(void);
@@ -16,18 +18,29 @@ void ConfigNVIC(void);
 void ConfigGPIO(void);
 void ConfigADC(void);
 void ConfigUSART(void);
+void ConfigTIM(void);
+void ConfigEXTI(void);
+void ConfigDMA(void);
 void USART1_IRQHandler(void);
+int sendReadyCapture(void);
 
 // Global variable (GV) holding payload of host message
 extern union payload_t payload;
 // GV holding number of samples already taken
 extern uint16_t currentNumberOfSamples;
 // Global array contatining samples
-extern uint16_t samples[];
+extern uint8_t samples[];
 // GV containing information about current probing state
 extern uint8_t state;
-// Global queues used in USART transmission
-extern Queue rxQueue, txQueue;
+// GV containing current probing mode
+extern int probingMode;
+// Circular buffer port snapshots of logic analyser are written to
+extern uint8_t logicRing[];
+// GVs describing segmented capture
+extern int numberOfSegments, maxNumberOfSamples;
+extern uint32_t segmentTimestamps[];
+// Global queue used in USART transmission
+extern Queue txQueue;
 
 int main(void) {
 	ConfigRCC();
@@ -35,6 +48,10 @@ int main(void) {
 	ConfigGPIO();
 	ConfigADC();
 	ConfigUSART();
+	ConfigTIM();
+	ConfigEXTI();
+	ConfigDMA();
+	initCapture();
 
 	if (SysTick_Config(SystemCoreClock / 1000))   // Every millisecond
 		while (1)
@@ -48,12 +65,11 @@ int main(void) {
 	HD44780_Puts(0, 0, "  STM32  Oscil\0");
 	HD44780_Puts(2, 1, "PC <-X-> Dev.\0");
 
-	clearQueue(&rxQueue);
 	clearQueue(&txQueue);
 
 	// Wait for connection
 	while (processPcCom() != PING)
-		;
+		waitForCommand();
 	sendAck(0);
 
 	// Display that we are connected, delay ~1s and print current state
@@ -83,18 +99,87 @@ int main(void) {
 		case TRIG_NOW:
 			sendAck(triggerNow());
 			break;
-		case IS_DATA_AVAIL:
-			sendAck(state == FINISHED);
+		case IS_DATA_AVAIL: {
+			int length;
+			sendAck(state == FINISHED || getReadyCapture(&length) != 0);
 			break;
+		}
 		case DOWNLOAD_DATA:
+			if (sendReadyCapture())
+				break;
 			if (state == FINISHED) {		// Check if data is ready
 				sendAck(0);
-				sendProbes(currentNumberOfSamples, samples);
+				if (probingMode == PROBING_DIGITAL)
+					sendRuns(getLogicRuns(), (uint32_t*) samples);
+				else
+					sendProbes(currentNumberOfSamples, samples);
 			} else if (state == WORKING)
 				sendAck(2);
 			else
 				sendAck(1);
 			break;
+		case DOWNLOAD_NEXT:
+			if (!sendReadyCapture())
+				sendAck(1);
+			break;
+		case SET_SEGMENTS:
+			sendAck(setNumberOfSegments(payload.dword));
+			break;
+		case SET_ETS:
+			sendAck(setEtsSteps(payload.dword));
+			break;
+		case SET_DECIMATION:
+			sendAck(setAveraging(payload.dword));
+			break;
+		case SET_CONFIG:
+			sendAck(setConfig(&payload.config));
+			break;
+		case GET_CONFIG: {
+			struct acquisitionConfig config;
+			getConfig(&config);
+			sendAck(0);
+			sendConfig(&config);
+			break;
+		}
+		case SET_TRIGGER_CONFIG:
+			sendAck(setTriggerConfig(&payload.trigger));
+			break;
+		case GET_TRIGGER_CONFIG: {
+			struct triggerConfig trigger;
+			getTriggerConfig(&trigger);
+			sendAck(0);
+			sendTriggerConfig(&trigger);
+			break;
+		}
+		case GET_TIME:
+			sendAck(0);
+			sendTime(getTimestamp(), segmentTimestamps[0]);
+			break;
+		case SET_ADC_TIMING: {
+			struct adcTiming timing = payload.timing;
+			int status = setAdcTiming(&timing);
+			sendAck(status);
+			if(status == 0)
+				sendAdcTiming(&timing);
+			break;
+		}
+		case GET_PROFILE: {
+			struct stageProfile profiles[NUMBER_OF_STAGES + NUMBER_OF_PC_COM_PROFILES];
+			takeProfiles(profiles);
+			takePcComProfiles(profiles + NUMBER_OF_STAGES);
+			sendAck(0);
+			sendProfiles(NUMBER_OF_STAGES + NUMBER_OF_PC_COM_PROFILES, profiles);
+			break;
+		}
+		case DOWNLOAD_SEGMENTS:
+			if (state == FINISHED) {		// Check if all segments are filled
+				sendAck(0);
+				sendSegments(numberOfSegments, maxNumberOfSamples, segmentTimestamps, samples);
+			} else if (state == WORKING || state == WAITING_FOR_TRIG)
+				sendAck(2);
+			else
+				sendAck(1);
+			break;
 		case TURN_OFF:
 			sendAck(setOff());
 			break;
@@ -105,7 +190,8 @@ int main(void) {
 			sendAck(setFreq(SystemCoreClock / payload.dword));
 			break;
 		case WAIT_FOR_DATA:
-			// Patiently wait for valid command
+			// Sleep until interrupt - USART one posts complete commands
+			waitForCommand();
 			continue;
 			break;
 		case INVALID_COMMAND:
@@ -118,19 +204,34 @@ int main(void) {
 	}
 }
 
+// Send capture of auto re-arm mode - the next one is taken while this one is being sent
+//		Returns: 1 if capture has been sent, 0 if there was none
+int sendReadyCapture(void) {
+	int length;
+	uint8_t* ready = getReadyCapture(&length);
+	if (ready == 0)
+		return 0;
+
+	sendAck(0);
+	sendProbes(length, ready);
+	releaseReadyCapture();
+	return 1;
+}
+
 void ConfigRCC(void) {
 	// Clock configuration is done by System_Init() function.
 	// We only need to configure our peripherals
 
-	// Set ADC clock line to 13MHz
-	RCC_ADCCLKConfig(RCC_PCLK2_Div6);
-
 	// Enable clock on peripherals
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_ADC1, ENABLE);
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOA, ENABLE);
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOB, ENABLE);
 	RCC_APB2PeriphClockCmd(RCC_APB2Periph_GPIOC, ENABLE);
+	RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO, ENABLE);
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
+	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE);
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
 }
 
 void ConfigNVIC(void) {
@@ -145,6 +246,27 @@ void ConfigNVIC(void) {
 	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
 	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
 	NVIC_Init(&NVIC_InitStructure);
+
+	// Configure TIM2 interrupt - it has to preempt SysTick, which reads timestamps
+	NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
+	NVIC_Init(&NVIC_InitStructure);
+
+	// Configure EXTI5 interrupt - trigger of equivalent-time sampling, has to preempt SysTick as well
+	NVIC_InitStructure.NVIC_IRQChannel = EXTI9_5_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 2;
+	NVIC_Init(&NVIC_InitStructure);
+
+	// Configure DMA1 channel 3 interrupt - encoding of snapshots of logic analyser
+	NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel3_IRQn;
+	NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+	NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+	NVIC_InitStructure.NVIC_IRQChannelSubPriority = 3;
+	NVIC_Init(&NVIC_InitStructure);
 }
 
 void ConfigGPIO(void) {
@@ -156,6 +278,16 @@ void ConfigGPIO(void) {
 	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_AIN;
 	GPIO_Init(GPIOC, &GPIO_InitStructure);
 
+	// PC5 - trigger input of equivalent-time sampling, connected to the same signal as PC4 (floating input)
+	GPIO_InitStructure.GPIO_Pin = GPIO_Pin_5;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+	GPIO_Init(GPIOC, &GPIO_InitStructure);
+
+	// PA0-7 - digital inputs of logic analyser (floating input)
+	GPIO_InitStructure.GPIO_Pin = 0x00FF;
+	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING;
+	GPIO_Init(GPIOA, &GPIO_InitStructure);
+
 	// PB8-15 - LED1-8
 	GPIO_InitStructure.GPIO_Pin = 0xFF00;
 	GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_PP;
@@ -185,22 +317,9 @@ void ConfigADC(void) {
 
 	// Init ADC
 	ADC_Init(ADC1, &ADC_InitStructure);
-	// Select 14th ADC channel and set sample time to 1.5 cycle
-	ADC_RegularChannelConfig(ADC1, ADC_Channel_14, 1, ADC_SampleTime_1Cycles5);
-	ADC_Cmd(ADC1, ENABLE);
-
-	ADC_ResetCalibration(ADC1);
-	// Wait till ADC reset its calibration
-	while (ADC_GetResetCalibrationStatus(ADC1))
-		;
-
-	ADC_StartCalibration(ADC1);
-	// Wait till ADC finish its calibration
-	while (ADC_GetCalibrationStatus(ADC1))
-		;
-
-	// Start ADC convertsion
-	ADC_SoftwareStartConvCmd(ADC1, ENABLE);
+	// Select 14th ADC channel with the shortest sample time and set ADC clock, calibrate ADC and start conversions.
+	// Timing is chosen again (and ADC calibrated) for each sample clock - see adc.c
+	initAdc();
 }
 
 void ConfigUSART(void) {
@@ -222,13 +341,70 @@ void ConfigUSART(void) {
 	USART_Cmd(USART1, ENABLE);
 }
 
+void ConfigTIM(void) {
+	TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+
+	// TIM2 counts microseconds for timestamps of segments, its overflows are counted in interrupt
+	TIM_TimeBaseStructure.TIM_Prescaler = SystemCoreClock / 1000000 - 1;
+	TIM_TimeBaseStructure.TIM_Period = 0xFFFF;
+	TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+	TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+	TIM_TimeBaseStructure.TIM_RepetitionCounter = 0;
+	TIM_TimeBaseInit(TIM2, &TIM_TimeBaseStructure);
+
+	// Enable interrupt on overflow and start counting
+	TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+	TIM_Cmd(TIM2, ENABLE);
+
+	// TIM3 is sample clock of logic analyser - its update requests DMA snapshot of port.
+	// Period is set by probe.c, timer is started only for duration of capture
+	TIM_TimeBaseStructure.TIM_Prescaler = 0;
+	TIM_TimeBaseStructure.TIM_Period = SystemCoreClock / 1000 - 1;
+	TIM_TimeBaseInit(TIM3, &TIM_TimeBaseStructure);
+	TIM_DMACmd(TIM3, TIM_DMA_Update, ENABLE);
+}
+
+void ConfigEXTI(void) {
+	EXTI_InitTypeDef EXTI_InitStructure;
+
+	// Falling edge on PC5 triggers equivalent-time sampling
+	GPIO_EXTILineConfig(GPIO_PortSourceGPIOC, GPIO_PinSource5);
+	EXTI_InitStructure.EXTI_Line = EXTI_Line5;
+	EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+	EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Falling;
+	EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+	EXTI_Init(&EXTI_InitStructure);
+	// Line stays masked until probe.c arms trigger
+	EXTI->IMR &= ~EXTI_Line5;
+}
+
+void ConfigDMA(void) {
+	DMA_InitTypeDef DMA_InitStructure;
+
+	// DMA1 channel 3 (TIM3 update) copies low byte of GPIOA->IDR into circular ring
+	DMA_DeInit(DMA1_Channel3);
+	DMA_InitStructure.DMA_PeripheralBaseAddr = (uint32_t) &GPIOA->IDR;
+	DMA_InitStructure.DMA_MemoryBaseAddr = (uint32_t) logicRing;
+	DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+	DMA_InitStructure.DMA_BufferSize = LOGIC_RING_SIZE;
+	DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+	DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+	DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+	DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+	DMA_InitStructure.DMA_Mode = DMA_Mode_Circular;
+	DMA_InitStructure.DMA_Priority = DMA_Priority_VeryHigh;
+	DMA_InitStructure.DMA_M2M = DMA_M2M_Disable;
+	DMA_Init(DMA1_Channel3, &DMA_InitStructure);
+
+	// Interrupt when each half of ring is full - channel is enabled by logic.c
+	DMA_ITConfig(DMA1_Channel3, DMA_IT_HT | DMA_IT_TC, ENABLE);
+}
+
 // USART1 interrupt handler
 void USART1_IRQHandler(void) {
 	if (USART_GetITStatus(USART1, USART_IT_RXNE) != RESET) {
-		// There is new data in receive buffer - push it to queue
-		if (pushToQueue(&rxQueue, USART_ReceiveData(USART1)) != QUEUE_SUCCESS) {
-			// Handle error
-		}
+		// There is new data in receive buffer - add it to command being assembled
+		receiveByte(USART_ReceiveData(USART1));
 	}
 	if (USART_GetITStatus(USART1, USART_IT_TXE) != RESET) {
 		// USART is ready to send next byte
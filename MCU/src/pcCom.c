@@ -13,57 +13,134 @@
 // Current state of communication
 enum pcComStates pcComCurrentState = NEW_DATA;
 // Access global variables declared in queue.c
-extern Queue txQueue, rxQueue;
+extern Queue txQueue;
 
 union payload_t payload;
 
-// Get message from host
-//		Returns: command represented as in pcComCommands enum
-//				 including: WAIT_FOR_DATA - we are still waiting for payload
-//							INVALID_COMMAND - host sent unknown command code
-int processPcCom(void) {
-	unsigned char data;
+// Command assembled by USART interrupt
+struct command {
+	int code;
+	uint32_t received;				// value of DWT cycle counter when the last byte arrived
+	union payload_t payload;
+};
+
+// Complete commands waiting for main loop - written only by interrupt at end, read only by main loop at start
+static struct command mailbox[COMMAND_MAILBOX_SIZE];
+static volatile uint8_t mailboxStart = 0, mailboxEnd = 0;
+
+static struct stageProfile pcComProfiles[NUMBER_OF_PC_COM_PROFILES];
+
+// Length of payload of each command - commands not listed here do not contain payload
+static const uint8_t payloadLengths[NUMBER_OF_COMMANDS] = {
+	[SET_TRIGGER] = 4, [SET_MODE] = 1, [SET_SAMPLES] = 4, [SET_PRECISION] = 4, [SET_SEGMENTS] = 4,
+	[SET_ETS] = 1, [SET_DECIMATION] = 1, [SET_CONFIG] = sizeof(struct acquisitionConfig),
+	[SET_TRIGGER_CONFIG] = sizeof(struct triggerConfig), [SET_ADC_TIMING] = sizeof(struct adcTiming)
+};
+
+static void addToProfile(struct stageProfile* profile, uint32_t cycles) {
+	profile->calls++;
+	profile->cycles += cycles;
+	if(cycles > profile->maxCycles)
+		profile->maxCycles = cycles;
+}
+
+// Pass command being assembled to main loop. If mailbox is full, command is dropped - host gets no response
+static void postCommand(void) {
+	uint8_t next = (mailboxEnd + 1) % COMMAND_MAILBOX_SIZE;
+	if(next == mailboxStart)
+		return;
+	mailbox[mailboxEnd].received = DWT->CYCCNT;
+	mailboxEnd = next;
+}
+
+// Assemble command from byte received by USART interrupt - opcode is followed by number of payload
+// bytes given in payloadLengths. Complete command is posted to mailbox
+void receiveByte(uint8_t data) {
 	static int payloadLength;
 	static int payloadBytesReadSoFar = 0;
-	static char commandCode = 0;
-
-	if(!isQueueEmpty(&rxQueue)) {
-		switch(pcComCurrentState) {
-		case NEW_DATA:
-			GPIO_WriteBit(GPIOB, GPIO_Pin_8, 1 - GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_8));
-			popFromQueue(&rxQueue, (char*)&data);
-			commandCode = data;
-
-			if(data == PING || data >= IS_DATA_AVAIL)
-				return data;				// This commands does not contain payload
-			else if(data > TRIG_NOW)		// Command code is outside pcComCommands enum
-				return INVALID_COMMAND;
-			else {
-				pcComCurrentState = WAIT_FOR_PAYLOAD;
-				payloadBytesReadSoFar = 0;
-				if(data == SET_SAMPLES || data == SET_TRIGGER || data == SET_PRECISION)
-					payloadLength = 4;		// This commands contain 4 byte payload
-				else
-					payloadLength = 1;		// ... and this 1 byte payload
-				payload.dword = 0;
-				return WAIT_FOR_DATA;
-			}
-			break;
-
-		case WAIT_FOR_PAYLOAD:
-			popFromQueue(&rxQueue, (char*)&data);
-
-			payload.bytes[payloadBytesReadSoFar] = data;
-			payloadBytesReadSoFar++;
-
-			if(payloadBytesReadSoFar >= payloadLength) {
-				pcComCurrentState = NEW_DATA;
-				return commandCode;
-			}
-			break;
+	// Free slot at end of mailbox holds command being assembled
+	struct command* command = &mailbox[mailboxEnd];
+
+	switch(pcComCurrentState) {
+	case NEW_DATA:
+		if(data >= NUMBER_OF_COMMANDS) {		// Command code is outside pcComCommands enum
+			command->code = INVALID_COMMAND;
+			postCommand();
+		} else if(payloadLengths[data] == 0) {
+			command->code = data;				// This command does not contain payload
+			postCommand();
+		} else {
+			command->code = data;
+			command->payload.dword = 0;
+			pcComCurrentState = WAIT_FOR_PAYLOAD;
+			payloadBytesReadSoFar = 0;
+			payloadLength = payloadLengths[data];
 		}
+		break;
+
+	case WAIT_FOR_PAYLOAD:
+		command->payload.bytes[payloadBytesReadSoFar] = data;
+		payloadBytesReadSoFar++;
+
+		if(payloadBytesReadSoFar >= payloadLength) {
+			pcComCurrentState = NEW_DATA;
+			postCommand();
+		}
+		break;
 	}
-	return WAIT_FOR_DATA;
+}
+
+// Get message from host
+//		Returns: command represented as in pcComCommands enum, its payload is copied to global payload
+//				 including: WAIT_FOR_DATA - no complete command has arrived
+//							INVALID_COMMAND - host sent unknown command code
+int processPcCom(void) {
+	if(mailboxStart == mailboxEnd)
+		return WAIT_FOR_DATA;
+
+	struct command* command = &mailbox[mailboxStart];
+	int code = command->code;
+	payload = command->payload;
+#if CAPTURE_PROFILING
+	addToProfile(&pcComProfiles[PROFILE_DISPATCH], DWT->CYCCNT - command->received);
+#endif
+	mailboxStart = (mailboxStart + 1) % COMMAND_MAILBOX_SIZE;
+
+	GPIO_WriteBit(GPIOB, GPIO_Pin_8, 1 - GPIO_ReadInputDataBit(GPIOB, GPIO_Pin_8));
+	return code;
+}
+
+// Sleep until interrupt, unless command has already arrived
+//		Interrupts are masked, so command posted between check and WFI still wakes core. Sleep is timed
+//		with TIM2 (in microseconds), as core clock is stopped in WFI. The end is read after pending handlers
+//		have run, so overflow of TIM2 which woke core is already counted
+void waitForCommand(void) {
+	__disable_irq();
+	if(mailboxStart != mailboxEnd) {
+		__enable_irq();
+		return;
+	}
+#if CAPTURE_PROFILING
+	// Interrupt which woke core up has not run yet - neither has one of TIM2 overflow
+	uint32_t start = getTimestampWithIrqOff();
+	__WFI();
+	uint32_t sleep = getTimestampWithIrqOff() - start;
+	__enable_irq();
+	addToProfile(&pcComProfiles[PROFILE_SLEEP], sleep);
+#else
+	__WFI();
+	__enable_irq();
+#endif
+}
+
+// Copies measurements of communication to provided array and starts new measurement
+void takePcComProfiles(struct stageProfile* out) {
+	__disable_irq();
+	for(int i = 0; i < NUMBER_OF_PC_COM_PROFILES; i++) {
+		out[i] = pcComProfiles[i];
+		pcComProfiles[i].calls = pcComProfiles[i].cycles = pcComProfiles[i].maxCycles = 0;
+	}
+	__enable_irq();
 }
 
 // Send one byte to host
@@ -87,12 +164,84 @@ void sendDword(uint32_t data) {
 	sendWord(data >> 16);
 }
 
+// Send samples converted to millivolts - packed samples are unpacked, so format of transmission does not change
+static void sendSamples(int length, const uint8_t* samples) {
+	for(int i = 0; i < length; i++)
+		sendWord((loadSample(samples, i) * 8059) / 10000);
+}
+
 // Send samples stored in global samples[] array
-void sendProbes(int length, uint16_t* samples) {
+void sendProbes(int length, const uint8_t* samples) {
 	sendDword(length);		// Send number of samples as 4byte value
+	sendSamples(length, samples);
+	sendAck(0xff);			// End of transmission
+}
 
-	for(int i = 0; i < length; i++)
-		sendWord((samples[i] * 8059) / 10000);
+// Send all segments of segmented capture, each preceded by its timestamp
+void sendSegments(int count, int length, uint32_t* timestamps, const uint8_t* samples) {
+	sendDword(count);		// Send number of segments
+	sendDword(length);		// ... and number of samples in each of them
+
+	for(int i = 0; i < count; i++) {
+		sendDword(timestamps[i]);
+		sendSamples(length, samples + i * samplesSize(length, getSampleWidth()));
+	}
+
+	sendAck(0xff);			// End of transmission
+}
+
+// Send runs of logic analyser capture - value of inputs in 8 LSB, number of snapshots in 24 MSB
+void sendRuns(int count, const uint32_t* runs) {
+	sendDword(count);		// Send number of runs
+
+	for(int i = 0; i < count; i++)
+		sendDword(runs[i]);
+
+	sendAck(0xff);			// End of transmission
+}
+
+// Send structure byte by byte, followed by end of transmission
+static void sendStruct(const void* data, int size) {
+	const uint8_t* bytes = (const uint8_t*)data;
+	for(int i = 0; i < size; i++)
+		sendByte(bytes[i]);
+
+	sendAck(0xff);			// End of transmission
+}
+
+// Send acquisition parameters in the same layout as they are received
+void sendConfig(const struct acquisitionConfig* config) {
+	sendStruct(config, sizeof(struct acquisitionConfig));
+}
+
+// Send trigger condition in the same layout as it is received
+void sendTriggerConfig(const struct triggerConfig* config) {
+	sendStruct(config, sizeof(struct triggerConfig));
+}
+
+// Send current time of timestamp timer and time at which the last capture was triggered (in microseconds),
+// so host can place captures of several devices on its own time axis
+void sendTime(uint32_t now, uint32_t trigger) {
+	sendDword(now);
+	sendDword(trigger);
+
+	sendAck(0xff);			// End of transmission
+}
+
+// Send timing of ADC chosen in response to SET_ADC_TIMING in the same layout as it is received
+void sendAdcTiming(const struct adcTiming* timing) {
+	sendStruct(timing, sizeof(struct adcTiming));
+}
+
+// Send cost of capture stages measured in core cycles
+void sendProfiles(int count, struct stageProfile* profiles) {
+	sendDword(count);		// Send number of stages
+
+	for(int i = 0; i < count; i++) {
+		sendDword(profiles[i].calls);
+		sendDword(profiles[i].cycles);
+		sendDword(profiles[i].maxCycles);
+	}
 
 	sendAck(0xff);			// End of transmission
 }
@@ -9,10 +9,13 @@
 #include <stdio.h>
 #include "stm32f10x.h"
 #include "../inc/probe.h"
+#include "../inc/capture.h"
+#include "../inc/logic.h"
+#include "../inc/adc.h"
 #include "../inc/hd44780.h"
 
-// Global array, where taken samples will be stored
-uint16_t samples[MAX_NUMBER_OF_SAMPLES + 1];
+// Global array, where taken samples will be stored in format selected by sample width
+uint8_t samples[SAMPLES_MEMORY_SIZE + 2] __attribute__((aligned(4)));
 // Variable indicating how many samples has already been taken
 uint16_t currentNumberOfSamples = 0;
 // Current state of probing
@@ -22,36 +25,225 @@ uint32_t currentFreq = 1000;
 
 // The number of samples to be taken - value set by host
 int maxNumberOfSamples = 0;
-// Current probing mode - not implemented yet
-int probingMode = 0;
+// Current probing mode - ADC readings or snapshots of digital inputs (logic analyser)
+int probingMode = PROBING_ANALOG;
 // Value at which probing will be automatically started if in WAITING_FOR_TRIG state
 int triggerLevel = 0;
 
+// Number of segments samples[] is divided into - each trigger fills next segment
+int numberOfSegments = 1;
+// Number of segment currently being filled
+int currentSegment = 0;
+// Beginning of segment currently being filled
+uint8_t* segment = samples;
+// Time (in microseconds) at which each segment has been triggered
+uint32_t segmentTimestamps[MAX_NUMBER_OF_SEGMENTS];
+// Number of different sampling phases used in equivalent-time sampling, 1 - ETS disabled
+int etsSteps = 1;
+// Number of TIM2 overflows - upper half of timestamps
+volatile uint16_t timestampOverflows = 0;
+
+// If set, samples memory is divided into two buffers - finished capture waits for download in one
+// of them, while the next one is already being taken into the other one
+int autoRearm = 0;
+// Buffer currently being filled
+uint8_t* captureBuffer = samples;
+// Condition of trigger set by host
+struct triggerConfig trigger = {.type = TRIGGER_LEVEL};
+// Output impedance of measured source (in ohms) set by host - timing of ADC is chosen for it
+uint32_t sourceImpedance = 0;
+
+// Finished capture waiting for download (0 if none) and its number of samples
+uint8_t* volatile readySamples = 0;
+int readyLength = 0;
+
+// Checks if capture is in progress (including waiting for trigger of next segment)
+static int isBusy(void) {
+	return state == WORKING || (state == WAITING_FOR_TRIG && currentSegment > 0);
+}
+
+// Start filling samples memory from the first segment
+static void resetSegments(void) {
+	currentNumberOfSamples = 0;
+	currentSegment = 0;
+	segment = captureBuffer;
+}
+
+// Drop capture waiting for download and start filling from the first buffer
+static void resetPipeline(void) {
+	readySamples = 0;
+	captureBuffer = samples;
+}
+
+// Checks if segments of provided number of samples fit in samples memory (or in its half if captures are pipelined)
+static int fitsInMemory(int count, int segments, int width, int pipelined) {
+	uint32_t memory = pipelined ? SAMPLES_MEMORY_SIZE / 2 : SAMPLES_MEMORY_SIZE;
+	return count >= 0 && segments * samplesSize(count, width) <= memory;
+}
+
+// Checks if settings can be used by logic analyser - it takes single capture of runs, so segments,
+// equivalent-time sampling, averaging and second buffer are not supported
+static int fitsLogic(int segments, int steps, int decimation, int pipelined, uint32_t period) {
+	return segments == 1 && steps == 1 && decimation == 1 && !pipelined && isValidLogicPeriod(period);
+}
+
+// Checks if trigger condition is available - pattern of inputs only for logic analyser, pulse and runt
+// triggers only for analog mode without equivalent-time sampling, which is triggered by edge on PC5
+static int isValidTrigger(const struct triggerConfig* config, int digital, int steps) {
+	if(config->type == TRIGGER_LEVEL)
+		return 1;
+	if(digital)
+		return config->type == TRIGGER_PATTERN && config->mask != 0;
+	if(steps > 1)
+		return 0;
+	if(config->type == TRIGGER_PULSE)
+		return config->width > 0;
+	return config->type == TRIGGER_RUNT;
+}
+
+// Pass trigger condition to capture stages and logic analyser
+static void applyTrigger(void) {
+	int pattern = trigger.type == TRIGGER_PATTERN;
+	setTriggerCondition(trigger.type, trigger.flags, (trigger.upperLevel * 10000) / 8059, trigger.width);
+	setLogicPattern(pattern ? trigger.pattern : 0, pattern ? trigger.mask : 0);
+}
+
+// Fall back to level trigger if current condition is not available after change of mode or ETS
+static void validateTrigger(void) {
+	if(!isValidTrigger(&trigger, probingMode == PROBING_DIGITAL, etsSteps)) {
+		trigger = (struct triggerConfig){.type = TRIGGER_LEVEL};
+		applyTrigger();
+	}
+}
+
+// Choose timing of ADC for current sample clock and impedance of source - with ETS, conversions have to keep up
+// with rate of equivalent-time samples, so every phase reads a new conversion
+static void updateAdcTiming(void) {
+	struct adcTiming timing = {.frequency = SystemCoreClock / currentFreq * etsSteps, .impedance = sourceImpedance};
+	chooseAdcTiming(&timing);
+	applyAdcTiming(&timing);
+}
+
+// Start sample clock of current probing mode - SysTick takes ADC readings, TIM3 requests snapshots of port
+static void selectSampleClock(void) {
+	if(probingMode == PROBING_DIGITAL) {
+		SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+		captureIdle();
+		setLogicPeriod(currentFreq);
+	} else {
+		logicStop();
+		updateAdcTiming();
+		SysTick_Config(currentFreq);
+	}
+}
+
+// Start capture of logic analyser - runs are stored in samples memory
+static void startLogic(int immediately) {
+	logicStart((uint32_t*)samples, SAMPLES_MEMORY_SIZE / sizeof(uint32_t), maxNumberOfSamples, immediately);
+}
+
+// Wait for trigger of current segment. In equivalent-time sampling mode trigger comes
+// from edge detected by EXTI on PC5, as sampled level does not give exact phase
+static void armTrigger(void) {
+	state = WAITING_FOR_TRIG;
+	if(etsSteps > 1) {
+		captureIdle();
+		EXTI->PR = EXTI_Line5;
+		EXTI->IMR |= EXTI_Line5;
+	} else
+		captureWaitForTrigger();
+}
+
+// Postpones the next tick of SysTick by provided number of core cycles
+static void delaySampleClock(uint32_t cycles) {
+	uint32_t reload = SysTick->LOAD;
+	if(reload + cycles > 0xFFFFFF)
+		cycles = 0xFFFFFF - reload;
+
+	SysTick->LOAD = reload + cycles;
+	SysTick->VAL = 0;				// Counter reloads with extended value on next cycle
+	__NOP();
+	__NOP();
+	SysTick->LOAD = reload;			// ... and with original one afterwards
+	SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;	// Drop tick which could have been pending
+}
+
 // Set number of samples to be taken
 // 		Returns: 0 on success, 1 if value is invalid, 2 if device is currently taking samples
 int setMaxNumberOfSamples(int no) {
-	if(no > MAX_NUMBER_OF_SAMPLES || no < 0)
+	if(probingMode == PROBING_DIGITAL ? no < 0 || no > MAX_LOGIC_SAMPLES :
+			!fitsInMemory(no, numberOfSegments, getSampleWidth(), autoRearm))
 		return 1;
-	if(state == WORKING)
+	if(isBusy())
 		return 2;
 
 	maxNumberOfSamples = no;
 	return 0;
 }
 
-// Set probing mode
-//		Returns: 0 on success, 2 if device is busy
+// Set number of segments samples memory is divided into
+// 		Returns: 0 on success, 1 if segments would not fit in memory, 2 if device is busy
+int setNumberOfSegments(int no) {
+	if(no < 1 || no > MAX_NUMBER_OF_SEGMENTS || !fitsInMemory(maxNumberOfSamples, no, getSampleWidth(), autoRearm) ||
+			(autoRearm && no > 1) || (probingMode == PROBING_DIGITAL && no > 1))
+		return 1;
+	if(isBusy())
+		return 2;
+
+	numberOfSegments = no;
+	return 0;
+}
+
+// Set number of sampling phases used in equivalent-time sampling (1 disables it)
+//		Sampling of segment n starts (n % steps) / steps of sampling period later after trigger
+//		Returns: 0 on success, 1 if value is invalid, 2 if device is busy
+int setEtsSteps(int steps) {
+	if(steps < 1 || steps > MAX_NUMBER_OF_SEGMENTS || (probingMode == PROBING_DIGITAL && steps > 1))
+		return 1;
+	if(isBusy())
+		return 2;
+
+	etsSteps = steps;
+	if(probingMode == PROBING_ANALOG)
+		updateAdcTiming();
+	validateTrigger();
+	return 0;
+}
+
+// Set number of ADC readings averaged into one sample - logic analyser stores every snapshot of port
+//		Returns: 0 on success, 1 if value is invalid or not supported by probing mode, 2 if device is busy
+int setAveraging(int no) {
+	if(probingMode == PROBING_DIGITAL && !fitsLogic(numberOfSegments, etsSteps, no, autoRearm, currentFreq))
+		return 1;
+	if(isBusy())
+		return 2;
+	return setDecimation(no);
+}
+
+// Set probing mode - switching it stops probing
+//		Returns: 0 on success, 1 if mode is invalid or does not support current settings, 2 if device is busy
 int setProbingMode(int mode) {
-	if(state == WORKING)
+	if(mode == PROBING_DIGITAL) {
+		if(!fitsLogic(numberOfSegments, etsSteps, getDecimation(), autoRearm, currentFreq))
+			return 1;
+	} else if(mode != PROBING_ANALOG || !fitsInMemory(maxNumberOfSamples, numberOfSegments, getSampleWidth(), autoRearm))
+		return 1;
+	if(isBusy())
 		return 2;
-	probingMode = mode;
+
+	if(mode != probingMode) {
+		setOff();
+		probingMode = mode;
+		selectSampleClock();
+		validateTrigger();
+	}
 	return 0;
 }
 
 // Convert provided level to ADC value and set as new triggerLevel
 //		Returns: 0 on success, 1 if argument is invalid, 2 if busy
 int setTriggerLevel(int level) {
-	if(state == WORKING)
+	if(isBusy())
 		return 2;
 	if(level < 0)
 		return 1;
@@ -61,19 +253,139 @@ int setTriggerLevel(int level) {
 
 // Set frequency of timer used to take sample of signal
 int setFreq(uint32_t freq) {
-	if(state == WORKING)
+	if(isBusy())
 		return 2;
+	if(probingMode == PROBING_DIGITAL && !isValidLogicPeriod(freq))
+		return 1;
 	currentFreq = freq;
+	if(probingMode == PROBING_DIGITAL) {
+		setLogicPeriod(freq);
+		return 0;
+	}
+	updateAdcTiming();
 	if(SysTick_Config(freq))
 		return 2;
 	return 0;
 }
 
+// Set output impedance of measured source and choose timing of ADC for it and provided sample clock (0 - current one).
+// Chosen timing and the highest sample clock ADC can keep up with are written back to provided structure
+//		Returns: 0 on success, 1 if impedance is too high, 2 if device is busy
+int setAdcTiming(struct adcTiming* timing) {
+	if(timing->impedance > MAX_SOURCE_IMPEDANCE)
+		return 1;
+	if(isBusy())
+		return 2;
+
+	sourceImpedance = timing->impedance;
+	if(timing->frequency == 0)
+		timing->frequency = SystemCoreClock / currentFreq * etsSteps;
+	chooseAdcTiming(timing);
+	if(probingMode == PROBING_ANALOG)
+		applyAdcTiming(timing);
+	return 0;
+}
+
+// Validate all acquisition parameters and apply them at once - either all or none of them are changed
+//		Returns: 0 on success, 1 if any of parameters is invalid, 2 if device is busy
+int setConfig(const struct acquisitionConfig* config) {
+	uint32_t clock = config->frequency * config->decimation;
+	int width = config->sampleWidth ? config->sampleWidth : SAMPLE_WIDTH_16;
+	int digital = config->probingMode == PROBING_DIGITAL;
+	if(config->version != CONFIG_VERSION || config->probingMode > PROBING_DIGITAL || !isValidSampleWidth(width))
+		return 1;
+	if(config->numberOfSegments < 1 || config->numberOfSegments > MAX_NUMBER_OF_SEGMENTS || (!digital &&
+			!fitsInMemory(config->numberOfSamples, config->numberOfSegments, width, config->flags & CONFIG_AUTO_REARM)))
+		return 1;
+	if((config->flags & CONFIG_AUTO_REARM) && (config->numberOfSegments > 1 || config->etsSteps > 1))
+		return 1;
+	if(config->etsSteps < 1 || config->etsSteps > MAX_NUMBER_OF_SEGMENTS || !isValidDecimation(config->decimation))
+		return 1;
+	if(clock == 0 || clock / config->decimation != config->frequency || SystemCoreClock / clock > 0x1000000 ||
+			SystemCoreClock / clock == 0)
+		return 1;
+	if(digital && !fitsLogic(config->numberOfSegments, config->etsSteps, config->decimation,
+			config->flags & CONFIG_AUTO_REARM, SystemCoreClock / clock))
+		return 1;
+	// Trigger must not fire between the check of state and the end of applying parameters
+	__disable_irq();
+	if(isBusy()) {
+		__enable_irq();
+		return 2;
+	}
+
+	// Armed trigger is stopped, as segment may point to the second buffer of auto re-arm mode. It is armed
+	// again with new parameters, unless probing mode changes
+	int armed = state == WAITING_FOR_TRIG && config->probingMode == probingMode;
+	setOff();
+	// Store stage is idle now, so neither of them should be refused
+	if(setDecimation(config->decimation) != 0 || setSampleWidth(width) != 0) {
+		__enable_irq();
+		return 2;
+	}
+	probingMode = config->probingMode;
+	triggerLevel = (config->triggerLevel * 10000) / 8059;
+	maxNumberOfSamples = config->numberOfSamples;
+	numberOfSegments = config->numberOfSegments;
+	etsSteps = config->etsSteps;
+	autoRearm = config->flags & CONFIG_AUTO_REARM;
+	resetPipeline();
+	resetSegments();
+	currentFreq = SystemCoreClock / clock;
+	selectSampleClock();
+	validateTrigger();
+	__enable_irq();
+	if(armed)
+		setTrigMode();
+	return 0;
+}
+
+// Fill provided structure with current acquisition parameters
+void getConfig(struct acquisitionConfig* config) {
+	config->version = CONFIG_VERSION;
+	config->probingMode = probingMode;
+	config->triggerLevel = (triggerLevel * 8059 + 5000) / 10000;		// Rounded, so level does not drift
+	config->frequency = SystemCoreClock / (currentFreq * getDecimation());
+	config->numberOfSamples = maxNumberOfSamples;
+	config->numberOfSegments = numberOfSegments;
+	config->etsSteps = etsSteps;
+	config->decimation = getDecimation();
+	config->flags = autoRearm ? CONFIG_AUTO_REARM : 0;
+	config->sampleWidth = getSampleWidth();
+	config->reserved[0] = 0;
+}
+
+// Validate and apply trigger condition. Trigger which is already armed is re-armed with new condition
+//		Returns: 0 on success, 1 if condition is not available in current mode, 2 if device is busy
+int setTriggerConfig(const struct triggerConfig* config) {
+	if(config->type > TRIGGER_PATTERN || !isValidTrigger(config, probingMode == PROBING_DIGITAL, etsSteps))
+		return 1;
+	if(isBusy())
+		return 2;
+
+	trigger = *config;
+	applyTrigger();
+	if(state == WAITING_FOR_TRIG)
+		setTrigMode();
+	return 0;
+}
+
+// Fill provided structure with current trigger condition
+void getTriggerConfig(struct triggerConfig* config) {
+	*config = trigger;
+}
+
 // Trigger probing now
 int triggerNow(void) {
 	if(state != WORKING) {
-		currentNumberOfSamples = 0;
+		resetPipeline();
+		resetSegments();
+		segmentTimestamps[0] = getTimestamp();
 		state = WORKING;
+		if(probingMode == PROBING_DIGITAL)
+			startLogic(1);
+		else
+			captureStart();
 	} else
 		return 2;
 	return 0;
@@ -82,20 +394,49 @@ int triggerNow(void) {
 // Disable probing
 int setOff(void) {
 	state = OFF;
-	currentNumberOfSamples = 0;
+	captureIdle();
+	logicStop();
+	EXTI->IMR &= ~EXTI_Line5;
+	resetPipeline();
+	resetSegments();
 	return 0;
 }
 
 // Enable WAITING_FOR_TRIG state
 int setTrigMode(void) {
 	if(state != WORKING) {
-		currentNumberOfSamples = 0;
-		state = WAITING_FOR_TRIG;
+		resetPipeline();
+		resetSegments();
+		if(probingMode == PROBING_DIGITAL) {
+			state = WAITING_FOR_TRIG;
+			startLogic(0);
+		} else
+			armTrigger();
 	} else
 		return 2;
 	return 0;
 }
 
+// Returns time in microseconds measured by free running TIM2
+uint32_t getTimestamp(void) {
+	uint16_t high, low;
+	// Read again if overflow occurred in the meantime
+	do {
+		high = timestampOverflows;
+		low = TIM_GetCounter(TIM2);
+	} while(high != timestampOverflows);
+	return ((uint32_t)high << 16) | low;
+}
+
+// Returns time like getTimestamp() when interrupts are disabled - overflow whose interrupt is still pending
+// is added, if counter was read after it
+uint32_t getTimestampWithIrqOff(void) {
+	uint32_t timestamp = getTimestamp();
+	if(TIM_GetFlagStatus(TIM2, TIM_FLAG_Update) == SET && (timestamp & 0xFFFF) < 0x8000)
+		timestamp += 0x10000;
+	return timestamp;
+}
+
 // Returns current state of probing
 int getState(void) {
 	return state;
@@ -127,7 +468,13 @@ void printState(void) {
 		cpState = '0' + (state % 10);
 
 	snprintf(firstLine, sizeof(firstLine), "M:%c S:%c T:%d", cpProbingMode, cpState, triggerLevel);
-	snprintf(secondLine, sizeof(secondLine), "No:%d", maxNumberOfSamples);
+	if(etsSteps > 1)
+		snprintf(secondLine, sizeof(secondLine), "No:%d ETS:%d", maxNumberOfSamples, etsSteps);
+	else if(numberOfSegments > 1)
+		snprintf(secondLine, sizeof(secondLine), "No:%d S:%d/%d", maxNumberOfSamples,
+				currentSegment, numberOfSegments);
+	else
+		snprintf(secondLine, sizeof(secondLine), "No:%d", maxNumberOfSamples);
 
 
 	HD44780_Clear();
@@ -135,21 +482,90 @@ void printState(void) {
 	HD44780_Puts(0, 1, secondLine);
 }
 
-// Hander for SysTick interrupt
-void SysTick_Handler(void) {
-	if(state == OFF || state == FINISHED) {
-		// Do nothing
-	} else if(state == WAITING_FOR_TRIG) {
-		uint16_t sample = ADC_GetConversionValue(ADC1);
-		if(sample <= triggerLevel) {		// We have been triggered
-			state = WORKING;
-			currentNumberOfSamples = 0;
-			samples[currentNumberOfSamples++] = ADC_GetConversionValue(ADC1);
+// Called by trigger stage of capture when current segment has been triggered
+void segmentTriggered(void) {
+	segmentTimestamps[currentSegment] = getTimestamp();
+	currentNumberOfSamples = 0;
+	state = WORKING;
+	captureStart();
+}
+
+// Called by logic analyser when any input has changed in WAITING_FOR_TRIG state
+void logicTriggered(void) {
+	segmentTimestamps[0] = getTimestamp();
+	state = WORKING;
+}
+
+// Called by logic analyser when all snapshots have been taken or memory of runs is full
+void logicFinished(void) {
+	state = FINISHED;
+}
+
+// Hand filled buffer over for download and immediately start the next capture in the other buffer.
+// If the previous capture has not been downloaded yet, both buffers are full - wait for host
+static void bufferFilled(void) {
+	if(readySamples != 0) {
+		state = FINISHED;
+		captureIdle();
+		return;
+	}
+	readySamples = captureBuffer;
+	readyLength = currentNumberOfSamples;
+	captureBuffer = (captureBuffer == samples) ? samples + SAMPLES_MEMORY_SIZE / 2 : samples;
+	resetSegments();
+	state = WAITING_FOR_TRIG;
+	armTrigger();
+}
+
+// Called by store stage of capture when current segment is full
+void segmentFilled(void) {
+	if(++currentSegment < numberOfSegments) {
+		// Immediately wait for trigger of the next segment
+		segment += samplesSize(maxNumberOfSamples, getSampleWidth());
+		currentNumberOfSamples = 0;
+		armTrigger();
+	} else if(autoRearm)
+		bufferFilled();
+	else {					// We have reached expected number of samples
+		state = FINISHED;
+		captureIdle();
+	}
+}
+
+// Returns capture waiting for download in auto re-arm mode (0 if there is none) and its length
+uint8_t* getReadyCapture(int* length) {
+	*length = readyLength;
+	return readySamples;
+}
+
+// Called when capture has been downloaded - its buffer can be filled again
+void releaseReadyCapture(void) {
+	__disable_irq();
+	readySamples = 0;
+	if(autoRearm && state == FINISHED)
+		bufferFilled();			// Capture which waited for free buffer can be downloaded now
+	__enable_irq();
+}
+
+// Handler for EXTI5 interrupt - trigger of equivalent-time sampling
+void EXTI9_5_IRQHandler(void) {
+	if(EXTI_GetITStatus(EXTI_Line5) != RESET) {
+		EXTI_ClearITPendingBit(EXTI_Line5);
+		EXTI->IMR &= ~EXTI_Line5;			// Only one trigger per segment
+
+		if(state == WAITING_FOR_TRIG) {
+			// Restart sample clock, so the first sample is taken one period plus phase offset of segment after edge
+			// (period of stored samples is longer than period of sample clock when readings are averaged)
+			delaySampleClock((SysTick->LOAD + 1) * getDecimation() / etsSteps * (currentSegment % etsSteps));
+			segmentTriggered();
 		}
-	} else if(state == WORKING) {
-		if(currentNumberOfSamples < maxNumberOfSamples)
-			samples[currentNumberOfSamples++] = ADC_GetConversionValue(ADC1);
-		else					// We have reached expected number of samples
-			state = FINISHED;
+	}
+}
+
+// Handler for TIM2 interrupt - counts overflows of timestamp timer
+void TIM2_IRQHandler(void) {
+	if(TIM_GetITStatus(TIM2, TIM_IT_Update) != RESET) {
+		TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+		timestampOverflows++;
 	}
 }
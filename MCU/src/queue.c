@@ -8,7 +8,6 @@
 
 #include "../inc/queue.h"
 
-Queue rxQueue;					// Global queue used to store data received via USART
 Queue txQueue;					// Global queue containing data to be send via USART
 
 void clearQueue(Queue* q) {